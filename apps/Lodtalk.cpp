@@ -1,5 +1,6 @@
 #include <string>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "Lodtalk/VMContext.hpp"
 #include "Lodtalk/InterpreterProxy.hpp"
@@ -10,6 +11,59 @@ VMContext *context = nullptr;
 void printHelp()
 {
     printf("LodtalkRunner\n");
+    printf("Usage: Lodtalk [options] <script | ->\n");
+    printf("    -incremental-gc                   Mark the heap incrementally\n");
+    printf("    -gc-pause-budget <microseconds>   Maximum pause of a marking increment\n");
+    printf("    -gc-compaction-threshold <percent> Dead heap percentage that triggers a compaction\n");
+    printf("    -max-heap <size>                  Maximum size of the heap. Accepts K, M and G suffixes\n");
+    printf("    -initial-heap <size>              Memory used before the first collection\n");
+    printf("    -gc-ratio <percent>               Target percentage of the time spent in the GC\n");
+    printf("    -huge-pages                       Request transparent huge pages for the heap\n");
+    printf("    -gc-log <file>                    Write the statistics of each collection into a file\n");
+    printf("    -alloc-profile <size>             Sample the allocations every <size> bytes and report them at exit\n");
+    printf("    -compiler-threads <count>         Number of threads that compile the method definitions\n");
+    printf("    -lazy-compile                     Compile the methods when they are used for the first time,\n");
+    printf("                                      except for the scripts that are recorded into the script cache\n");
+    printf("    -compiler-stats                   Report the throughput of the compiler at exit\n");
+    printf("    -script-cache                     Cache the compiled scripts in .lodtalkc files next to them\n");
+    printf("    -script-cache-dir <directory>     Cache the compiled scripts in a directory\n");
+    printf("    -image <file>                     Load the kernel from an image instead of its sources\n");
+    printf("    -save-image <file>                Save an image after loading the kernel\n");
+}
+
+size_t parseMemorySize(const char *string)
+{
+    char *suffix = nullptr;
+    size_t size = strtoull(string, &suffix, 10);
+    switch(*suffix)
+    {
+    case 'g':
+    case 'G':
+        size *= 1024;
+        // Fall through
+    case 'm':
+    case 'M':
+        size *= 1024;
+        // Fall through
+    case 'k':
+    case 'K':
+        size *= 1024;
+        break;
+    default:
+        break;
+    }
+
+    return size;
+}
+
+void writeAllocationProfile()
+{
+    context->writeAllocationProfile(stderr);
+}
+
+void writeCompilerStatistics()
+{
+    context->writeCompilerStatistics(stderr);
 }
 
 void loadKernel()
@@ -19,9 +73,23 @@ void loadKernel()
 
 int main(int argc, const char *argv[])
 {
-    context = createVMContext();
-
     std::string scriptFilename;
+    bool incrementalGC = false;
+    size_t gcPauseBudget = 1000;
+    int gcCompactionThreshold = -1;
+    size_t maxHeapSize = 0;
+    size_t initialHeapSize = 0;
+    size_t gcRatio = 0;
+    bool hugePages = false;
+    std::string gcLogFileName;
+    size_t allocationSamplingInterval = 0;
+    bool compilerStatistics = false;
+    size_t compilerThreadCount = 0;
+    bool lazyCompilation = false;
+    bool scriptCache = false;
+    std::string scriptCacheDirectory;
+    std::string imageFileName;
+    std::string saveImageFileName;
 
     for(int i = 1; i < argc; ++i)
     {
@@ -31,20 +99,154 @@ int main(int argc, const char *argv[])
             printHelp();
             return 0;
         }
+        else if(!strcmp(argv[i], "-incremental-gc"))
+        {
+            incrementalGC = true;
+        }
+        else if(!strcmp(argv[i], "-gc-pause-budget") && i + 1 < argc)
+        {
+            incrementalGC = true;
+            gcPauseBudget = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-gc-compaction-threshold") && i + 1 < argc)
+        {
+            gcCompactionThreshold = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-max-heap") && i + 1 < argc)
+        {
+            maxHeapSize = parseMemorySize(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-initial-heap") && i + 1 < argc)
+        {
+            initialHeapSize = parseMemorySize(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-gc-ratio") && i + 1 < argc)
+        {
+            gcRatio = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-huge-pages"))
+        {
+            hugePages = true;
+        }
+        else if(!strcmp(argv[i], "-gc-log") && i + 1 < argc)
+        {
+            gcLogFileName = argv[++i];
+        }
+        else if(!strncmp(argv[i], "--gc-log=", 9))
+        {
+            gcLogFileName = argv[i] + 9;
+        }
+        else if(!strcmp(argv[i], "-alloc-profile") && i + 1 < argc)
+        {
+            allocationSamplingInterval = parseMemorySize(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-compiler-threads") && i + 1 < argc)
+        {
+            compilerThreadCount = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(!strcmp(argv[i], "-lazy-compile"))
+        {
+            lazyCompilation = true;
+        }
+        else if(!strcmp(argv[i], "-compiler-stats"))
+        {
+            compilerStatistics = true;
+        }
+        else if(!strcmp(argv[i], "-script-cache"))
+        {
+            scriptCache = true;
+        }
+        else if(!strcmp(argv[i], "-script-cache-dir") && i + 1 < argc)
+        {
+            scriptCache = true;
+            scriptCacheDirectory = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-image") && i + 1 < argc)
+        {
+            imageFileName = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-save-image") && i + 1 < argc)
+        {
+            saveImageFileName = argv[++i];
+        }
         else
         {
             scriptFilename = argv[i];
         }
     }
 
-    if(scriptFilename.empty())
+    if(scriptFilename.empty() && saveImageFileName.empty())
     {
         printHelp();
         return -1;
     }
 
+    // Create the context. The image already contains the kernel.
+    if(!imageFileName.empty())
+    {
+        context = createVMContextFromImage(imageFileName);
+        if(!context)
+        {
+            fprintf(stderr, "Failed to load the image '%s'\n", imageFileName.c_str());
+            return -1;
+        }
+    }
+    else
+    {
+        context = createVMContext();
+    }
+
+    // Set the garbage collector mode.
+    if(incrementalGC)
+        context->setIncrementalMarking(true, gcPauseBudget);
+    if(gcCompactionThreshold >= 0)
+        context->setCompactionThreshold(gcCompactionThreshold);
+    if(maxHeapSize)
+        context->setMaxHeapSize(maxHeapSize);
+    if(initialHeapSize)
+        context->setInitialHeapSize(initialHeapSize);
+    if(gcRatio)
+        context->setTargetGCRatio(gcRatio);
+    if(hugePages)
+        context->enableHugePages();
+    if(!gcLogFileName.empty() && !context->setGCLogFile(gcLogFileName))
+    {
+        fprintf(stderr, "Failed to open the GC log file '%s'\n", gcLogFileName.c_str());
+        return -1;
+    }
+
+    // Profile the allocations. The report is also written when the script quits.
+    if(allocationSamplingInterval)
+    {
+        context->setAllocationSamplingInterval(allocationSamplingInterval);
+        atexit(writeAllocationProfile);
+    }
+
+    if(compilerThreadCount)
+        context->setCompilerThreadCount(compilerThreadCount);
+    if(lazyCompilation)
+        context->setLazyMethodCompilation(true);
+    if(scriptCache)
+    {
+        context->setScriptCacheEnabled(true);
+        context->setScriptCacheDirectory(scriptCacheDirectory);
+    }
+
+    // Report the compiler throughput, including the kernel compilation.
+    if(compilerStatistics)
+        atexit(writeCompilerStatistics);
+
     // Execute the kernel script
-    loadKernel();
+    if(imageFileName.empty())
+        loadKernel();
+
+    if(!saveImageFileName.empty())
+    {
+        if(!context->saveImage(saveImageFileName))
+            return -1;
+        if(scriptFilename.empty())
+            return 0;
+    }
 
     // Execute the source script.
     if(scriptFilename == "-")
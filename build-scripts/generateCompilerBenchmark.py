@@ -0,0 +1,57 @@
+#!/usr/bin/python
+# Generates a large source file for measuring the throughput of the compiler.
+# Usage: generateCompilerBenchmark.py <output> [classes] [methods per class]
+# Run the output with the -compiler-stats option of Lodtalk.
+import sys
+
+# The literal frame of a method has room for 256 literals.
+TABLE_LITERAL_COUNT = 200
+TABLE_STATEMENT_COUNT = 2000
+
+def tableLiteral(index):
+    kind = index % 3
+    if kind == 0:
+        return str(100000 + index)
+    elif kind == 1:
+        return "#symbol%d" % index
+    return "'string%d'" % index
+
+def writeClass(out, classIndex, methodCount):
+    className = "Bench%d" % classIndex
+    out.write("Object subclass: #%s instanceVariableNames: 'a b c' category: 'CompilerBenchmark'.\n" % className)
+    out.write("self class: %s.\n\n" % className)
+
+    for i in range(methodCount):
+        kind = i % 4
+        if kind == 0:
+            out.write("self method [\naccessor%d\n    ^ a\n].\n\n" % i)
+        elif kind == 1:
+            out.write("self method [\narithmetic%d: x\n    | t |\n    t := x * %d + b.\n    ^ (t // 3) - (c max: t)\n].\n\n" % (i, i))
+        elif kind == 2:
+            out.write("self method [\ncontrol%d: x\n    | s |\n    s := 0.\n    1 to: x do: [:i | (i \\\\ 2) = 0 ifTrue: [s := s + i] ifFalse: [s := s - 1]].\n    ^ s > %d ifTrue: [#big] ifFalse: [#small]\n].\n\n" % (i, i))
+        else:
+            out.write("self method [\nsends%d\n    ^ (self accessor0 printString , 'x%d') size + (Array new: %d) size\n].\n\n" % (i, i, i % 16))
+
+    # A method with a large literal table, where each literal is used many times.
+    out.write("self method [\ntable\n    | x |\n")
+    for i in range(TABLE_STATEMENT_COUNT):
+        out.write("    x := %s.\n" % tableLiteral(i % TABLE_LITERAL_COUNT))
+    out.write("    ^ x\n].\n\n")
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: generateCompilerBenchmark.py <output> [classes] [methods per class]")
+        sys.exit(1)
+
+    outputFileName = sys.argv[1]
+    classCount = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+    methodCount = int(sys.argv[3]) if len(sys.argv) > 3 else 100
+
+    with open(outputFileName, "w") as out:
+        out.write("\"Generated by generateCompilerBenchmark.py\"\n")
+        for i in range(classCount):
+            writeClass(out, i, methodCount)
+
+        out.write("self function [\nmain\n    ^ Bench0 new table\n].\n")
+
+main()
@@ -96,9 +96,13 @@ public:
 
     void finish();
 
+    // Binds the native methods of a class that was loaded from an image.
+    void rebindNativeMethods();
+
 private:
     void createClassMethodDict();
     void createMetaclassMethodDict();
+    void rebindNativeMethodsOf(Oop description, const std::unordered_map<std::string, PrimitiveFunction> &methods);
 
     VMContext *context;
     Ref<Class> clazz;
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <string>
 #include "Lodtalk/Object.hpp"
+#include "Lodtalk/VMContext.hpp"
 
 namespace Lodtalk
 {
@@ -284,14 +285,16 @@ protected:
 		auto position = findKeyPosition(keyFunction(keyValue), keyFunction, hashFunction, equalityFunction);
 		if(position < 0)
 		{
-            OopRef keyValueRef(context, keyValue);
+            HandleScope scope(context);
+            Handle<ProtoObject> keyValueHandle(context, keyValue);
 			increaseCapacity(context, keyFunction, hashFunction, equalityFunction);
-			return internalPutKeyValue(context, keyValueRef.oop, keyFunction, hashFunction, equalityFunction);
+			return internalPutKeyValue(context, keyValueHandle.getOop(), keyFunction, hashFunction, equalityFunction);
 		}
 
 		// Put the key and value.
 		auto keyValueArray = getHashTableKeyValues();
 		auto oldKeyValue = keyValueArray[position];
+        context->writeBarrier(oldKeyValue, keyValue);
 		keyValueArray[position] = keyValue;
 
 		// Increase the size.
@@ -305,6 +308,7 @@ protected:
 		// Store temporarily the data.
 		auto oldKeyValues = Oop::fromPointer(keyValues);
 		size_t oldCapacity = capacityObject.decodeSmallInteger();
+        context->writeBarrier(oldKeyValues);
 
 		// Create the new capacity.
 		capacityObject = Oop::encodeSmallInteger(newCapacity);
@@ -348,7 +352,17 @@ public:
 
 	static MethodDictionary* basicNativeNew(VMContext *context);
 
-	Oop atOrNil(Oop key)
+	// Gets a method for calling it. The methods that were installed as a lazy stub are compiled here.
+	Oop atOrNil(VMContext *context, Oop key)
+	{
+		auto method = internalAtOrNil(key);
+		if(classIndexOf(method) == SCI_MethodASTHandle)
+			return compileLazyMethod(context, method);
+		return method;
+	}
+
+	// Gets a method or its lazy stub, without compiling it.
+	Oop rawAtOrNil(Oop key)
 	{
 		return internalAtOrNil(key);
 	}
@@ -375,6 +389,8 @@ public:
     static int stAtPut(InterpreterProxy *interpreter);
 
 protected:
+	Oop compileLazyMethod(VMContext *context, Oop stub);
+
 	MethodDictionary()
 	{
 		object_header_ = ObjectHeader::specialNativeClass(generateIdentityHash(this), SCI_MethodDictionary, 4);
@@ -418,16 +434,19 @@ protected:
 		auto position = findKeyPosition(key, identityFunction<Oop>, identityHashOf, identityOopEquals);
 		if(position < 0)
 		{
-            OopRef keyRef(context, key);
-            OopRef valueRef(context, value);
+            HandleScope scope(context);
+            Handle<ProtoObject> keyHandle(context, key);
+            Handle<ProtoObject> valueHandle(context, value);
 			increaseCapacity(context);
-            return internalAtPut(context, keyRef.oop, valueRef.oop);
+            return internalAtPut(context, keyHandle.getOop(), valueHandle.getOop());
 		}
 
 		// Put the key and value.
 		auto keyArray = getHashTableKeys();
 		auto valueArray = getHashTableValues();
 		auto oldKey = keyArray[position];
+        context->writeBarrier(oldKey, key);
+        context->writeBarrier(valueArray[position], value);
 		keyArray[position] = key;
 		valueArray[position] = value;
 
@@ -442,6 +461,8 @@ protected:
         auto oldKeys = Oop::fromPointer(keyValues);
         auto oldValues = Oop::fromPointer(values);
 		size_t oldCapacity = capacityObject.decodeSmallInteger();
+        context->writeBarrier(oldKeys);
+        context->writeBarrier(oldValues);
 
 		// Create the new capacity.
 		capacityObject = Oop::encodeSmallInteger(newCapacity);
@@ -65,6 +65,9 @@ public:
     // Message send.
     virtual void sendMessage(int argumentCount) = 0;
     virtual void sendMessageWithSelector(Oop selector, int argumentCount) = 0;
+
+    // Activates a compiled method with the receiver and the arguments in the stack.
+    virtual void executeMethod(Oop method, int argumentCount) = 0;
 };
 
 } // End of namespace VMContext
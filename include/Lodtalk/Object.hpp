@@ -58,6 +58,7 @@ public:
 	static int stAtPut(InterpreterProxy *interpreter);
     static int stIdentityEqual(InterpreterProxy *interpreter);
     static int stIdentityHash(InterpreterProxy *interpreter);
+    static int stIsPinned(InterpreterProxy *interpreter);
 
     static SpecialNativeClassFactory Factory;
 };
@@ -78,13 +79,16 @@ public:
 
 	static int stBasicNew(InterpreterProxy *interpreter);
 	static int stBasicNewSize(InterpreterProxy *interpreter);
+	static int stBasicNewPinned(InterpreterProxy *interpreter);
+	static int stBasicNewPinnedSize(InterpreterProxy *interpreter);
     static int stRegisterInClassTable(InterpreterProxy *interpreter);
 
 	Object *basicNativeNew(VMContext *context);
 	Object *basicNativeNew(VMContext *context, size_t indexableSize);
+	Object *basicNativeNewPinned(VMContext *context, size_t indexableSize);
 
-	Oop superLookupSelector(Oop selector);
-	Oop lookupSelector(Oop selector);
+	Oop superLookupSelector(VMContext *context, Oop selector);
+	Oop lookupSelector(VMContext *context, Oop selector);
 
 	Oop getBinding(VMContext *context);
 
@@ -417,6 +421,13 @@ public:
     static int stExitToDebugger(InterpreterProxy *interpreter);
     static int stNativeBreakpoint(InterpreterProxy *interpreter);
     static int stWordSize(InterpreterProxy *interpreter);
+    static int stVMParameterAt(InterpreterProxy *interpreter);
+    static int stVMParameterAtPut(InterpreterProxy *interpreter);
+    static int stGCStatistics(InterpreterProxy *interpreter);
+    static int stGarbageCollect(InterpreterProxy *interpreter);
+    static int stAllocationSamplingIntervalPut(InterpreterProxy *interpreter);
+    static int stWriteAllocationProfile(InterpreterProxy *interpreter);
+    static int stResetAllocationProfile(InterpreterProxy *interpreter);
 
     Oop globals;
 };
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string>
+#include <vector>
 #include "Lodtalk/Definitions.h"
 
 #if UINTPTR_MAX > UINT32_MAX
@@ -75,7 +76,7 @@ enum ObjectFormat
 	OF_VARIABLE_SIZE_NO_IVARS = 2,
 	OF_VARIABLE_SIZE_IVARS = 3,
 	OF_WEAK_VARIABLE_SIZE = 4,
-	OF_WEAK_FIXED_SIZE = 5,
+	OF_EPHEMERON = 5,
 	OF_INDEXABLE_64 = 9,
 	OF_INDEXABLE_32 = 10,
 	OF_INDEXABLE_32_1,
@@ -186,6 +187,11 @@ enum class CompilerOptimizedSelector
     // Iteration
     ToByDo,
     ToDo,
+    TimesRepeat,
+
+    // Logic
+    And,
+    Or,
 
     CompilerMessageCount,
 };
@@ -218,7 +224,7 @@ inline size_t variableSlotSizeFor(ObjectFormat format)
 	case OF_VARIABLE_SIZE_IVARS:
 	case OF_WEAK_VARIABLE_SIZE:
 		return sizeof(void*);
-	case OF_WEAK_FIXED_SIZE:
+	case OF_EPHEMERON:
 		return 0;
 	case OF_INDEXABLE_64:
 		return 8;
@@ -331,27 +337,42 @@ struct ObjectHeader
 	unsigned int identityHash : 22;
 	unsigned int gcColor : 3;
 	unsigned int objectFormat : 5;
-	unsigned int reserved : 2;
+	unsigned int isFreeChunk : 1;
+	unsigned int reserved : 1;
 	unsigned int classIndex : 22;
 
 	static constexpr ObjectHeader specialNativeClass(unsigned int identityHash, unsigned int classIndex, uint8_t slotCount, ObjectFormat format = OF_FIXED_SIZE)
 	{
-		return {slotCount, false, true, identityHash, 0, (unsigned int)format, 0, classIndex};
+		return {slotCount, false, true, identityHash, 0, (unsigned int)format, 0, 0, classIndex};
 	}
 
 	static constexpr ObjectHeader emptySpecialNativeClass(unsigned int identityHash, unsigned int classIndex)
 	{
-		return {0, true, true, identityHash, 0, OF_EMPTY, 0, classIndex};
+		return {0, true, true, identityHash, 0, OF_EMPTY, 0, 0, classIndex};
 	}
 
 	static ObjectHeader emptyNativeClass(void *self, unsigned int classIndex)
 	{
-		return {0, true, true, generateIdentityHash(self), 0, OF_EMPTY, 0, classIndex};
+		return {0, true, true, generateIdentityHash(self), 0, OF_EMPTY, 0, 0, classIndex};
 	}
 
 };
 static_assert(sizeof(ObjectHeader) == 8, "Object header size must be 8");
 
+// The slot count of a big object is stored in the word that precedes its header.
+// The low byte of this word is also 255, so the heap can be parsed without extra words.
+static constexpr unsigned int BigObjectSlotCountMarker = 255;
+
+inline uint64_t encodeBigObjectSlotCount(size_t slotCount)
+{
+    return (uint64_t(slotCount) << 8) | BigObjectSlotCountMarker;
+}
+
+inline size_t decodeBigObjectSlotCount(uint64_t slotCountWord)
+{
+    return size_t(slotCountWord >> 8);
+}
+
 typedef intptr_t SmallIntegerValue;
 static constexpr SmallIntegerValue SmallIntegerMin = SmallIntegerValue(1) << (sizeof(SmallIntegerValue)*8 - 1);
 static constexpr SmallIntegerValue SmallIntegerMax = ~SmallIntegerMin;
@@ -410,9 +431,9 @@ class UndefinedObject;
 class True;
 class False;
 
-extern LODTALK_VM_EXPORT UndefinedObject NilObject;
-extern LODTALK_VM_EXPORT True TrueObject;
-extern LODTALK_VM_EXPORT False FalseObject;
+extern LODTALK_VM_EXPORT UndefinedObject &NilObject;
+extern LODTALK_VM_EXPORT True &TrueObject;
+extern LODTALK_VM_EXPORT False &FalseObject;
 
 struct LODTALK_VM_EXPORT Oop
 {
@@ -493,6 +514,11 @@ public:
 		return isPointer() && header->objectFormat >= OF_INDEXABLE_NATIVE_FIRST;
 	}
 
+	inline bool isPinned() const
+	{
+		return isPointer() && header->isPinned;
+	}
+
 	void *getFirstFieldPointer() const
 	{
 		if(!isPointer())
@@ -626,7 +652,7 @@ public:
 		if(header->slotCount == 255)
 		{
 			uint64_t *theSlotCount = reinterpret_cast<uint64_t*> (pointer - 8);
-			return static_cast<size_t> (*theSlotCount);
+			return decodeBigObjectSlotCount(*theSlotCount);
 		}
 
 		return header->slotCount;
@@ -665,7 +691,7 @@ public:
     inline size_t getNumberOfVariableElements(VMContext *context) const
 	{
         auto result = getNumberOfElements();
-        if(header->objectFormat == OF_VARIABLE_SIZE_IVARS)
+        if(header->objectFormat == OF_VARIABLE_SIZE_IVARS || header->objectFormat == OF_WEAK_VARIABLE_SIZE)
             return result - getFixedSlotCount(context);
         return result;
 	}
@@ -1019,6 +1045,147 @@ Ref<T> makeRef(T *pointer)
 	return Ref<T> (pointer);
 }
 
+// Number of handles in each chunk of a handle arena.
+static constexpr size_t HandleArenaChunkSize = 1024;
+
+/**
+ * Handle arena. Each thread has its own arena of handles, which are
+ * allocated by bumping a pointer and released by the handle scopes. The
+ * GC scans the used part of the arena as a range of roots.
+ */
+class LODTALK_VM_EXPORT HandleArena
+{
+public:
+    HandleArena(VMContext *context);
+    ~HandleArena();
+
+    Oop *allocate(Oop value)
+    {
+        if(top == limit)
+            addChunk();
+        *top = value;
+        return top++;
+    }
+
+    template<typename FT>
+    void handlesDo(const FT &f)
+    {
+        for(size_t i = 0; i < chunkCount; ++i)
+        {
+            auto chunk = chunks[i];
+            auto end = i + 1 == chunkCount ? top : chunk + HandleArenaChunkSize;
+            for(auto pos = chunk; pos < end; ++pos)
+                f(*pos);
+        }
+    }
+
+    VMContext *getContext() const
+    {
+        return context;
+    }
+
+private:
+    friend class HandleScope;
+
+    void addChunk();
+
+    VMContext *context;
+    std::vector<Oop*> chunks;
+    size_t chunkCount;
+    Oop *top;
+    Oop *limit;
+};
+
+// Gets the handle arena of the current thread.
+LODTALK_VM_EXPORT HandleArena *getHandleArena(VMContext *context);
+
+/**
+ * Handle scope. The handles created inside of the scope are released when
+ * the scope is destroyed. The scopes must be nested.
+ */
+class HandleScope
+{
+public:
+    HandleScope(VMContext *context)
+        : arena(getHandleArena(context)), chunkCount(arena->chunkCount), top(arena->top), limit(arena->limit)
+    {
+    }
+
+    ~HandleScope()
+    {
+        arena->chunkCount = chunkCount;
+        arena->top = top;
+        arena->limit = limit;
+    }
+
+private:
+    HandleScope(const HandleScope &) = delete;
+    HandleScope &operator=(const HandleScope &) = delete;
+
+    HandleArena *arena;
+    size_t chunkCount;
+    Oop *top;
+    Oop *limit;
+};
+
+/**
+ * Handle to an object for the native code. It is a slot of the handle arena,
+ * so it is only valid inside of the handle scope where it was created. Copying
+ * a handle copies the reference to the slot.
+ */
+template<typename T>
+class Handle
+{
+public:
+    Handle()
+        : location(nullptr) {}
+
+    Handle(VMContext *context)
+        : location(getHandleArena(context)->allocate(Oop())) {}
+
+    Handle(VMContext *context, T *pointer)
+        : location(getHandleArena(context)->allocate(Oop::fromPointer(pointer))) {}
+
+    Handle(VMContext *context, Oop oop)
+        : location(getHandleArena(context)->allocate(oop)) {}
+
+    T *operator->() const
+    {
+        assert(!isNil());
+        return reinterpret_cast<T*> (location->pointer);
+    }
+
+    T *get() const
+    {
+        return reinterpret_cast<T*> (location->pointer);
+    }
+
+    Oop getOop() const
+    {
+        return *location;
+    }
+
+    Handle<T> &operator=(T *pointer)
+    {
+        *location = Oop::fromPointer(pointer);
+        return *this;
+    }
+
+    Handle<T> &operator=(Oop oop)
+    {
+        *location = oop;
+        return *this;
+    }
+
+    bool isNil() const
+    {
+        return location->isNil();
+    }
+
+private:
+    Oop *location;
+};
+
 } // End of namespace Lodtalk
 
 #endif //LODTALK_OBJECT_MODEL_HPP_
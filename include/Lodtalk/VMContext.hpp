@@ -2,6 +2,7 @@
 #define LODTALK_VMCONTEXT_HPP_
 
 #include <string>
+#include <vector>
 #include <stdio.h>
 #include <functional>
 #include <unordered_map>
@@ -22,6 +23,8 @@ class GarbageCollector;
 class SpecialRuntimeObjects;
 class AbstractClassFactory;
 class SystemDictionary;
+class CompilerStatistics;
+class LazyMethodTable;
 
 typedef int (*PrimitiveFunction) (InterpreterProxy *proxy);
 typedef std::function<void (InterpreterProxy *)> WithInterpreterBlock;
@@ -35,6 +38,12 @@ public:
     VMContext();
     ~VMContext();
 
+    // Creates a context from an image file. Returns null if the image cannot be loaded.
+    static VMContext *loadImage(const std::string &fileName);
+
+    // Saves the object memory into an image file. It must be called outside of the interpreter.
+    bool saveImage(const std::string &fileName);
+
     MemoryManager *getMemoryManager();
     SpecialRuntimeObjects *getSpecialRuntimeObjects();
 
@@ -48,6 +57,7 @@ public:
     // Garbage collection interface
     void disableGC();
     void enableGC();
+    void collectGarbage();
 
     void registerGCRoot(Oop *gcroot, size_t size);
     void unregisterGCRoot(Oop *gcroot);
@@ -55,13 +65,53 @@ public:
     void registerThreadForGC();
     void unregisterThreadForGC();
     bool garbageCollectionSafePoint();
+    void writeBarrier(Oop oldValue, Oop newValue = Oop());
+    void setIncrementalMarking(bool enabled, size_t pauseBudgetMicroseconds);
+    void setCompactionThreshold(size_t percentage);
+    void setMaxHeapSize(size_t size);
+    void setInitialHeapSize(size_t size);
+    void setTargetGCRatio(size_t percentage);
+    void enableHugePages();
+
+    bool getVMParameter(int index, int64_t &result);
+    bool setVMParameter(int index, int64_t value);
+
+    bool setGCLogFile(const std::string &fileName);
+    void getGCStatistics(std::vector<int64_t> &counters);
+
+    // Allocation profiler
+    void setAllocationSamplingInterval(size_t bytes);
+    void writeAllocationProfile(FILE *output);
+    void resetAllocationProfile();
+
+    // Compiler
+    void setCompilerThreadCount(size_t count);
+    size_t getCompilerThreadCount() const;
+
+    // The method definitions of the scripts can be compiled when they are looked up for the first time.
+    void setLazyMethodCompilation(bool enabled);
+    bool isLazyMethodCompilationEnabled() const;
+    LazyMethodTable *getLazyMethodTable();
+    Oop compileLazyMethod(Oop stub);
+    void compileLazyMethods();
+
+    // The compiled code of the script files can be cached, next to the scripts or in a directory.
+    void setScriptCacheEnabled(bool enabled);
+    bool isScriptCacheEnabled() const;
+    void setScriptCacheDirectory(const std::string &directory);
+    const std::string &getScriptCacheDirectory() const;
+    CompilerStatistics *getCompilerStatistics();
+    void writeCompilerStatistics(FILE *output);
 
     void registerNativeObject(Oop object);
 
     // Object memory
-    uint8_t *allocateObjectMemory(size_t objectSize, bool bigObject);
+    uint8_t *allocateObjectMemory(size_t objectSize, bool bigObject, bool pinned = false);
     ObjectHeader *newObject(size_t fixedSlotCount, size_t indexableSize, ObjectFormat format, int classIndex, int identityHash = -1);
 
+    // Pinned objects are never moved by the GC, so native code can keep their address.
+    ObjectHeader *newPinnedObject(size_t fixedSlotCount, size_t indexableSize, ObjectFormat format, int classIndex);
+
     ObjectHeader *basicNativeNewFromClassIndex(size_t classIndex);
     ObjectHeader *basicNativeNewFromFactory(AbstractClassFactory *factory);
 
@@ -105,7 +155,12 @@ public:
     // Object creation
     Oop makeByteString(const std::string &content);
     Oop makeByteSymbol(const std::string &content);
+    Oop makeByteSymbol(const char *data, size_t size);
     Oop makeSelector(const std::string &content);
+    Oop makeSelector(const char *data, size_t size);
+
+    // Gets an existing symbol without creating it. Returns nil if there is no such symbol.
+    Oop findByteSymbol(const char *data, size_t size);
 
     // Global context.
     Oop getGlobalContext();
@@ -123,25 +178,39 @@ public:
 
     unsigned int instanceClassFactory(AbstractClassFactory *factory);
 
+    // Binds the native methods of a class that was loaded from an image.
+    bool rebindClassFactory(AbstractClassFactory *factory);
+
     // Primitives
     PrimitiveFunction findPrimitive(int primitiveIndex);
     void registerPrimitive(int primitiveIndex, PrimitiveFunction primitive);
     void registerNamedPrimitive(Oop name, Oop module, PrimitiveFunction primitive);
 
 private:
+    VMContext(bool bootstrap);
+
     void initialize();
+    bool initializeFromImage(const std::string &fileName);
+    ObjectHeader *allocateObject(size_t fixedSlotCount, size_t indexableSize, ObjectFormat format, int classIndex, int identityHash, bool pinned);
     void createGlobalDictionary();
     void instanceClassFactories();
 
     MemoryManager *memoryManager;
     SpecialRuntimeObjects *specialRuntimeObjects;
     SystemDictionary *globalDictionary;
+    CompilerStatistics *compilerStatistics;
+    size_t compilerThreadCount;
+    bool lazyMethodCompilation;
+    LazyMethodTable *lazyMethodTable;
+    bool scriptCacheEnabled;
+    std::string scriptCacheDirectory;
 
     std::unordered_map<AbstractClassFactory*, unsigned int> instancedClassFactories;
     std::unordered_map<int, PrimitiveFunction> numberedPrimitives;
 };
 
 LODTALK_VM_EXPORT VMContext *createVMContext();
+LODTALK_VM_EXPORT VMContext *createVMContextFromImage(const std::string &fileName);
 LODTALK_VM_EXPORT VMContext *getCurrentContext();
 LODTALK_VM_EXPORT void setCurrentContext(VMContext *context);
 
@@ -19,6 +19,11 @@ bool Node::isIdentifierExpression() const
 	return false;
 }
 
+bool Node::isMessageSendNode() const
+{
+    return false;
+}
+
 bool Node::isLiteral() const
 {
     return false;
@@ -29,11 +34,21 @@ bool Node::isReturnStatement() const
 	return false;
 }
 
+bool Node::isSelfReference() const
+{
+    return false;
+}
+
 bool Node::isSuperReference() const
 {
     return false;
 }
 
+bool Node::isMethodAST() const
+{
+    return false;
+}
+
 bool Node::isBlockExpression() const
 {
     return false;
@@ -123,9 +138,6 @@ MessageSendNode::MessageSendNode(const std::string &selector, Node *receiver, No
 
 MessageSendNode::~MessageSendNode()
 {
-	delete receiver;
-	for(auto &arg : arguments)
-		delete arg;
 }
 
 Oop MessageSendNode::acceptVisitor(ASTVisitor *visitor)
@@ -133,6 +145,11 @@ Oop MessageSendNode::acceptVisitor(ASTVisitor *visitor)
 	return visitor->visitMessageSendNode(this);
 }
 
+bool MessageSendNode::isMessageSendNode() const
+{
+    return true;
+}
+
 const std::string &MessageSendNode::getSelector() const
 {
 	return selector;
@@ -178,6 +195,24 @@ void MessageSendNode::appendChained(MessageSendNode *chainedMessage)
 	chainedMessages.push_back(chainedMessage);
 }
 
+bool MessageSendNode::hasConstantValue() const
+{
+    return constantValueRef != nullptr;
+}
+
+Oop MessageSendNode::getConstantValue() const
+{
+    return constantValueRef ? constantValueRef->oop : Oop();
+}
+
+void MessageSendNode::setConstantValue(Oop value)
+{
+    if(constantValueRef)
+        *constantValueRef = value;
+    else
+        constantValueRef.reset(new OopRef(value));
+}
+
 // Assignment expression
 AssignmentExpression::AssignmentExpression(Node *reference, Node *value)
 	: reference(reference), value(value)
@@ -186,8 +221,6 @@ AssignmentExpression::AssignmentExpression(Node *reference, Node *value)
 
 AssignmentExpression::~AssignmentExpression()
 {
-	delete reference;
-	delete value;
 }
 
 Oop AssignmentExpression::acceptVisitor(ASTVisitor *visitor)
@@ -215,8 +248,6 @@ SequenceNode::SequenceNode(Node *first)
 
 SequenceNode::~SequenceNode()
 {
-	for(auto &child : children)
-		delete child;
 }
 
 Oop SequenceNode::acceptVisitor(ASTVisitor *visitor)
@@ -252,7 +283,6 @@ ReturnStatement::ReturnStatement(Node *value)
 
 ReturnStatement::~ReturnStatement()
 {
-	delete value;
 }
 
 Oop ReturnStatement::acceptVisitor(ASTVisitor *visitor)
@@ -352,8 +382,6 @@ ArgumentList::ArgumentList(Argument *firstArgument)
 
 ArgumentList::~ArgumentList()
 {
-	for(auto &child : arguments)
-		delete child;
 }
 
 Oop ArgumentList::acceptVisitor(ASTVisitor *visitor)
@@ -379,8 +407,6 @@ BlockExpression::BlockExpression(ArgumentList *argumentList, SequenceNode *body)
 
 BlockExpression::~BlockExpression()
 {
-	delete argumentList;
-	delete body;
 }
 
 Oop BlockExpression::acceptVisitor(ASTVisitor *visitor)
@@ -448,7 +474,6 @@ MethodHeader::MethodHeader(const std::string &selector, ArgumentList *arguments)
 
 MethodHeader::~MethodHeader()
 {
-	delete arguments;
 }
 
 Oop MethodHeader::acceptVisitor(ASTVisitor *visitor)
@@ -480,9 +505,9 @@ MethodAST::MethodAST(VMContext *context, MethodHeader *header, PragmaList *pragm
 
 MethodAST::~MethodAST()
 {
-	delete header;
-    delete pragmaList;
-	delete body;
+    // The handle can outlive the tree.
+    if(!astHandle.isNil())
+        astHandle->ast = nullptr;
 }
 
 Oop MethodAST::acceptVisitor(ASTVisitor *visitor)
@@ -490,6 +515,11 @@ Oop MethodAST::acceptVisitor(ASTVisitor *visitor)
 	return visitor->visitMethodAST(this);
 }
 
+bool MethodAST::isMethodAST() const
+{
+    return true;
+}
+
 MethodHeader *MethodAST::getHeader() const
 {
 	return header;
@@ -525,8 +555,6 @@ PragmaList::PragmaList()
 
 PragmaList::~PragmaList()
 {
-    for(auto pragma : pragmas)
-        delete pragma;
 }
 
 Oop PragmaList::acceptVisitor(ASTVisitor *visitor)
@@ -552,8 +580,6 @@ PragmaDefinition::PragmaDefinition(VMContext *context, const std::string &select
 
 PragmaDefinition::~PragmaDefinition()
 {
-    for(auto param : parameters)
-        delete param;
 }
 
 Oop PragmaDefinition::acceptVisitor(ASTVisitor *visitor)
@@ -583,6 +609,11 @@ Oop SelfReference::acceptVisitor(ASTVisitor *visitor)
 	return visitor->visitSelfReference(this);
 }
 
+bool SelfReference::isSelfReference() const
+{
+    return true;
+}
+
 // Super reference
 Oop SuperReference::acceptVisitor(ASTVisitor *visitor)
 {
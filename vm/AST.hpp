@@ -65,7 +65,8 @@ public:
 };
 
 /**
- * AST node
+ * AST node. The nodes are allocated in the arena of their tree, which owns
+ * them, so a node does not delete its children.
  */
 class Node
 {
@@ -77,9 +78,12 @@ public:
 
     virtual bool isLiteral() const;
 	virtual bool isIdentifierExpression() const;
+    virtual bool isMessageSendNode() const;
     virtual bool isBlockExpression() const;
 	virtual bool isReturnStatement() const;
+    virtual bool isSelfReference() const;
     virtual bool isSuperReference() const;
+    virtual bool isMethodAST() const;
 };
 
 /**
@@ -114,6 +118,8 @@ public:
 
 	virtual Oop acceptVisitor(ASTVisitor *visitor);
 
+    virtual bool isMessageSendNode() const override;
+
 	const std::string &getSelector() const;
 	Oop getSelectorOop() const;
 
@@ -128,11 +134,19 @@ public:
 	void appendArgument(Node *newArgument);
 	void appendChained(MessageSendNode *chainedMessage);
 
+    // The value of a message that is evaluated at compile time.
+    bool hasConstantValue() const;
+    Oop getConstantValue() const;
+    void setConstantValue(Oop value);
+
 private:
 	std::string selector;
 	Node *receiver;
 	std::vector<Node*> arguments;
 	std::vector<MessageSendNode*> chainedMessages;
+
+    // The reference is only allocated for the folded messages.
+    std::unique_ptr<OopRef> constantValueRef;
 };
 
 /**
@@ -381,6 +395,8 @@ public:
 
 	virtual Oop acceptVisitor(ASTVisitor *visitor);
 
+    virtual bool isMethodAST() const;
+
 	MethodHeader *getHeader() const;
     PragmaList *getPragmaList() const;
 	SequenceNode *getBody() const;
@@ -448,6 +464,8 @@ class SelfReference: public Node
 {
 public:
 	virtual Oop acceptVisitor(ASTVisitor *visitor);
+
+    virtual bool isSelfReference() const;
 };
 
 /**
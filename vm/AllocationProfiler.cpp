@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <math.h>
+#include <vector>
+#include "Lodtalk/VMContext.hpp"
+#include "Lodtalk/Object.hpp"
+#include "AllocationProfiler.hpp"
+#include "Method.hpp"
+#include "StackMemory.hpp"
+
+namespace Lodtalk
+{
+
+AllocationProfiler::AllocationProfiler(VMContext *context)
+    : context(context), samplingInterval(0), bytesUntilNextSample(0)
+{
+}
+
+AllocationProfiler::~AllocationProfiler()
+{
+}
+
+void AllocationProfiler::setSamplingInterval(size_t bytes)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    samplingInterval = bytes;
+    if(bytes)
+        bytesUntilNextSample = nextSampleDistance();
+}
+
+size_t AllocationProfiler::getSamplingInterval()
+{
+    return samplingInterval;
+}
+
+void AllocationProfiler::reset()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    sites.clear();
+}
+
+int64_t AllocationProfiler::nextSampleDistance()
+{
+    // Exponentially distributed distances give a Poisson sampling process.
+    std::exponential_distribution<double> distribution(1.0 / double(samplingInterval));
+    return std::max(int64_t(1), int64_t(distribution(randomGenerator)));
+}
+
+void AllocationProfiler::recordSample(size_t objectSize, int classIndex)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    if(!samplingInterval)
+        return;
+
+    // Another thread could have taken this sample.
+    auto remaining = bytesUntilNextSample.load();
+    if(remaining > 0)
+        return;
+
+    // Compute the distance to the next sample.
+    int64_t distance = 0;
+    while(remaining + distance <= 0)
+        distance += nextSampleDistance();
+    bytesUntilNextSample += distance;
+
+    // An object of this size is sampled with this probability.
+    auto probability = 1.0 - exp(-double(objectSize) / double(samplingInterval));
+
+    AllocationSite site;
+    site.classIndex = classIndex;
+    currentAllocationSite(site);
+
+    auto &counters = sites[site];
+    ++counters.sampleCount;
+    counters.sampledBytes += objectSize;
+    counters.estimatedBytes += double(objectSize) / probability;
+    counters.estimatedObjectCount += 1.0 / probability;
+}
+
+static bool findCallerMethodFrame(StackFrame &frame, size_t &pc)
+{
+    if(!frame.getPrevFramePointer())
+        return false;
+
+    pc = frame.getReturnPointer();
+    frame = frame.getPreviousFrame();
+    return true;
+}
+
+static bool findMethodFrame(StackFrame &frame, size_t &pc)
+{
+    // Primitives and native methods are attributed to the method that invoked them.
+    for(;;)
+    {
+        auto method = frame.getMethod();
+        if(classIndexOf(Oop::fromPointer(method)) == SCI_CompiledMethod && !method->hasPrimitive())
+            return true;
+
+        if(!findCallerMethodFrame(frame, pc))
+            return false;
+    }
+}
+
+void AllocationProfiler::currentAllocationSite(AllocationSite &site)
+{
+    site.method = "<vm>";
+    site.pc = 0;
+    site.senderPC = 0;
+
+    auto stack = getCurrentStackMemory();
+    if(!stack || stack->getContext() != context || !stack->getFramePointer())
+        return;
+
+    // The active frame uses the pc of the interpreter.
+    auto frame = stack->getCurrentFrame();
+    auto pcLocation = stack->getInstructionPointerLocation();
+    size_t pc = pcLocation ? *pcLocation : 0;
+    if(!findMethodFrame(frame, pc))
+        return;
+
+    site.method = methodNameOf(frame.getMethod());
+    site.pc = pc;
+
+    // The sender frame is the return pointer.
+    if(findCallerMethodFrame(frame, pc) && findMethodFrame(frame, pc))
+    {
+        site.senderMethod = methodNameOf(frame.getMethod());
+        site.senderPC = pc;
+    }
+}
+
+std::string AllocationProfiler::classNameOf(Oop clazz)
+{
+    if(!clazz.pointer || isNil(clazz))
+        return "nil";
+
+    if(context->isMetaclass(clazz))
+    {
+        auto meta = reinterpret_cast<Metaclass*> (clazz.pointer);
+        if(isNil(meta->thisClass))
+            return "a Metaclass";
+        return reinterpret_cast<Class*> (meta->thisClass.pointer)->getNameString() + " class";
+    }
+
+    return reinterpret_cast<Class*> (clazz.pointer)->getNameString();
+}
+
+std::string AllocationProfiler::methodNameOf(CompiledMethod *method)
+{
+    if(method->getLiteralCount() < 2)
+        return "a CompiledMethod";
+
+    std::string className = "nil";
+    auto binding = method->getClassBinding();
+    if(!isNil(binding))
+        className = classNameOf(reinterpret_cast<Association*> (binding.pointer)->value);
+
+    std::string selector = "doIt";
+    auto selectorOop = method->getSelector();
+    if(classIndexOf(selectorOop) == SCI_ByteSymbol)
+        selector = context->getByteSymbolData(selectorOop);
+
+    return className + ">>" + selector;
+}
+
+void AllocationProfiler::writeReport(FILE *output, size_t siteCount)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    typedef Sites::value_type Entry;
+
+    std::vector<const Entry*> entries;
+    size_t sampleCount = 0;
+    double estimatedBytes = 0;
+    double estimatedObjectCount = 0;
+    for(auto &entry : sites)
+    {
+        entries.push_back(&entry);
+        sampleCount += entry.second.sampleCount;
+        estimatedBytes += entry.second.estimatedBytes;
+        estimatedObjectCount += entry.second.estimatedObjectCount;
+    }
+
+    fprintf(output, "Allocation profile: %zu samples, %zu sites, sampling interval %zu bytes\n",
+        sampleCount, entries.size(), samplingInterval.load());
+    fprintf(output, "Estimated allocation: %.0f bytes in %.0f objects\n", estimatedBytes, estimatedObjectCount);
+
+    auto writeTable = [&](const char *title, double AllocationSiteCounters::*field) {
+        auto count = std::min(siteCount, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + count, entries.end(), [&](const Entry *a, const Entry *b) {
+            return a->second.*field > b->second.*field;
+        });
+
+        fprintf(output, "\nTop allocation sites by %s:\n", title);
+        fprintf(output, "%14s %12s %8s  %-24s %s\n", "bytes", "objects", "samples", "class", "site");
+        for(size_t i = 0; i < count; ++i)
+        {
+            auto &site = entries[i]->first;
+            auto &counters = entries[i]->second;
+            auto className = classNameOf(context->getClassFromIndex(site.classIndex));
+            fprintf(output, "%14.0f %12.0f %8zu  %-24s %s@%zu", counters.estimatedBytes, counters.estimatedObjectCount,
+                counters.sampleCount, className.c_str(), site.method.c_str(), site.pc);
+            if(!site.senderMethod.empty())
+                fprintf(output, " from %s@%zu", site.senderMethod.c_str(), site.senderPC);
+            fprintf(output, "\n");
+        }
+    };
+
+    writeTable("bytes", &AllocationSiteCounters::estimatedBytes);
+    writeTable("count", &AllocationSiteCounters::estimatedObjectCount);
+    fflush(output);
+}
+
+} // End of namespace Lodtalk
@@ -0,0 +1,109 @@
+#ifndef LODTALK_ALLOCATION_PROFILER_HPP
+#define LODTALK_ALLOCATION_PROFILER_HPP
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Lodtalk/ObjectModel.hpp"
+
+namespace Lodtalk
+{
+class VMContext;
+class CompiledMethod;
+
+// Number of allocation sites in each table of the report.
+static constexpr size_t DefaultAllocationReportSiteCount = 20;
+
+/**
+ * Allocation site. The methods are kept by name, because the GC can move
+ * the compiled methods.
+ */
+struct AllocationSite
+{
+    std::string method;
+    size_t pc;
+    std::string senderMethod;
+    size_t senderPC;
+    int classIndex;
+
+    bool operator<(const AllocationSite &other) const
+    {
+        if(classIndex != other.classIndex)
+            return classIndex < other.classIndex;
+        if(pc != other.pc)
+            return pc < other.pc;
+        if(senderPC != other.senderPC)
+            return senderPC < other.senderPC;
+        if(method != other.method)
+            return method < other.method;
+        return senderMethod < other.senderMethod;
+    }
+};
+
+/**
+ * Counters of an allocation site.
+ */
+struct AllocationSiteCounters
+{
+    AllocationSiteCounters()
+        : sampleCount(0), sampledBytes(0), estimatedBytes(0), estimatedObjectCount(0) {}
+
+    size_t sampleCount;
+    size_t sampledBytes;
+    double estimatedBytes;
+    double estimatedObjectCount;
+};
+
+/**
+ * Allocation profiler. It samples on average one allocation every N
+ * allocated bytes. The distance between samples is randomized, so
+ * periodic allocation patterns are not aliased into a single site.
+ */
+class AllocationProfiler
+{
+public:
+    AllocationProfiler(VMContext *context);
+    ~AllocationProfiler();
+
+    void setSamplingInterval(size_t bytes);
+    size_t getSamplingInterval();
+
+    inline void objectAllocated(size_t objectSize, int classIndex)
+    {
+        if(!samplingInterval.load(std::memory_order_relaxed))
+            return;
+
+        if(bytesUntilNextSample.fetch_sub(objectSize) - int64_t(objectSize) <= 0)
+            recordSample(objectSize, classIndex);
+    }
+
+    void reset();
+    void writeReport(FILE *output, size_t siteCount = DefaultAllocationReportSiteCount);
+
+private:
+    typedef std::map<AllocationSite, AllocationSiteCounters> Sites;
+
+    void recordSample(size_t objectSize, int classIndex);
+    int64_t nextSampleDistance();
+    void currentAllocationSite(AllocationSite &site);
+
+    std::string methodNameOf(CompiledMethod *method);
+    std::string classNameOf(Oop clazz);
+
+    VMContext *context;
+    std::atomic<size_t> samplingInterval;
+    std::atomic<int64_t> bytesUntilNextSample;
+
+    std::mutex mutex;
+    std::minstd_rand randomGenerator;
+    Sites sites;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_ALLOCATION_PROFILER_HPP
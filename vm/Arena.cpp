@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arena.hpp"
+
+namespace Lodtalk
+{
+
+static inline uintptr_t alignAddress(uintptr_t address, size_t alignment)
+{
+    return (address + alignment - 1) & ~uintptr_t(alignment - 1);
+}
+
+Arena::Arena()
+    : chunks(nullptr), position(nullptr), limit(nullptr), destructors(nullptr), allocatedSize(0)
+{
+}
+
+Arena::Arena(Arena &&other)
+    : chunks(other.chunks), position(other.position), limit(other.limit), destructors(other.destructors), allocatedSize(other.allocatedSize)
+{
+    other.chunks = nullptr;
+    other.position = other.limit = nullptr;
+    other.destructors = nullptr;
+    other.allocatedSize = 0;
+}
+
+Arena::~Arena()
+{
+    clear();
+}
+
+Arena &Arena::operator=(Arena &&other)
+{
+    if(this == &other)
+        return *this;
+
+    clear();
+    std::swap(chunks, other.chunks);
+    std::swap(position, other.position);
+    std::swap(limit, other.limit);
+    std::swap(destructors, other.destructors);
+    std::swap(allocatedSize, other.allocatedSize);
+    return *this;
+}
+
+void Arena::clear()
+{
+    // Destroy the objects, from the last one.
+    for(auto destructor = destructors; destructor; destructor = destructor->previous)
+        destructor->function(destructor->object);
+    destructors = nullptr;
+
+    // Release the chunks.
+    while(chunks)
+    {
+        auto previous = chunks->previous;
+        free(chunks);
+        chunks = previous;
+    }
+
+    position = limit = nullptr;
+    allocatedSize = 0;
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+    auto address = alignAddress(reinterpret_cast<uintptr_t> (position), alignment);
+    if(!position || address + size > reinterpret_cast<uintptr_t> (limit))
+        return allocateInNewChunk(size, alignment);
+
+    position = reinterpret_cast<uint8_t*> (address + size);
+    return reinterpret_cast<void*> (address);
+}
+
+void *Arena::allocateInNewChunk(size_t size, size_t alignment)
+{
+    auto requiredSize = sizeof(Chunk) + size + alignment;
+    auto isLarge = requiredSize > ArenaChunkSize;
+    auto chunkSize = isLarge ? requiredSize : ArenaChunkSize;
+
+    auto chunk = reinterpret_cast<Chunk*> (malloc(chunkSize));
+    if(!chunk)
+    {
+        fprintf(stderr, "Failed to allocate a chunk of %zu bytes for an arena.\n", chunkSize);
+        abort();
+    }
+
+    chunk->previous = chunks;
+    chunks = chunk;
+    allocatedSize += chunkSize;
+
+    auto address = alignAddress(reinterpret_cast<uintptr_t> (chunk + 1), alignment);
+
+    // Keep allocating from the current chunk after a large allocation.
+    if(!isLarge || !position)
+    {
+        position = reinterpret_cast<uint8_t*> (address + size);
+        limit = reinterpret_cast<uint8_t*> (chunk) + chunkSize;
+    }
+
+    return reinterpret_cast<void*> (address);
+}
+
+void Arena::registerDestructor(void *object, void (*function)(void*))
+{
+    auto destructor = reinterpret_cast<Destructor*> (allocate(sizeof(Destructor), alignof(Destructor)));
+    destructor->previous = destructors;
+    destructor->function = function;
+    destructor->object = object;
+    destructors = destructor;
+}
+
+} // End of namespace Lodtalk
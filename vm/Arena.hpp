@@ -0,0 +1,83 @@
+#ifndef LODTALK_ARENA_HPP
+#define LODTALK_ARENA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Lodtalk
+{
+
+// The size of the chunks of an arena. The larger allocations get their own chunk.
+static constexpr size_t ArenaChunkSize = 64*1024;
+
+/**
+ * Arena allocator. The objects are bump allocated in chunks, and they are
+ * released all at once with the arena. The destructors of the objects that
+ * need one are called in the reverse order of their construction.
+ * An arena can be moved, but not copied.
+ */
+class Arena
+{
+public:
+    Arena();
+    Arena(Arena &&other);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena &operator=(Arena &&other);
+
+    void *allocate(size_t size, size_t alignment);
+
+    template<typename T, typename... Args>
+    T *make(Args&&... args)
+    {
+        auto object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args> (args)...);
+        if(!std::is_trivially_destructible<T>::value)
+            registerDestructor(object, &destroy<T>);
+        return object;
+    }
+
+    // Destroys the objects and releases the memory.
+    void clear();
+
+    size_t getAllocatedSize() const
+    {
+        return allocatedSize;
+    }
+
+private:
+    struct Chunk
+    {
+        Chunk *previous;
+    };
+
+    struct Destructor
+    {
+        Destructor *previous;
+        void (*function)(void*);
+        void *object;
+    };
+
+    template<typename T>
+    static void destroy(void *object)
+    {
+        reinterpret_cast<T*> (object)->~T();
+    }
+
+    void *allocateInNewChunk(size_t size, size_t alignment);
+    void registerDestructor(void *object, void (*function)(void*));
+
+    Chunk *chunks;
+    uint8_t *position;
+    uint8_t *limit;
+    Destructor *destructors;
+    size_t allocatedSize;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_ARENA_HPP
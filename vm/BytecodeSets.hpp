@@ -37,6 +37,10 @@ constexpr int PushClosure_NumArgsShift = 0;
 
 #undef SISTAV1_INSTRUCTION_RANGE
 #undef SISTAV1_INSTRUCTION
+
+// The version of the code that is generated with this bytecode set. It is
+// increased when the compiler changes, so the cached compiled code is discarded.
+constexpr int BytecodeSetVersion = 1;
 };
 
 namespace BytecodeSet = SistaV1BytecodeSet;
@@ -67,26 +67,57 @@ void ClassBuilder::finish()
 void ClassBuilder::createClassMethodDict()
 {
     clazz->methodDict = MethodDictionary::basicNativeNew(context);
-    OopRef selector(context);
-    OopRef method(context);
+    HandleScope scope(context);
+    Handle<ByteSymbol> selector(context);
+    Handle<NativeMethod> method(context);
     for(auto &selectorAndMethod : primitiveMethods)
     {
         selector = ByteSymbol::fromNative(context, selectorAndMethod.first);
-        method = Oop::fromPointer(NativeMethod::create(context, selectorAndMethod.second));
-        clazz->methodDict->atPut(context, selector.oop, method.oop);
+        method = NativeMethod::create(context, selectorAndMethod.second);
+        clazz->methodDict->atPut(context, selector.getOop(), method.getOop());
     }
 }
 
 void ClassBuilder::createMetaclassMethodDict()
 {
     metaclass->methodDict = MethodDictionary::basicNativeNew(context);
-    OopRef selector(context);
-    OopRef method(context);
+    HandleScope scope(context);
+    Handle<ByteSymbol> selector(context);
+    Handle<NativeMethod> method(context);
     for(auto &selectorAndMethod : classSidePrimitiveMethods)
     {
         selector = ByteSymbol::fromNative(context, selectorAndMethod.first);
-        method = Oop::fromPointer(NativeMethod::create(context, selectorAndMethod.second));
-        metaclass->methodDict->atPut(context, selector.oop, method.oop);
+        method = NativeMethod::create(context, selectorAndMethod.second);
+        metaclass->methodDict->atPut(context, selector.getOop(), method.getOop());
+    }
+}
+
+void ClassBuilder::rebindNativeMethods()
+{
+    rebindNativeMethodsOf(clazz.getOop(), primitiveMethods);
+    rebindNativeMethodsOf(metaclass.getOop(), classSidePrimitiveMethods);
+}
+
+void ClassBuilder::rebindNativeMethodsOf(Oop descriptionOop, const std::unordered_map<std::string, PrimitiveFunction> &methods)
+{
+    HandleScope scope(context);
+    Handle<ClassDescription> description(context, descriptionOop);
+    Handle<ByteSymbol> selector(context);
+    Handle<NativeMethod> method(context);
+    for(auto &selectorAndMethod : methods)
+    {
+        // The methods that were replaced in the image are kept.
+        selector = ByteSymbol::fromNative(context, selectorAndMethod.first);
+        auto oldMethod = description->methodDict->rawAtOrNil(selector.getOop());
+        if(classIndexOf(oldMethod) == SCI_NativeMethod)
+        {
+            reinterpret_cast<NativeMethod*> (oldMethod.pointer)->primitive = selectorAndMethod.second;
+        }
+        else if(isNil(oldMethod))
+        {
+            method = NativeMethod::create(context, selectorAndMethod.second);
+            description->methodDict->atPut(context, selector.getOop(), method.getOop());
+        }
     }
 }
 
@@ -41,6 +41,15 @@ void ClassFactoryRegistry::unregisterVMContext(VMContext *context)
 {
 }
 
+void ClassFactoryRegistry::rebindVMContext(VMContext *context)
+{
+    // Bind the classes of the image, and then create the ones that are missing there.
+    for (auto factory : factories)
+        context->rebindClassFactory(factory);
+    for (auto factory : factories)
+        context->instanceClassFactory(factory);
+}
+
 LODTALK_VM_EXPORT void registerClassFactory(AbstractClassFactory *factory)
 {
     ClassFactoryRegistry::get()->registerFactory(factory);
@@ -22,6 +22,7 @@ public:
 
     void registerVMContext(VMContext *context);
     void unregisterVMContext(VMContext *context);
+    void rebindVMContext(VMContext *context);
 
     static ClassFactoryRegistry *get();
 
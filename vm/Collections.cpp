@@ -128,7 +128,8 @@ Oop ByteString::splitVariableNames(VMContext *context, const std::string &string
 		varNameIndices.push_back(std::make_pair(tokenStart, size - tokenStart));
 
 	// Allocate the result.
-	Ref<Array> result(context, Array::basicNativeNew(context, varNameIndices.size()));
+	HandleScope scope(context);
+	Handle<Array> result(context, Array::basicNativeNew(context, varNameIndices.size()));
 	for(size_t i = 0; i < varNameIndices.size(); ++i)
 	{
 		auto &startSize = varNameIndices[i];
@@ -182,25 +183,12 @@ Object *ByteSymbol::basicNativeNew(VMContext *context, size_t indexableSize)
 
 Oop ByteSymbol::fromNative(VMContext *context, const std::string &native)
 {
-	// Find existing internation
-    auto &dict = context->getMemoryManager()->getSymbolDictionary();
-	auto it = dict.find(native);
-	if(it != dict.end())
-		return it->second;
-
-	// Create the byte symbol
-	auto result = basicNativeNew(context, native.size());
-	memcpy(result->getFirstFieldPointer(), native.data(), native.size());
-
-	// Store in the internation dictionary.
-    auto resultOop = Oop::fromPointer(result);
-	dict[native] = resultOop;
-	return resultOop;
+	return fromNativeRange(context, native.data(), native.size());
 }
 
 Oop ByteSymbol::fromNativeRange(VMContext *context, const char *start, size_t size)
 {
-	return fromNative(context, std::string(start, start + size));
+	return context->getMemoryManager()->getSymbolTable()->intern(start, size);
 }
 
 SpecialNativeClassFactory ByteSymbol::Factory("ByteSymbol", SCI_ByteSymbol, &Symbol::Factory, [](ClassBuilder &builder) {
@@ -233,6 +221,11 @@ MethodDictionary* MethodDictionary::basicNativeNew(VMContext *context)
 	return res;
 }
 
+Oop MethodDictionary::compileLazyMethod(VMContext *context, Oop stub)
+{
+	return context->compileLazyMethod(stub);
+}
+
 int MethodDictionary::stAtOrNil(InterpreterProxy *interpreter)
 {
     if(interpreter->getArgumentCount() != 1)
@@ -241,7 +234,7 @@ int MethodDictionary::stAtOrNil(InterpreterProxy *interpreter)
     Oop selfOop = interpreter->getReceiver();
     Oop key = interpreter->getTemporary(0);
     auto self = reinterpret_cast<MethodDictionary*> (selfOop.pointer);
-    return interpreter->returnOop(self->atOrNil(key));
+    return interpreter->returnOop(self->atOrNil(interpreter->getContext(), key));
 }
 
 int MethodDictionary::stAtPut(InterpreterProxy *interpreter)
@@ -1,13 +1,21 @@
 #include <map>
+#include <chrono>
+#include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include "Lodtalk/Exception.hpp"
+#include "Lodtalk/Math.hpp"
 #include "Lodtalk/VMContext.hpp"
 #include "Lodtalk/InterpreterProxy.hpp"
+#include "Arena.hpp"
 #include "Compiler.hpp"
+#include "MemoryManager.hpp"
 #include "Method.hpp"
 #include "MethodBuilder.hpp"
 #include "ParserScannerInterface.hpp"
+#include "ScriptCache.hpp"
+#include "SourceBuffer.hpp"
+#include "WorkerPool.hpp"
 #include "FileSystem.hpp"
 #include "RAII.hpp"
 
@@ -275,7 +283,7 @@ VariableLookupPtr GlobalEvaluationScope::lookSymbol(Oop symbol)
 class InstanceVariableScope: public EvaluationScope
 {
 public:
-	InstanceVariableScope(const EvaluationScopePtr &parent, const Ref<ClassDescription> &classDesc)
+	InstanceVariableScope(const EvaluationScopePtr &parent, const Handle<ClassDescription> &classDesc)
 		: EvaluationScope(parent), classDesc(classDesc) {}
 
 	virtual VariableLookupPtr lookSymbol(Oop symbol);
@@ -283,7 +291,7 @@ public:
 private:
 	std::pair<int, int> findInstanceVariable(ClassDescription *pos, Oop symbol);
 
-	Ref<ClassDescription> classDesc;
+	Handle<ClassDescription> classDesc;
 	std::map<OopRef, VariableLookupPtr> lookupCache;
 };
 
@@ -446,7 +454,7 @@ public:
 
 private:
     InterpreterProxy *interpreter;
-	OopRef currentSelf;
+	Handle<ProtoObject> currentSelf;
 };
 
 Oop ASTInterpreter::visitArgument(Argument *node)
@@ -587,13 +595,13 @@ Oop ASTInterpreter::visitSequenceNode(SequenceNode *node)
 
 Oop ASTInterpreter::visitSelfReference(SelfReference *node)
 {
-    interpreter->pushOop(currentSelf.oop);
+    interpreter->pushOop(currentSelf.getOop());
 	return Oop();
 }
 
 Oop ASTInterpreter::visitSuperReference(SuperReference *node)
 {
-	interpreter->pushOop(currentSelf.oop);
+	interpreter->pushOop(currentSelf.getOop());
     return Oop();
 }
 
@@ -603,12 +611,227 @@ Oop ASTInterpreter::visitThisContextReference(ThisContextReference *node)
 	abort();
 }
 
+// Constant folding
+static bool constantValueOf(Node *node, Oop &value)
+{
+    if(node->isLiteral())
+    {
+        value = static_cast<LiteralNode*> (node)->getValue();
+        return true;
+    }
+
+    if(node->isMessageSendNode())
+    {
+        auto message = static_cast<MessageSendNode*> (node);
+        if(message->hasConstantValue())
+        {
+            value = message->getConstantValue();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static Oop booleanConstant(bool value)
+{
+    return value ? trueOop() : falseOop();
+}
+
+static bool smallIntegerConstant(SmallIntegerValue value, Oop &result)
+{
+    // The values that do not fit are large integers, which are made by the runtime.
+    auto encoded = Oop::encodeSmallInteger(value);
+    if(encoded.decodeSmallInteger() != value)
+        return false;
+
+    result = encoded;
+    return true;
+}
+
+static bool characterConstant(SmallIntegerValue value, Oop &result)
+{
+    if(value < 0 || (SmallIntegerValue)Oop::encodeCharacter((int)value).decodeCharacter() != value)
+        return false;
+
+    result = Oop::encodeCharacter((int)value);
+    return true;
+}
+
+template<typename T>
+static bool foldComparison(const std::string &selector, T a, T b, Oop &result)
+{
+    if(selector == "<")
+        result = booleanConstant(a < b);
+    else if(selector == ">")
+        result = booleanConstant(a > b);
+    else if(selector == "<=")
+        result = booleanConstant(a <= b);
+    else if(selector == ">=")
+        result = booleanConstant(a >= b);
+    else if(selector == "=")
+        result = booleanConstant(a == b);
+    else if(selector == "~=")
+        result = booleanConstant(a != b);
+    else
+        return false;
+    return true;
+}
+
+static bool foldSmallIntegerMessage(const std::string &selector, SmallIntegerValue a, SmallIntegerValue b, Oop &result)
+{
+    static constexpr int ValueBits = sizeof(SmallIntegerValue)*8;
+
+    // The factors are bounded, so the native product cannot overflow.
+    static constexpr SmallIntegerValue FactorLimit = SmallIntegerValue(1) << (ValueBits/2 - 1);
+
+    if(selector == "+")
+        return smallIntegerConstant(a + b, result);
+    if(selector == "-")
+        return smallIntegerConstant(a - b, result);
+    if(selector == "*")
+    {
+        if(a <= -FactorLimit || a >= FactorLimit || b <= -FactorLimit || b >= FactorLimit)
+            return false;
+        return smallIntegerConstant(a * b, result);
+    }
+
+    // The divisions by zero fail in the runtime, and the inexact divisions make fractions.
+    if(selector == "/")
+    {
+        if(b == 0 || a % b != 0)
+            return false;
+        return smallIntegerConstant(a / b, result);
+    }
+    if(selector == "//")
+        return b != 0 && smallIntegerConstant(divideRoundNeg(a, b), result);
+    if(selector == "\\\\")
+        return b != 0 && smallIntegerConstant(moduleRoundNeg(a, b), result);
+    if(selector == "quo:")
+        return b != 0 && smallIntegerConstant(a / b, result);
+
+    if(selector == "bitAnd:")
+        return smallIntegerConstant(a & b, result);
+    if(selector == "bitOr:")
+        return smallIntegerConstant(a | b, result);
+    if(selector == "bitXor:")
+        return smallIntegerConstant(a ^ b, result);
+    if(selector == "bitShift:")
+    {
+        if(b <= -ValueBits || b >= ValueBits)
+            return false;
+        if(b < 0)
+            return smallIntegerConstant(a >> -b, result);
+
+        // Only fold the shifts that do not lose bits.
+        auto shifted = SmallIntegerValue(uintptr_t(a) << b);
+        if((shifted >> b) != a)
+            return false;
+        return smallIntegerConstant(shifted, result);
+    }
+
+    return foldComparison(selector, a, b, result);
+}
+
+static bool foldCharacterMessage(const std::string &selector, SmallIntegerValue a, SmallIntegerValue b, Oop &result)
+{
+    // These are the character operations of the special message bytecodes.
+    if(selector == "+")
+        return characterConstant(a + b, result);
+    if(selector == "-")
+        return characterConstant(a - b, result);
+    if(selector == "*")
+        return characterConstant(a * b, result);
+    if(selector == "bitAnd:")
+        return characterConstant(a & b, result);
+    if(selector == "bitOr:")
+        return characterConstant(a | b, result);
+
+    return foldComparison(selector, a, b, result);
+}
+
+static bool foldFloatMessage(VMContext *context, const std::string &selector, double a, double b, Oop &result)
+{
+    double value;
+    if(selector == "+")
+        value = a + b;
+    else if(selector == "-")
+        value = a - b;
+    else if(selector == "*")
+        value = a * b;
+    else if(selector == "/" && b != 0)
+        value = a / b;
+    else if(selector == "//" && b != 0)
+        value = floor(a / b);
+    else if(selector == "\\\\" && b != 0)
+        value = a - floor(a / b)*b;
+    else
+        return foldComparison(selector, a, b, result);
+
+    // Keep the infinities and the NaNs in the runtime.
+    if(!isfinite(value))
+        return false;
+
+    result = context->floatObjectFor(value);
+    return true;
+}
+
+static bool isImmediateConstant(Oop value)
+{
+    return value.isSmallInteger() || value.isCharacter() || isNil(value) || value == trueOop() || value == falseOop();
+}
+
+// Evaluates a message with constant operands, as the special message bytecodes
+// and the primitives of the runtime would do. It fails when the result is not a
+// literal, or when the runtime could fail or send a message.
+static bool foldConstantMessage(VMContext *context, const std::string &selector, Oop receiver, const std::vector<Oop> &arguments, Oop &result)
+{
+    if(arguments.empty())
+    {
+        // The size of the literal strings and symbols.
+        auto classIndex = classIndexOf(receiver);
+        if(selector == "size" && (classIndex == SCI_ByteString || classIndex == SCI_ByteSymbol))
+            return smallIntegerConstant((SmallIntegerValue)receiver.getNumberOfElements(), result);
+        return false;
+    }
+
+    if(arguments.size() != 1)
+        return false;
+
+    auto argument = arguments[0];
+    if(selector == "==")
+    {
+        if(!isImmediateConstant(receiver) || !isImmediateConstant(argument))
+            return false;
+        result = booleanConstant(receiver == argument);
+        return true;
+    }
+
+    if(receiver.isSmallInteger() && argument.isSmallInteger())
+        return foldSmallIntegerMessage(selector, receiver.decodeSmallInteger(), argument.decodeSmallInteger(), result);
+    if(receiver.isCharacter() && argument.isCharacter())
+        return foldCharacterMessage(selector, receiver.decodeCharacter(), argument.decodeCharacter(), result);
+    if(receiver.isFloatOrInt() && argument.isFloatOrInt())
+        return foldFloatMessage(context, selector, receiver.decodeFloatOrInt(), argument.decodeFloatOrInt(), result);
+    return false;
+}
+
+// The to:by:do: loops are inlined when the direction is known.
+static bool isLiteralLoopStep(Node *node)
+{
+    if(!node->isLiteral())
+        return false;
+
+    auto step = static_cast<LiteralNode*> (node)->getValue();
+    return step.isSmallInteger() && step.decodeSmallInteger() != 0;
+}
+
 // Method compiler semantic analysis
 class MethodSemanticAnalysis: public ScopedInterpreter
 {
 public:
 	MethodSemanticAnalysis(VMContext *context, const EvaluationScopePtr &initialScope)
-		: ScopedInterpreter(context, initialScope) {}
+		: ScopedInterpreter(context, initialScope), localContext(nullptr), allowsUndeclaredIdentifiers(false), hasUndeclaredIdentifiers_(false) {}
 
     virtual Oop visitArgument(Argument *node);
     virtual Oop visitArgumentList(ArgumentList *node);
@@ -629,12 +852,20 @@ public:
     virtual Oop visitSuperReference(SuperReference *node);
     virtual Oop visitThisContextReference(ThisContextReference *node);
 
+    // Records the undeclared identifiers instead of failing.
+    void allowUndeclaredIdentifiers();
+    bool hasUndeclaredIdentifiers() const;
+
 private:
     bool optimizeMessage(MessageSendNode *node, CompilerOptimizedSelector selectorId);
     void inlineBlock(Node *node, int argumentCount);
+    void inlineNotNilBlock(Node *node);
+    void foldConstantMessage(MessageSendNode *node);
 
     MethodAST::LocalVariables localVariables;
     Node *localContext;
+    bool allowsUndeclaredIdentifiers;
+    bool hasUndeclaredIdentifiers_;
 };
 
 void MethodSemanticAnalysis::inlineBlock(Node *node, int argumentCount)
@@ -652,6 +883,15 @@ void MethodSemanticAnalysis::inlineBlock(Node *node, int argumentCount)
     node->acceptVisitor(this);
 }
 
+void MethodSemanticAnalysis::inlineNotNilBlock(Node *node)
+{
+    // The not nil block can receive the value.
+    int argumentCount = 0;
+    if(node->isBlockExpression() && static_cast<BlockExpression*> (node)->getArgumentCount() == 1)
+        argumentCount = 1;
+    inlineBlock(node, argumentCount);
+}
+
 Oop MethodSemanticAnalysis::visitArgument(Argument *node)
 {
     LODTALK_UNIMPLEMENTED();
@@ -680,6 +920,8 @@ Oop MethodSemanticAnalysis::visitAssignmentExpression(AssignmentExpression *node
     // Ensure the variable is mutable.
     auto identExpr = static_cast<AST::IdentifierExpression*> (reference);
     auto variable = identExpr-> getVariable();
+    if(!variable)
+        return Oop();
     if(!variable->isMutable())
         error(node, "cannot perform an assignment into an immutable variable.");
 
@@ -767,7 +1009,12 @@ Oop MethodSemanticAnalysis::visitIdentifierExpression(IdentifierExpression *node
     // Find the variable
     auto variable = currentScope->lookSymbolRecursively(node->getSymbol());
     if(!variable)
-        error(node, "undeclared identifier '%s'.", node->getIdentifier().c_str());
+    {
+        if(!allowsUndeclaredIdentifiers)
+            error(node, "undeclared identifier '%s'.", node->getIdentifier().c_str());
+        hasUndeclaredIdentifiers_ = true;
+        return Oop();
+    }
 
     // Check the variable context, for marking the closure.
     if(variable->isTemporal())
@@ -832,9 +1079,33 @@ Oop MethodSemanticAnalysis::visitMessageSendNode(MessageSendNode *node)
 			arg->acceptVisitor(this);
 	}
 
+	// Try to evaluate the message at compile time.
+	if(!isSuperSend && chained.empty())
+		foldConstantMessage(node);
+
 	return Oop();
 }
 
+void MethodSemanticAnalysis::foldConstantMessage(MessageSendNode *node)
+{
+    Oop receiver;
+    if(!constantValueOf(node->getReceiver(), receiver))
+        return;
+
+    std::vector<Oop> arguments;
+    for(auto &arg : node->getArguments())
+    {
+        Oop argument;
+        if(!constantValueOf(arg, argument))
+            return;
+        arguments.push_back(argument);
+    }
+
+    Oop result;
+    if(Lodtalk::foldConstantMessage(context, node->getSelector(), receiver, arguments, result))
+        node->setConstantValue(result);
+}
+
 bool MethodSemanticAnalysis::optimizeMessage(MessageSendNode *node, CompilerOptimizedSelector selectorId)
 {
     auto receiver = node->getReceiver();
@@ -845,17 +1116,21 @@ bool MethodSemanticAnalysis::optimizeMessage(MessageSendNode *node, CompilerOpti
     case CompilerOptimizedSelector::IfTrue:
     case CompilerOptimizedSelector::IfFalse:
     case CompilerOptimizedSelector::IfNil:
-    case CompilerOptimizedSelector::IfNotNil:
         {
             auto thenBlock = arguments[0];
             receiver->acceptVisitor(this);
             inlineBlock(thenBlock, 0);
         }
         break;
+    case CompilerOptimizedSelector::IfNotNil:
+        {
+            auto thenBlock = arguments[0];
+            receiver->acceptVisitor(this);
+            inlineNotNilBlock(thenBlock);
+        }
+        break;
     case CompilerOptimizedSelector::IfTrueIfFalse:
     case CompilerOptimizedSelector::IfFalseIfTrue:
-    case CompilerOptimizedSelector::IfNotNilIfNil:
-    case CompilerOptimizedSelector::IfNilIfNotNil:
 
         {
             auto thenBlock = arguments[0];
@@ -865,6 +1140,24 @@ bool MethodSemanticAnalysis::optimizeMessage(MessageSendNode *node, CompilerOpti
             inlineBlock(elseBlock, 0);
         }
         break;
+    case CompilerOptimizedSelector::IfNilIfNotNil:
+        {
+            auto nilBlock = arguments[0];
+            auto notNilBlock = arguments[1];
+            receiver->acceptVisitor(this);
+            inlineBlock(nilBlock, 0);
+            inlineNotNilBlock(notNilBlock);
+        }
+        break;
+    case CompilerOptimizedSelector::IfNotNilIfNil:
+        {
+            auto notNilBlock = arguments[0];
+            auto nilBlock = arguments[1];
+            receiver->acceptVisitor(this);
+            inlineNotNilBlock(notNilBlock);
+            inlineBlock(nilBlock, 0);
+        }
+        break;
     case CompilerOptimizedSelector::WhileTrue:
     case CompilerOptimizedSelector::WhileFalse:
         {
@@ -895,7 +1188,7 @@ bool MethodSemanticAnalysis::optimizeMessage(MessageSendNode *node, CompilerOpti
             auto stopValue = arguments[0];
             auto stepValue = arguments[1];
             auto bodyBlock = arguments[2];
-            if(!bodyBlock->isBlockExpression())
+            if(!bodyBlock->isBlockExpression() || !isLiteralLoopStep(stepValue))
                 return false;
 
             startValue->acceptVisitor(this);
@@ -904,6 +1197,27 @@ bool MethodSemanticAnalysis::optimizeMessage(MessageSendNode *node, CompilerOpti
             inlineBlock(bodyBlock, 1);
         }
         break;
+    case CompilerOptimizedSelector::TimesRepeat:
+        {
+            auto bodyBlock = arguments[0];
+            if(!bodyBlock->isBlockExpression())
+                return false;
+
+            receiver->acceptVisitor(this);
+            inlineBlock(bodyBlock, 0);
+        }
+        break;
+    case CompilerOptimizedSelector::And:
+    case CompilerOptimizedSelector::Or:
+        {
+            auto alternativeBlock = arguments[0];
+            if(!alternativeBlock->isBlockExpression())
+                return false;
+
+            receiver->acceptVisitor(this);
+            inlineBlock(alternativeBlock, 0);
+        }
+        break;
     default:
         LODTALK_UNIMPLEMENTED();
     }
@@ -913,6 +1227,10 @@ bool MethodSemanticAnalysis::optimizeMessage(MessageSendNode *node, CompilerOpti
 
 Oop MethodSemanticAnalysis::visitMethodAST(MethodAST *node)
 {
+    // A method inside of a doit is a literal, which is analyzed when it is compiled.
+    if(localContext)
+        return Oop();
+
     // Set the local context.
     localContext = node;
 
@@ -1041,12 +1359,23 @@ Oop MethodSemanticAnalysis::visitThisContextReference(ThisContextReference *node
     return Oop();
 }
 
+void MethodSemanticAnalysis::allowUndeclaredIdentifiers()
+{
+    allowsUndeclaredIdentifiers = true;
+}
+
+bool MethodSemanticAnalysis::hasUndeclaredIdentifiers() const
+{
+    return hasUndeclaredIdentifiers_;
+}
+
 // Method compiler
 class MethodCompiler: public AbstractASTVisitor
 {
 public:
 	MethodCompiler(VMContext *context, Oop classBinding)
-		: context(context), selector(context), additionalMethodState(context), classBinding(context, classBinding), gen(context) {}
+		: context(context), selector(context), additionalMethodState(context), classBinding(context, classBinding), gen(context),
+          localContext(nullptr), answersLastValue(false) {}
 
 	virtual Oop visitArgument(Argument *node);
 	virtual Oop visitArgumentList(ArgumentList *node);
@@ -1068,22 +1397,26 @@ public:
 	virtual Oop visitThisContextReference(ThisContextReference *node);
 
     void useLongInstanceVariableAccessors();
+    void answerLastValue();
 
 private:
     bool generateOptimizedMessage(MessageSendNode *node, CompilerOptimizedSelector optimizedSelector);
     void generateIf(MessageSendNode *node, Oop trueValue, Node *receiver, Node *trueBranch, bool negated = false);
-    void generateIfElse(MessageSendNode *node, Oop trueValue, Node *receiver, Node *trueBranch, Node *falseBranch, bool negated = false);
+    void generateIfElse(MessageSendNode *node, Oop trueValue, Node *receiver, Node *trueBranch, Node *falseBranch, bool negated = false, Oop elseValue = Oop());
     void generateWhile(MessageSendNode *node, Oop trueValue, Node *receiver, Node *bodyNode);
     void generateToDo(MessageSendNode *node, Node *receiver, Node *stopNode, Node *bodyNode);
     void generateToByDo(MessageSendNode *node, Node *receiver, Node *stopNode, Node *stepNode, Node *bodyNode);
+    void generateTimesRepeat(MessageSendNode *node, Node *receiver, Node *bodyNode);
+    void generateStoreNotNilValue(Node *notNilBranch);
 
     VMContext *context;
-	OopRef selector;
-    Ref<AdditionalMethodState> additionalMethodState;
-	OopRef classBinding;
+	Handle<ByteSymbol> selector;
+    Handle<AdditionalMethodState> additionalMethodState;
+	Handle<Association> classBinding;
 	MethodAssembler::Assembler gen;
     FunctionalNode *localContext;
     int temporalVectorCount;
+    bool answersLastValue;
 };
 
 // Method compiler.
@@ -1316,10 +1649,25 @@ bool MethodCompiler::generateOptimizedMessage(MessageSendNode *node, CompilerOpt
         generateToDo(node, receiver, arguments[0], arguments[1]);
         break;
     case CompilerOptimizedSelector::ToByDo:
-        if(!arguments[2]->isBlockExpression())
+        if(!arguments[2]->isBlockExpression() || !isLiteralLoopStep(arguments[1]))
             return false;
         generateToByDo(node, receiver, arguments[0], arguments[1], arguments[2]);
         break;
+    case CompilerOptimizedSelector::TimesRepeat:
+        if(!arguments[0]->isBlockExpression())
+            return false;
+        generateTimesRepeat(node, receiver, arguments[0]);
+        break;
+    case CompilerOptimizedSelector::And:
+        if(!arguments[0]->isBlockExpression())
+            return false;
+        generateIfElse(node, trueOop(), receiver, arguments[0], nullptr, false, falseOop());
+        break;
+    case CompilerOptimizedSelector::Or:
+        if(!arguments[0]->isBlockExpression())
+            return false;
+        generateIfElse(node, falseOop(), receiver, arguments[0], nullptr, false, trueOop());
+        break;
     default:
         LODTALK_UNIMPLEMENTED();
     }
@@ -1332,13 +1680,15 @@ void MethodCompiler::generateIf(MessageSendNode *node, Oop trueValue, Node *rece
     generateIfElse(node, trueValue, receiver, trueBranch, nullptr, negated);
 }
 
-void MethodCompiler::generateIfElse(MessageSendNode *node, Oop trueValue, Node *receiver, Node *trueBranch, Node *falseBranch, bool negated)
+void MethodCompiler::generateIfElse(MessageSendNode *node, Oop trueValue, Node *receiver, Node *trueBranch, Node *falseBranch, bool negated, Oop elseValue)
 {
     auto elseLabel = gen.makeLabel();
     auto mergeLabel = gen.makeLabel();
 
     // Evaluate the condition.
     receiver->acceptVisitor(this);
+    if(trueValue == nilOop())
+        generateStoreNotNilValue(negated ? trueBranch : falseBranch);
 
     // Compare the condition to the true value.
     if(trueValue == trueOop())
@@ -1374,12 +1724,24 @@ void MethodCompiler::generateIfElse(MessageSendNode *node, Oop trueValue, Node *
             gen.sendValue();
     }
     else
-        gen.pushNil();
+        gen.pushLiteral(elseValue);
 
     // Merge the control flow.
     gen.putLabel(mergeLabel);
 }
 
+void MethodCompiler::generateStoreNotNilValue(Node *notNilBranch)
+{
+    if(!notNilBranch || !notNilBranch->isBlockExpression())
+        return;
+
+    // Store the value into the argument of the inlined block.
+    auto notNilBlock = reinterpret_cast<BlockExpression*> (notNilBranch);
+    auto &blockArguments = notNilBlock->getInlineArguments();
+    if(blockArguments.size() == 1)
+        blockArguments[0]->generateStore(gen, localContext);
+}
+
 void MethodCompiler::generateWhile(MessageSendNode *node, Oop trueValue, Node *receiver, Node *bodyNode)
 {
     // Enter into the loop.
@@ -1467,11 +1829,95 @@ void MethodCompiler::generateToDo(MessageSendNode *node, Node *receiver, Node *s
 
 void MethodCompiler::generateToByDo(MessageSendNode *node, Node *receiver, Node *stopNode, Node *stepNode, Node *bodyNode)
 {
-    LODTALK_UNIMPLEMENTED();
+    // Get the data from the body.
+    assert(bodyNode->isBlockExpression());
+    auto bodyBlock = reinterpret_cast<BlockExpression*> (bodyNode);
+    auto &bodyArguments = bodyBlock->getInlineArguments();
+    assert(bodyBlock->getArgumentCount() == 1);
+    assert(bodyArguments.size() == 1);
+    auto &iterationVariable = bodyArguments[0];
+
+    // The step is a literal, so it gives the direction of the loop.
+    assert(stepNode->isLiteral());
+    auto step = reinterpret_cast<LiteralNode*> (stepNode)->getValue();
+    auto isAscending = step.decodeSmallInteger() > 0;
+
+    // Generate the starting value.
+    receiver->acceptVisitor(this);
+    iterationVariable->generateStore(gen, localContext);
+
+    // Generate the end value.
+    stopNode->acceptVisitor(this);
+
+    // The loop condition.
+    auto loopCondition = gen.makeLabelHere();
+    auto loopEnd = gen.makeLabel();
+
+    // Check the loop condition.
+    gen.duplicateStackTop();
+    iterationVariable->generateLoad(gen, localContext);
+    if(isAscending)
+        gen.greaterEqual();
+    else
+        gen.lessEqual();
+    gen.jumpOnFalse(loopEnd);
+
+    // The loop body.
+    bodyNode->acceptVisitor(this);
+    gen.popStackTop();
+
+    // Increase the value by the step.
+    iterationVariable->generateLoad(gen, localContext);
+    gen.pushLiteral(step);
+    gen.add();
+    iterationVariable->generateStore(gen, localContext);
+    gen.popStackTop();
+    gen.jump(loopCondition);
+
+    // End of the loop.
+    gen.putLabel(loopEnd);
+    gen.popStackTop(); // The stop value
+}
+
+void MethodCompiler::generateTimesRepeat(MessageSendNode *node, Node *receiver, Node *bodyNode)
+{
+    // The receiver is the result, and its copy is the remaining count.
+    receiver->acceptVisitor(this);
+    gen.duplicateStackTop();
+
+    // The loop condition.
+    auto loopCondition = gen.makeLabelHere();
+    auto loopEnd = gen.makeLabel();
+
+    // Check the loop condition.
+    gen.duplicateStackTop();
+    gen.pushOne();
+    gen.greaterEqual();
+    gen.jumpOnFalse(loopEnd);
+
+    // The loop body.
+    bodyNode->acceptVisitor(this);
+    gen.popStackTop();
+
+    // Decrease the count by one.
+    gen.pushOne();
+    gen.subtract();
+    gen.jump(loopCondition);
+
+    // End of the loop.
+    gen.putLabel(loopEnd);
+    gen.popStackTop(); // The remaining count
 }
 
 Oop MethodCompiler::visitMessageSendNode(MessageSendNode *node)
 {
+    // A message evaluated at compile time is pushed as a literal.
+    if(node->hasConstantValue())
+    {
+        gen.pushLiteral(node->getConstantValue());
+        return Oop();
+    }
+
 	// Visit the receiver.
 	bool isSuper = node->getReceiver()->isSuperReference();
 
@@ -1526,6 +1972,13 @@ Oop MethodCompiler::visitMessageSendNode(MessageSendNode *node)
 
 Oop MethodCompiler::visitMethodAST(MethodAST *node)
 {
+    // A method inside of a doit is pushed as its ast handle.
+    if(localContext)
+    {
+        gen.pushLiteral(node->getHandle().getOop());
+        return Oop();
+    }
+
     size_t temporalCount = 0;
     size_t argumentCount = 0;
 
@@ -1552,10 +2005,10 @@ Oop MethodCompiler::visitMethodAST(MethodAST *node)
         auto &pragmas = pragmaList->getPragmas();
         pragmaCount = pragmas.size();
 
-        Ref<Pragma> pragmaObject(context);
+        Handle<Pragma> pragmaObject(context);
 
         additionalMethodState = AdditionalMethodState::basicNew(context, pragmaCount);
-        additionalMethodState->setSelector(selector.oop);
+        additionalMethodState->setSelector(selector.getOop());
 
         for(size_t i = 0; i < pragmaCount; ++i)
         {
@@ -1639,7 +2092,8 @@ Oop MethodCompiler::visitMethodAST(MethodAST *node)
                 localVar->setTemporalIndex((int)i);
             else
             {
-                localVar->setTemporalIndex(int(i + temporalVectorCount));
+                // The captured variables leave no holes in the frame.
+                localVar->setTemporalIndex(int(argumentCount + temporalCount));
                 ++temporalCount;
             }
         }
@@ -1668,16 +2122,21 @@ Oop MethodCompiler::visitMethodAST(MethodAST *node)
 
 	// Always return
 	if(!gen.isLastReturn())
-		gen.returnReceiver();
+    {
+        if(answersLastValue && !node->getBody()->getChildren().empty())
+            gen.returnTop();
+        else
+            gen.returnReceiver();
+    }
 
 	// Set the method selector/additonal method state.
     if(!additionalMethodState.isNil())
         gen.addLiteralAlways(additionalMethodState.getOop());
     else
-        gen.addLiteralAlways(selector);
+        gen.addLiteralAlways(selector.getOop());
 
 	// Set the class binding.
-	gen.addLiteralAlways(classBinding);
+	gen.addLiteralAlways(classBinding.getOop());
 	Oop result = Oop::fromPointer(gen.generate(temporalCount, argumentCount, hasPrimitive));
 
     // Set some back pointers.
@@ -1759,9 +2218,45 @@ void MethodCompiler::useLongInstanceVariableAccessors()
     gen.useLongInstanceVariableAccessors();
 }
 
+void MethodCompiler::answerLastValue()
+{
+    answersLastValue = true;
+}
+
+// Compiler statistics
+CompilerStatistics::CompilerStatistics()
+    : methodCount(0), literalCount(0), compilationTime(0)
+{
+}
+
+void CompilerStatistics::addMethod(size_t methodLiteralCount)
+{
+    ++methodCount;
+    literalCount += methodLiteralCount;
+}
+
+void CompilerStatistics::addCompilationTime(uint64_t microseconds)
+{
+    compilationTime += microseconds;
+}
+
+void CompilerStatistics::writeReport(FILE *output)
+{
+    auto methods = methodCount.load();
+    auto seconds = compilationTime.load() * 1e-6;
+    fprintf(output, "Compiler statistics\n");
+    fprintf(output, "    Compiled methods:  %llu\n", (unsigned long long)methods);
+    fprintf(output, "    Literals:          %llu\n", (unsigned long long)literalCount.load());
+    fprintf(output, "    Compilation time:  %.3f ms\n", seconds*1000.0);
+    if(seconds > 0)
+        fprintf(output, "    Throughput:        %.0f methods/s\n", methods / seconds);
+}
+
 // Compiler interface
-CompiledMethod *compileMethod(VMContext *vmContext, const EvaluationScopePtr &scope, const Ref<ClassDescription> &clazz, Node *ast)
+CompiledMethod *compileMethod(VMContext *vmContext, const EvaluationScopePtr &scope, const Handle<ClassDescription> &clazz, Node *ast)
 {
+    HandleScope handleScope(vmContext);
+
     // Perform the semantic analysis
     MethodSemanticAnalysis semanticAnalyzer(vmContext, scope);
     ast->acceptVisitor(&semanticAnalyzer);
@@ -1772,7 +2267,400 @@ CompiledMethod *compileMethod(VMContext *vmContext, const EvaluationScopePtr &sc
     if (classIndex == SMCI_InstructionStream || classIndex == SMCI_Context)
         compiler.useLongInstanceVariableAccessors();
 
-    return reinterpret_cast<CompiledMethod*> (ast->acceptVisitor(&compiler).pointer);
+    auto method = reinterpret_cast<CompiledMethod*> (ast->acceptVisitor(&compiler).pointer);
+    vmContext->getCompilerStatistics()->addMethod(method->getLiteralCount());
+    return method;
+}
+
+// Compiles a method definition of a script in the scope of its class.
+static CompiledMethod *compileMethodDefinition(VMContext *context, Oop classOop, MethodAST *ast)
+{
+	HandleScope handleScope(context);
+	Handle<ClassDescription> clazz(context, reinterpret_cast<ClassDescription*> (classOop.pointer));
+
+	// Create the global scope
+	auto globalScope = std::make_shared<GlobalEvaluationScope> (context);
+
+	// TODO: Create the class variables scope.
+
+	// Create the class instance variables scope.
+	auto instanceVarScope = std::make_shared<InstanceVariableScope> (globalScope, clazz);
+
+	// Compile the method
+	return compileMethod(context, instanceVarScope, clazz, ast);
+}
+
+static uint64_t elapsedMicroseconds(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+// A compiler thread is only used for this many method definitions.
+static constexpr size_t MinimumDefinitionsPerCompilerThread = 8;
+
+// The initial capacity of the classes of the queued definitions.
+static constexpr size_t InitialDefinitionQueueCapacity = 64;
+
+/**
+ * Method definition queue. The method definitions of a script are queued
+ * while they are executed, and they are compiled in parallel before the next
+ * statement that could use them. The compiled methods are installed in their
+ * source order, from the interpreter thread.
+ */
+class MethodDefinitionQueue
+{
+public:
+    MethodDefinitionQueue(VMContext *context)
+        : context(context), accepting(false) {}
+
+    ~MethodDefinitionQueue()
+    {
+        // The definitions of a script that is aborted are dropped.
+        if(!classes.empty())
+            context->unregisterGCRoot(classes.data());
+    }
+
+    bool isAccepting() const
+    {
+        return accepting;
+    }
+
+    void setAccepting(bool newAccepting)
+    {
+        accepting = newAccepting;
+    }
+
+    void add(Oop classOop, MethodAST *ast)
+    {
+        if(definitions.size() == classes.size())
+            growClasses();
+        classes[definitions.size()] = classOop;
+        definitions.push_back(Definition{ast, nullptr});
+    }
+
+    void compileAndInstall();
+
+private:
+    struct Definition
+    {
+        MethodAST *ast;
+        CompiledMethod *method;
+    };
+
+    void growClasses();
+    void compileDefinitions();
+
+    VMContext *context;
+    bool accepting;
+    std::vector<Definition> definitions;
+
+    // The classes of the definitions are a single root range, which is only registered again when it grows.
+    std::vector<Oop> classes;
+};
+
+/**
+ * The execution of a script. Its tree is shared with the methods that are
+ * compiled lazily.
+ */
+class ScriptExecution
+{
+public:
+    ScriptExecution(VMContext *context);
+    ~ScriptExecution();
+
+    std::shared_ptr<Arena> arena;
+    MethodDefinitionQueue definitionQueue;
+
+    // The cache that records the compiled statements, if any.
+    ScriptCache *cache;
+
+private:
+    ScriptExecution *previous;
+};
+
+// The script that is being executed in this thread.
+static thread_local ScriptExecution *currentScript = nullptr;
+
+ScriptExecution::ScriptExecution(VMContext *context)
+    : arena(std::make_shared<Arena> ()), definitionQueue(context), cache(nullptr), previous(currentScript)
+{
+    currentScript = this;
+}
+
+ScriptExecution::~ScriptExecution()
+{
+    currentScript = previous;
+}
+
+// Records the compiled method of a definition in the cache of the current script.
+static void cacheDefinitionMethod(MethodAST *ast, Oop clazz, CompiledMethod *method)
+{
+    if(currentScript && currentScript->cache)
+        currentScript->cache->setDefinitionMethod(ast, clazz, method);
+}
+
+void MethodDefinitionQueue::compileAndInstall()
+{
+    if(definitions.empty())
+        return;
+
+    // The compiled methods are not referenced until they are installed.
+    WithoutGC withoutGC(context);
+    auto startTime = std::chrono::steady_clock::now();
+    compileDefinitions();
+    context->getCompilerStatistics()->addCompilationTime(elapsedMicroseconds(startTime));
+
+    // Install the methods in their source order.
+    for(size_t i = 0; i < definitions.size(); ++i)
+    {
+        auto &definition = definitions[i];
+        auto clazz = reinterpret_cast<ClassDescription*> (classes[i].pointer);
+        clazz->methodDict->atPut(context, definition.method->getSelector(), Oop::fromPointer(definition.method));
+        cacheDefinitionMethod(definition.ast, classes[i], definition.method);
+    }
+
+    std::fill(classes.begin(), classes.begin() + definitions.size(), Oop());
+    definitions.clear();
+}
+
+void MethodDefinitionQueue::growClasses()
+{
+    if(!classes.empty())
+        context->unregisterGCRoot(classes.data());
+
+    classes.resize(std::max(InitialDefinitionQueueCapacity, classes.size()*2));
+    context->registerGCRoot(classes.data(), classes.size());
+}
+
+void MethodDefinitionQueue::compileDefinitions()
+{
+    // The write barrier of the incremental marking is not thread safe.
+    auto gc = context->getMemoryManager()->getGarbageCollector();
+    auto definitionCount = definitions.size();
+    auto workerCount = std::max(size_t(1), std::min(context->getCompilerThreadCount(), definitionCount / MinimumDefinitionsPerCompilerThread));
+    if(gc->isMarkingInProgress())
+        workerCount = 1;
+
+    // The definitions are claimed in ascending order by the workers of the context and the current thread.
+    context->getMemoryManager()->getWorkerPool()->parallelFor(definitionCount, workerCount, [&](size_t index) {
+        auto &definition = definitions[index];
+        definition.method = compileMethodDefinition(context, classes[index], definition.ast);
+    });
+}
+
+// Tells whether a script statement only defines a method, or sets the class or the category of the next definitions.
+static bool isDefinitionStatement(Node *statement)
+{
+    if(!statement->isMessageSendNode())
+        return false;
+
+    auto message = static_cast<MessageSendNode*> (statement);
+    if(!message->getReceiver()->isSelfReference() || !message->getChainedMessages().empty())
+        return false;
+
+    auto &selector = message->getSelector();
+    auto &arguments = message->getArguments();
+    if(arguments.size() != 1)
+        return false;
+
+    auto argument = arguments[0];
+    if(selector == "method:" || selector == "function:")
+        return argument->isMethodAST();
+    if(selector == "category:")
+        return argument->isLiteral();
+    if(selector == "class:")
+    {
+        if(argument->isIdentifierExpression())
+            return true;
+
+        // The metaclass of a class.
+        if(!argument->isMessageSendNode())
+            return false;
+        auto metaclass = static_cast<MessageSendNode*> (argument);
+        return metaclass->getSelector() == "class" && metaclass->getReceiver()->isIdentifierExpression() && metaclass->getChainedMessages().empty();
+    }
+
+    return false;
+}
+
+// Gets the method of a statement that defines a method or a function.
+static MethodAST *methodDefinitionOf(Node *statement, bool &isFunction)
+{
+    if(!isDefinitionStatement(statement))
+        return nullptr;
+
+    auto message = static_cast<MessageSendNode*> (statement);
+    auto &selector = message->getSelector();
+    isFunction = selector == "function:";
+    if(!isFunction && selector != "method:")
+        return nullptr;
+
+    return static_cast<MethodAST*> (message->getArguments()[0]);
+}
+
+// Compiles a script statement into a doit of the script context. It returns
+// null when the statement uses a global that is not defined yet.
+CompiledMethod *compileScriptStatement(VMContext *vmContext, const EvaluationScopePtr &scope, Node *statement)
+{
+    HandleScope handleScope(vmContext);
+    Handle<ClassDescription> clazz(vmContext, reinterpret_cast<ClassDescription*> (vmContext->getClassFromIndex(SCI_ScriptContext).pointer));
+
+    // The doit is a method whose body is the statement.
+    Arena arena;
+    MethodAST doIt(vmContext, arena.make<MethodHeader> ("doIt"), nullptr, arena.make<SequenceNode> (statement));
+    CompiledMethod *result = nullptr;
+
+    // Perform the semantic analysis
+    MethodSemanticAnalysis semanticAnalyzer(vmContext, scope);
+    semanticAnalyzer.allowUndeclaredIdentifiers();
+    doIt.acceptVisitor(&semanticAnalyzer);
+
+    // Generate the doit.
+    if(!semanticAnalyzer.hasUndeclaredIdentifiers())
+    {
+        MethodCompiler compiler(vmContext, clazz->getBinding(vmContext));
+        compiler.answerLastValue();
+        result = reinterpret_cast<CompiledMethod*> (doIt.acceptVisitor(&compiler).pointer);
+    }
+
+    return result;
+}
+
+static void executeScriptStatement(InterpreterProxy *interpreter, const EvaluationScopePtr &scope, Oop scriptContext, Node *statement, ScriptCache *cache, bool isDefinition)
+{
+    auto vmContext = interpreter->getContext();
+    auto doIt = compileScriptStatement(vmContext, scope, statement);
+
+    // Interpret the statements that cannot be compiled yet.
+    if(!doIt)
+    {
+        if(cache)
+            cache->addSourceStatement(isDefinition);
+
+        ASTInterpreter astInterpreter(interpreter, scope, scriptContext);
+        statement->acceptVisitor(&astInterpreter);
+        return;
+    }
+
+    if(cache)
+        cache->addDoIt(doIt, isDefinition);
+
+    interpreter->pushOop(scriptContext);
+    interpreter->executeMethod(Oop::fromPointer(doIt), 0);
+}
+
+// Executes a statement from the cache. It returns false when the statement has to be compiled from the source.
+static bool executeCachedStatement(InterpreterProxy *interpreter, ScriptCache *cache, size_t index, const Handle<ScriptContext> &scriptContext)
+{
+    auto context = interpreter->getContext();
+    HandleScope handleScope(context);
+    switch(cache->getStatementKind(index))
+    {
+    case SCSK_DoIt:
+        {
+            auto doIt = cache->loadStatementMethod(index, context->getClassFromIndex(SCI_ScriptContext));
+            if(!doIt)
+                return false;
+
+            interpreter->pushOop(scriptContext.getOop());
+            interpreter->executeMethod(Oop::fromPointer(doIt), 0);
+        }
+        return true;
+    case SCSK_Method:
+    case SCSK_Function:
+        {
+            auto classOop = cache->getStatementKind(index) == SCSK_Method ? scriptContext->currentClass : scriptContext->globalContextClass;
+            if(!context->isClassOrMetaclass(classOop))
+                return false;
+
+            Handle<ClassDescription> clazz(context, reinterpret_cast<ClassDescription*> (classOop.pointer));
+            auto loadedMethod = cache->loadStatementMethod(index, clazz.getOop());
+            if(!loadedMethod)
+                return false;
+            Handle<CompiledMethod> method(context, loadedMethod);
+
+            // The definition answers the script context.
+            clazz->methodDict->atPut(context, method->getSelector(), method.getOop());
+            interpreter->pushOop(scriptContext.getOop());
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Lazy methods
+LazyMethodTable::LazyMethodTable(VMContext *context)
+    : context(context)
+{
+}
+
+LazyMethodTable::~LazyMethodTable()
+{
+}
+
+void LazyMethodTable::add(Oop clazz, Oop stub, const std::shared_ptr<Arena> &arena)
+{
+    auto ast = reinterpret_cast<MethodASTHandle*> (stub.pointer)->ast;
+    methods[ast].reset(new LazyMethod(context, clazz, stub, arena));
+}
+
+Oop LazyMethodTable::compile(Oop stub)
+{
+    auto ast = reinterpret_cast<MethodASTHandle*> (stub.pointer)->ast;
+    auto it = methods.find(ast);
+    if(!ast || it == methods.end())
+        nativeError("the definition of a lazy method was lost.");
+
+    // The tree is released after the method is compiled, if it was the last one of its script.
+    std::unique_ptr<LazyMethod> lazyMethod(std::move(it->second));
+    methods.erase(it);
+
+    HandleScope handleScope(context);
+    Handle<ClassDescription> clazz(context, lazyMethod->classRef.oop);
+    auto startTime = std::chrono::steady_clock::now();
+    Handle<CompiledMethod> compiledMethod(context, compileMethodDefinition(context, clazz.getOop(), ast));
+    context->getCompilerStatistics()->addCompilationTime(elapsedMicroseconds(startTime));
+
+    // Replace the stub, unless the method was defined again.
+    auto selector = compiledMethod->getSelector();
+    if(clazz->methodDict->rawAtOrNil(selector) == stub)
+        clazz->methodDict->atPut(context, selector, compiledMethod.getOop());
+
+    return compiledMethod.getOop();
+}
+
+void LazyMethodTable::compileAll()
+{
+    while(!methods.empty())
+        compile(methods.begin()->second->stubRef.oop);
+}
+
+// Defers the compilation of a method definition of a script. It returns false
+// when the definition has to be compiled now.
+static bool deferMethodDefinition(VMContext *context, const Handle<ClassDescription> &clazz, Oop methodAstHandle, MethodAST *ast)
+{
+    if(!currentScript)
+        return false;
+
+    // Install a stub that is compiled when it is looked up. The definitions of a script that
+    // is recorded into its cache are compiled now, so the cache keeps their compiled methods.
+    if(context->isLazyMethodCompilationEnabled() && !currentScript->cache)
+    {
+        auto selector = context->makeSelector(ast->getHeader()->getSelector());
+        context->getLazyMethodTable()->add(clazz.getOop(), methodAstHandle, currentScript->arena);
+        clazz->methodDict->atPut(context, selector, methodAstHandle);
+        return true;
+    }
+
+    // Queue the definition, which is compiled before the next statement that could use it.
+    if(currentScript->definitionQueue.isAccepting())
+    {
+        currentScript->definitionQueue.add(clazz.getOop(), ast);
+        return true;
+    }
+
+    return false;
 }
 
 int executeDoIt(InterpreterProxy *interpreter, const std::string &code)
@@ -1787,41 +2675,116 @@ int executeScript(InterpreterProxy *interpreter, const std::string &code, const
 	abort();
 }
 
-int executeScriptFromFile(InterpreterProxy *interpreter, FILE *file, const std::string &name, const std::string &basePath)
+// Executes the statements of a script. The statements are loaded from the
+// cache when it is valid, and otherwise they are recorded into it.
+static int executeScriptSource(InterpreterProxy *interpreter, SourceBuffer &source, const std::string &basePath, ScriptCache *cache)
 {
     // Create the script context
     auto vmContext = interpreter->getContext();
-	Ref<ScriptContext> context(vmContext, reinterpret_cast<ScriptContext*> (vmContext->basicNativeNewFromClassIndex(SCI_ScriptContext)));
+	HandleScope handleScope(vmContext);
+	Handle<ScriptContext> context(vmContext, reinterpret_cast<ScriptContext*> (vmContext->basicNativeNewFromClassIndex(SCI_ScriptContext)));
 	if(context.isNil())
 		return interpreter->primitiveFailed();
 
 	context->globalContextClass = vmContext->getClassFromOop(vmContext->getGlobalContext());
 	context->basePath = vmContext->makeByteString(basePath);
 
-	// Parse the script.
-	auto ast = Lodtalk::AST::parseSourceFromFile(vmContext, file);
-	if(!ast)
-		return interpreter->primitiveFailed();
+	ScriptExecution script(vmContext);
+	auto isCached = cache && cache->load();
+	if(cache && !isCached)
+		script.cache = cache;
+
+	// Parse the script, unless it is cached. The tree is released with its arena after
+	// the execution, unless there are methods of the script that are not compiled yet.
+	Node *ast = nullptr;
+	if(!isCached)
+	{
+		ast = Lodtalk::AST::parseSourceFromBuffer(vmContext, source, *script.arena);
+		if(!ast)
+			return interpreter->primitiveFailed();
+	}
 
 	// Create the global scope
 	auto scope = std::make_shared<GlobalEvaluationScope> (vmContext);
 
-	// Interpret the script.
-	ASTInterpreter astInterpreter(interpreter, scope, context.getOop());
-	ast->acceptVisitor(&astInterpreter);
+	// The method definitions are compiled in parallel, before the statements that could use them.
+	auto &definitionQueue = script.definitionQueue;
+
+	// Execute the script statements. The value of the last one is left in the stack.
+	auto statementCount = isCached ? cache->getStatementCount() : static_cast<SequenceNode*> (ast)->getChildren().size();
+	for(size_t i = 0; i < statementCount; ++i)
+	{
+		if(i > 0)
+			interpreter->popOop();
+
+		if(isCached)
+		{
+			if(!cache->isDefinitionStatement(i))
+				definitionQueue.compileAndInstall();
+			if(executeCachedStatement(interpreter, cache, i, context))
+				continue;
+
+			// Parse the script when a statement cannot be loaded from the cache.
+			if(!ast)
+			{
+				ast = Lodtalk::AST::parseSourceFromBuffer(vmContext, source, *script.arena);
+				if(!ast || static_cast<SequenceNode*> (ast)->getChildren().size() != statementCount)
+					return interpreter->primitiveFailed();
+			}
+		}
+
+		auto statement = static_cast<SequenceNode*> (ast)->getChildren()[i];
+		auto isDefinition = isDefinitionStatement(statement);
+		if(!isDefinition)
+			definitionQueue.compileAndInstall();
+
+		// The method of a definition is cached when it is compiled.
+		bool isFunction = false;
+		auto methodDefinition = script.cache ? methodDefinitionOf(statement, isFunction) : nullptr;
+		if(methodDefinition)
+			script.cache->addMethodDefinition(methodDefinition, isFunction);
 
+		definitionQueue.setAccepting(isDefinition);
+		executeScriptStatement(interpreter, scope, context.getOop(), statement, methodDefinition ? nullptr : script.cache, isDefinition);
+		definitionQueue.setAccepting(false);
+	}
+
+	definitionQueue.compileAndInstall();
+	if(script.cache)
+		script.cache->save();
     return 0;
 }
 
+int executeScriptFromFile(InterpreterProxy *interpreter, FILE *file, const std::string &name, const std::string &basePath)
+{
+	SourceBuffer source;
+	if(!source.load(file))
+		return interpreter->primitiveFailed();
+
+	return executeScriptSource(interpreter, source, basePath, nullptr);
+}
+
 int executeScriptFromFileNamed(InterpreterProxy *interpreter, const std::string &filename)
 {
-	StdFile file(filename, "r");
-	if(!file)
-		nativeErrorFormat("Failed to open file '%s'", filename.c_str());
+	SourceBuffer source;
+	{
+		StdFile file(filename, "r");
+		if(!file)
+			nativeErrorFormat("Failed to open file '%s'", filename.c_str());
+		if(!source.load(file))
+			return interpreter->primitiveFailed();
+	}
 
 	std::string basePathString = dirname(filename);
 
-	return executeScriptFromFile(interpreter, file, filename, basePathString);
+	// The compiled statements are cached by the contents of the file.
+	if(interpreter->getContext()->isScriptCacheEnabled())
+	{
+		ScriptCache cache(interpreter->getContext(), filename, source);
+		return executeScriptSource(interpreter, source, basePathString, &cache);
+	}
+
+	return executeScriptSource(interpreter, source, basePathString, nullptr);
 }
 
 // ScriptContext
@@ -1885,26 +2848,28 @@ int ScriptContext::stAddFunction(InterpreterProxy *interpreter)
 	// Check the class
 	if(!context->isClassOrMetaclass(self->globalContextClass))
 		nativeError("a global context class is needed");
-	Ref<ClassDescription> clazz(context, reinterpret_cast<ClassDescription*> (self->globalContextClass.pointer));
+	HandleScope handleScope(context);
+	Handle<ClassDescription> clazz(context, reinterpret_cast<ClassDescription*> (self->globalContextClass.pointer));
 
 	// Get the ast
 	MethodASTHandle *handle = reinterpret_cast<MethodASTHandle*> (methodAstHandle.pointer);
 	auto ast = handle->ast;
+	if(!ast)
+		nativeError("the method AST was released with its script.");
 
-	// Create the global scope
-	auto globalScope = std::make_shared<GlobalEvaluationScope> (context);
-
-	// TODO: Create the class global variables scope.
-
-	// Create the class instance variables scope.
-	auto instanceVarScope = std::make_shared<InstanceVariableScope> (globalScope, clazz);
+	// The definitions of a script are compiled later.
+	if(deferMethodDefinition(context, clazz, methodAstHandle, ast))
+		return interpreter->returnReceiver();
 
 	// Compile the method
-	Ref<CompiledMethod> compiledMethod(context, compileMethod(context, instanceVarScope, clazz, ast));
+	auto startTime = std::chrono::steady_clock::now();
+	Handle<CompiledMethod> compiledMethod(context, compileMethodDefinition(context, clazz.getOop(), ast));
+	context->getCompilerStatistics()->addCompilationTime(elapsedMicroseconds(startTime));
 
 	// Register the method in the global context class side
 	auto selector = compiledMethod->getSelector();
 	clazz->methodDict->atPut(context, selector, compiledMethod.getOop());
+	cacheDefinitionMethod(ast, clazz.getOop(), compiledMethod.get());
 
 	// Return self
 	return interpreter->returnReceiver();
@@ -1926,26 +2891,28 @@ int ScriptContext::stAddMethod(InterpreterProxy *interpreter)
 	// Check the class
 	if(!context->isClassOrMetaclass(self->currentClass))
 		nativeError("a class is needed for adding a method.");
-	Ref<ClassDescription> clazz(context, reinterpret_cast<ClassDescription*> (self->currentClass.pointer));
+	HandleScope handleScope(context);
+	Handle<ClassDescription> clazz(context, reinterpret_cast<ClassDescription*> (self->currentClass.pointer));
 
 	// Get the ast
 	MethodASTHandle *handle = reinterpret_cast<MethodASTHandle*> (methodAstHandle.pointer);
 	auto ast = handle->ast;
+	if(!ast)
+		nativeError("the method AST was released with its script.");
 
-	// Create the global scope
-	auto globalScope = std::make_shared<GlobalEvaluationScope> (context);
-
-	// TODO: Create the class variables scope.
-
-	// Create the class instance variables scope.
-	auto instanceVarScope = std::make_shared<InstanceVariableScope> (globalScope, clazz);
+	// The definitions of a script are compiled later.
+	if(deferMethodDefinition(context, clazz, methodAstHandle, ast))
+		return interpreter->returnReceiver();
 
 	// Compile the method
-	Ref<CompiledMethod> compiledMethod(context, compileMethod(context, instanceVarScope, clazz, ast));
+	auto startTime = std::chrono::steady_clock::now();
+	Handle<CompiledMethod> compiledMethod(context, compileMethodDefinition(context, clazz.getOop(), ast));
+	context->getCompilerStatistics()->addCompilationTime(elapsedMicroseconds(startTime));
 
 	// Register the method in the current class
 	auto selector = compiledMethod->getSelector();
 	clazz->methodDict->atPut(context, selector, compiledMethod.getOop());
+	cacheDefinitionMethod(ast, clazz.getOop(), compiledMethod.get());
 
 	// Return self
 	return interpreter->returnReceiver();
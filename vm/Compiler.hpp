@@ -1,6 +1,11 @@
 #ifndef LODTALK_COMPILER_HPP
 #define LODTALK_COMPILER_HPP
 
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <stdio.h>
+#include "Arena.hpp"
 #include "AST.hpp"
 
 namespace Lodtalk
@@ -36,6 +41,60 @@ public:
 	AST::MethodAST *ast;
 };
 
+/**
+ * Compiler statistics. They count the compiled methods and the time spent
+ * compiling them, for measuring the throughput of the compiler. The time of
+ * the methods that are compiled in parallel is the elapsed time.
+ */
+class CompilerStatistics
+{
+public:
+    CompilerStatistics();
+
+    void addMethod(size_t literalCount);
+    void addCompilationTime(uint64_t microseconds);
+    void writeReport(FILE *output);
+
+private:
+    std::atomic<uint64_t> methodCount;
+    std::atomic<uint64_t> literalCount;
+    std::atomic<uint64_t> compilationTime;
+};
+
+/**
+ * Lazily compiled methods. A method definition of a script can be installed
+ * as a stub, which is the handle of its AST. The method is compiled when it
+ * is looked up for the first time, and it replaces the stub in the method
+ * dictionary. The tree of a script is kept until its last stub is compiled.
+ */
+class LazyMethodTable
+{
+public:
+    LazyMethodTable(VMContext *context);
+    ~LazyMethodTable();
+
+    void add(Oop clazz, Oop stub, const std::shared_ptr<Arena> &arena);
+
+    // Compiles the method of a stub.
+    Oop compile(Oop stub);
+
+    // Compiles all of the installed stubs.
+    void compileAll();
+
+private:
+    struct LazyMethod
+    {
+        LazyMethod(VMContext *context, Oop clazz, Oop stub, const std::shared_ptr<Arena> &arena)
+            : classRef(context, clazz), stubRef(context, stub), arena(arena) {}
+
+        OopRef classRef;
+        OopRef stubRef;
+        std::shared_ptr<Arena> arena;
+    };
+
+    VMContext *context;
+    std::unordered_map<AST::MethodAST*, std::unique_ptr<LazyMethod>> methods;
+};
 
 // Compiler interface
 int executeDoIt(InterpreterProxy *interpreter, const std::string &code);
@@ -1,6 +1,14 @@
+#include <errno.h>
 #include <algorithm>
 #include "FileSystem.hpp"
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
 namespace Lodtalk
 {
 	
@@ -50,4 +58,21 @@ bool isAbsolutePath(const std::string &path)
 #endif
 }
 
-}
\ No newline at end of file
+bool makeDirectory(const std::string &path)
+{
+	if(path.empty())
+		return true;
+
+	// Create the parent first.
+	auto parent = dirname(path.substr(0, path.size() - 1));
+	if(!parent.empty() && parent.size() < path.size() && !makeDirectory(parent))
+		return false;
+
+#ifdef _WIN32
+	return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+	return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+}
@@ -10,6 +10,9 @@ std::string dirname(const std::string &filename);
 std::string joinPath(const std::string &path1, const std::string &path2);
 bool isAbsolutePath(const std::string &path);
 
+// Creates a directory and its missing parents. An existing directory is not an error.
+bool makeDirectory(const std::string &path);
+
 } // End of namespace Lodtalk
 
 #endif //LODTALK_FILESYSTEM_HPP
\ No newline at end of file
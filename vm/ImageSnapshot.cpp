@@ -0,0 +1,582 @@
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+#include <stdlib.h>
+#include "Lodtalk/VMContext.hpp"
+#include "ImageSnapshot.hpp"
+#include "MemoryManager.hpp"
+#include "Compiler.hpp"
+#include "Method.hpp"
+#include "RAII.hpp"
+
+namespace Lodtalk
+{
+
+static_assert(sizeof(ImageHeader) <= ImageBlockSize, "the image header must fit before the heap");
+
+// Gets the object of an allocation in the heap, and the size of the allocation.
+static Oop objectOfAllocation(uint8_t *allocation, size_t &allocationSize)
+{
+    auto header = reinterpret_cast<ObjectHeader*> (allocation);
+    if(header->slotCount == BigObjectSlotCountMarker)
+    {
+        auto slotCount = decodeBigObjectSlotCount(*reinterpret_cast<uint64_t*> (allocation));
+        allocationSize = 8 + sizeof(ObjectHeader) + slotCount*sizeof(void*);
+        return Oop::fromPointer(allocation + 8);
+    }
+
+    allocationSize = sizeof(ObjectHeader) + header->slotCount*sizeof(void*);
+    return Oop::fromPointer(allocation);
+}
+
+// The large objects always have their slot count before the header.
+static size_t largeObjectAllocationSize(uint8_t *pages)
+{
+    auto slotCount = decodeBigObjectSlotCount(*reinterpret_cast<uint64_t*> (pages));
+    return 8 + sizeof(ObjectHeader) + slotCount*sizeof(void*);
+}
+
+// Iterates the slots of an object that can contain pointers.
+template<typename FT>
+static void pointerSlotsDo(Oop object, const FT &f)
+{
+    auto format = object.header->objectFormat;
+    if(format == OF_FIXED_SIZE ||
+       format == OF_VARIABLE_SIZE_NO_IVARS ||
+       format == OF_VARIABLE_SIZE_IVARS ||
+       format == OF_WEAK_VARIABLE_SIZE ||
+       format == OF_EPHEMERON)
+    {
+        auto slotCount = object.getSlotCount();
+        auto slots = reinterpret_cast<Oop*> (object.getFirstFieldPointer());
+        for(size_t i = 0; i < slotCount; ++i)
+            f(slots[i]);
+    }
+
+    // Compiled method literals.
+    if(format >= OF_COMPILED_METHOD)
+    {
+        auto compiledMethod = reinterpret_cast<CompiledMethod*> (object.pointer);
+        auto literalCount = compiledMethod->getLiteralCount();
+        auto literals = compiledMethod->getFirstLiteralPointer();
+        for(size_t i = 0; i < literalCount; ++i)
+            f(literals[i]);
+    }
+}
+
+// Iterates the words of an object that contain native pointers, which are not valid in another process.
+template<typename FT>
+static void nativePointerWordsDo(Oop object, const FT &f)
+{
+    switch(object.header->classIndex)
+    {
+    case SCI_NativeMethod:
+        f(reinterpret_cast<uint8_t*> (&reinterpret_cast<NativeMethod*> (object.pointer)->primitive));
+        break;
+    case SCI_MethodASTHandle:
+        f(reinterpret_cast<uint8_t*> (&reinterpret_cast<MethodASTHandle*> (object.pointer)->ast));
+        break;
+    case SCI_ExternalHandle:
+    case SCI_ExternalPointer:
+        {
+            auto first = reinterpret_cast<uint8_t*> (object.getFirstFieldPointer());
+            auto size = object.getNumberOfElements();
+            for(size_t i = 0; i < size; i += sizeof(uint64_t))
+                f(first + i);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static bool writeWord(FILE *file, uint64_t value)
+{
+    return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool readWord(FILE *file, uint64_t &value)
+{
+    return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+static size_t alignedToImageBlock(size_t size)
+{
+    return (size + ImageBlockSize - 1) & (~(ImageBlockSize - 1));
+}
+
+// Image relocation
+ImageRelocation::ImageRelocation()
+    : oldHeapBase(0), heapSize(0), newHeapBase(nullptr), changedPointers(0)
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        oldSpecialObjectAddresses[i] = 0;
+        newSpecialObjectAddresses[i] = nullptr;
+    }
+}
+
+uint64_t ImageRelocation::relocate(uint64_t address) const
+{
+    // Objects in the heap.
+    if(address - oldHeapBase < heapSize)
+        return reinterpret_cast<uintptr_t> (newHeapBase) + (address - oldHeapBase);
+
+    // Special objects.
+    for(int i = 0; i < 3; ++i)
+    {
+        if(address == oldSpecialObjectAddresses[i])
+            return reinterpret_cast<uintptr_t> (newSpecialObjectAddresses[i]);
+    }
+
+    // Large objects.
+    auto it = std::lower_bound(largeObjectAddresses.begin(), largeObjectAddresses.end(), std::make_pair(address, (uint8_t*)nullptr));
+    if(it != largeObjectAddresses.end() && it->first == address)
+        return reinterpret_cast<uintptr_t> (it->second);
+
+    fprintf(stderr, "The image contains an invalid pointer 0x%llx.\n", (unsigned long long)address);
+    abort();
+}
+
+void ImageRelocation::relocateBlock(uint8_t *block, const uint64_t *blockBitmap) const
+{
+    auto words = reinterpret_cast<uint64_t*> (block);
+    for(size_t i = 0; i < ImageBlockBitmapWordCount; ++i)
+    {
+        auto bits = blockBitmap[i];
+        for(size_t bit = 0; bits; ++bit, bits >>= 1)
+        {
+            if(bits & 1)
+                words[i*64 + bit] = relocate(words[i*64 + bit]);
+        }
+    }
+}
+
+// Image snapshot
+ImageSnapshot::ImageSnapshot(VMContext *context)
+    : context(context), memoryManager(context->getMemoryManager())
+{
+    memset(&header, 0, sizeof(header));
+}
+
+ImageSnapshot::~ImageSnapshot()
+{
+}
+
+size_t ImageSnapshot::getMappedHeapSize() const
+{
+    return alignedToImageBlock(header.heapSize);
+}
+
+size_t ImageSnapshot::getBitmapSize() const
+{
+    return getMappedHeapSize() / ImageBlockSize * ImageBlockBitmapWordCount * sizeof(uint64_t);
+}
+
+bool ImageSnapshot::save(const std::string &fileName, Oop *globalDictionary)
+{
+    auto gc = memoryManager->getGarbageCollector();
+    std::unique_lock<std::mutex> l(gc->controlMutex);
+
+    // The heap has to be collected and compacted before saving it.
+    if(gc->disableCount > 0)
+    {
+        fprintf(stderr, "Cannot save the image while the garbage collector is disabled.\n");
+        return false;
+    }
+
+    // Compact the heap, so that the image only contains the live objects.
+    auto oldCompactionThreshold = gc->compactionThreshold;
+    gc->compactionThreshold = 0;
+    gc->performFullCollection();
+    gc->compactionThreshold = oldCompactionThreshold;
+
+    // Fill the header.
+    auto heap = memoryManager->getHeap();
+    auto classTable = memoryManager->getClassTable();
+    auto symbolTable = memoryManager->getSymbolTable();
+    memcpy(header.magic, ImageMagic, sizeof(header.magic));
+    header.version = ImageFormatVersion;
+    header.wordSize = sizeof(void*);
+    header.heapBase = reinterpret_cast<uintptr_t> (heap->getAddressSpace());
+    header.heapSize = heap->getSize();
+    header.heapOffset = ImageBlockSize;
+    header.regionCount = gc->regionFirstObjects.size();
+    header.largeObjectCount = gc->largeObjects.size();
+    header.classTableSize = classTable->getSize();
+    header.nilAddress = reinterpret_cast<uintptr_t> (nilOop().pointer);
+    header.trueAddress = reinterpret_cast<uintptr_t> (trueOop().pointer);
+    header.falseAddress = reinterpret_cast<uintptr_t> (falseOop().pointer);
+    header.nilIdentityHash = nilOop().header->identityHash;
+    header.trueIdentityHash = trueOop().header->identityHash;
+    header.falseIdentityHash = falseOop().header->identityHash;
+    header.globalDictionary = reinterpret_cast<uintptr_t> (globalDictionary->pointer);
+    header.symbolTable = reinterpret_cast<uintptr_t> (symbolTable->getTableOop().pointer);
+    header.symbolCount = symbolTable->getSymbolCount();
+
+    // Find the pointers of the heap.
+    std::vector<uint64_t> bitmap(getBitmapSize() / sizeof(uint64_t));
+    std::vector<uint8_t> flags(getMappedHeapSize() / ImageBlockSize);
+    std::vector<size_t> nativePointerOffsets;
+    if(!describeHeap(bitmap, flags, nativePointerOffsets))
+        return false;
+
+    StdFile file(fileName, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open the image file '%s' for writing.\n", fileName.c_str());
+        return false;
+    }
+
+    // Write the header, the heap and its descriptions.
+    bool succeeded = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fseek(file, long(header.heapOffset), SEEK_SET) == 0 &&
+        writeHeap(file, nativePointerOffsets) &&
+        fwrite(bitmap.data(), sizeof(uint64_t), bitmap.size(), file) == bitmap.size() &&
+        fwrite(flags.data(), 1, flags.size(), file) == flags.size();
+
+    for(auto regionFirstObject : gc->regionFirstObjects)
+        succeeded = succeeded && writeWord(file, regionFirstObject - heap->getAddressSpace());
+
+    // Write the large objects with their address.
+    for(auto pages : gc->largeObjects)
+    {
+        auto allocationSize = largeObjectAllocationSize(pages);
+        succeeded = succeeded &&
+            writeWord(file, reinterpret_cast<uintptr_t> (pages + 8)) &&
+            writeWord(file, allocationSize) &&
+            fwrite(pages, 1, allocationSize, file) == allocationSize;
+    }
+
+    // Write the class table.
+    for(size_t i = 0; i < header.classTableSize; ++i)
+        succeeded = succeeded && writeWord(file, reinterpret_cast<uintptr_t> (classTable->getClassFromIndex(i)));
+
+    if(!succeeded)
+        fprintf(stderr, "Failed to write the image file '%s'.\n", fileName.c_str());
+    return succeeded;
+}
+
+bool ImageSnapshot::describeHeap(std::vector<uint64_t> &bitmap, std::vector<uint8_t> &flags, std::vector<size_t> &nativePointerOffsets)
+{
+    auto gc = memoryManager->getGarbageCollector();
+    auto heapStart = memoryManager->getHeap()->getAddressSpace();
+    auto heapEnd = heapStart + header.heapSize;
+
+    std::vector<uint64_t> largeObjects;
+    for(auto pages : gc->largeObjects)
+        largeObjects.push_back(reinterpret_cast<uintptr_t> (pages + 8));
+    std::sort(largeObjects.begin(), largeObjects.end());
+
+    bool succeeded = true;
+    size_t allocationSize;
+    for(auto position = heapStart; position < heapEnd; position += allocationSize)
+    {
+        auto object = objectOfAllocation(position, allocationSize);
+        if(object.header->isFreeChunk)
+            continue;
+
+        // Mark the pointer slots, and the kind of pointers of each block.
+        pointerSlotsDo(object, [&](Oop &slot) {
+            if(!slot.isPointer())
+                return;
+
+            auto offset = size_t(reinterpret_cast<uint8_t*> (&slot) - heapStart);
+            auto word = offset / sizeof(uint64_t);
+            auto address = reinterpret_cast<uintptr_t> (slot.pointer);
+            bitmap[word / 64] |= uint64_t(1) << (word % 64);
+
+            auto &blockFlags = flags[offset / ImageBlockSize];
+            if(heapStart <= slot.pointer && slot.pointer < heapEnd)
+                blockFlags |= IBF_HeapPointers;
+            else if(address == header.nilAddress || address == header.trueAddress || address == header.falseAddress)
+                blockFlags |= IBF_SpecialObjectPointers;
+            else if(std::binary_search(largeObjects.begin(), largeObjects.end(), address))
+                blockFlags |= IBF_LargeObjectPointers;
+            else
+                succeeded = false;
+        });
+
+        nativePointerWordsDo(object, [&](uint8_t *word) {
+            nativePointerOffsets.push_back(word - heapStart);
+        });
+    }
+
+    if(!succeeded)
+        fprintf(stderr, "Cannot save an image with pointers outside of the object memory.\n");
+    return succeeded;
+}
+
+bool ImageSnapshot::writeHeap(FILE *file, const std::vector<size_t> &nativePointerOffsets)
+{
+    // The heap is padded to whole blocks, and the native pointers are cleared.
+    auto heapStart = memoryManager->getHeap()->getAddressSpace();
+    std::vector<uint8_t> block(ImageBlockSize);
+    auto nativePointer = nativePointerOffsets.begin();
+    for(size_t blockOffset = 0; blockOffset < header.heapSize; blockOffset += ImageBlockSize)
+    {
+        auto blockSize = std::min(ImageBlockSize, size_t(header.heapSize - blockOffset));
+        memcpy(block.data(), heapStart + blockOffset, blockSize);
+        memset(block.data() + blockSize, 0, ImageBlockSize - blockSize);
+        for(; nativePointer != nativePointerOffsets.end() && *nativePointer < blockOffset + ImageBlockSize; ++nativePointer)
+            memset(&block[*nativePointer - blockOffset], 0, sizeof(uint64_t));
+
+        if(fwrite(block.data(), 1, ImageBlockSize, file) != ImageBlockSize)
+            return false;
+    }
+
+    return true;
+}
+
+bool ImageSnapshot::load(const std::string &fileName, Oop &globalDictionary)
+{
+    StdFile file(fileName, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open the image file '%s'.\n", fileName.c_str());
+        return false;
+    }
+
+    auto gc = memoryManager->getGarbageCollector();
+    auto heap = memoryManager->getHeap();
+    std::unique_lock<std::mutex> l(gc->controlMutex);
+    if(!readHeader(file))
+        return false;
+
+    // Read the descriptions that follow the heap.
+    blockFlags.resize(getMappedHeapSize() / ImageBlockSize);
+    std::vector<uint64_t> regionOffsets(header.regionCount);
+    std::vector<uint64_t> classAddresses(header.classTableSize);
+    if(fseek(file, long(header.heapOffset + getMappedHeapSize() + getBitmapSize()), SEEK_SET) != 0 ||
+       fread(blockFlags.data(), 1, blockFlags.size(), file) != blockFlags.size() ||
+       fread(regionOffsets.data(), sizeof(uint64_t), regionOffsets.size(), file) != regionOffsets.size() ||
+       !readLargeObjects(file) ||
+       fread(classAddresses.data(), sizeof(uint64_t), classAddresses.size(), file) != classAddresses.size())
+    {
+        fprintf(stderr, "The image file '%s' is truncated.\n", fileName.c_str());
+        return false;
+    }
+
+    // Compute the kinds of pointers that have a different value in this process.
+    relocation.oldHeapBase = header.heapBase;
+    relocation.heapSize = header.heapSize;
+    relocation.newHeapBase = heap->getAddressSpace();
+    relocation.oldSpecialObjectAddresses[0] = header.nilAddress;
+    relocation.oldSpecialObjectAddresses[1] = header.trueAddress;
+    relocation.oldSpecialObjectAddresses[2] = header.falseAddress;
+    relocation.newSpecialObjectAddresses[0] = nilOop().pointer;
+    relocation.newSpecialObjectAddresses[1] = trueOop().pointer;
+    relocation.newSpecialObjectAddresses[2] = falseOop().pointer;
+    if(relocation.newHeapBase != reinterpret_cast<uint8_t*> (uintptr_t(header.heapBase)))
+        relocation.changedPointers |= IBF_HeapPointers;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(relocation.newSpecialObjectAddresses[i] != reinterpret_cast<uint8_t*> (uintptr_t(relocation.oldSpecialObjectAddresses[i])))
+            relocation.changedPointers |= IBF_SpecialObjectPointers;
+    }
+    for(auto &addresses : relocation.largeObjectAddresses)
+    {
+        if(addresses.second != reinterpret_cast<uint8_t*> (uintptr_t(addresses.first)))
+            relocation.changedPointers |= IBF_LargeObjectPointers;
+    }
+
+    // Map the heap, or read it when it cannot be mapped. Only the relocated blocks of a mapped heap stop being shared.
+    if((!mapHeap(file) && !readHeap(file)) || !relocateHeap(file))
+        return false;
+    for(auto offset : regionOffsets)
+        gc->regionFirstObjects.push_back(relocation.newHeapBase + offset);
+
+    // The large objects are relocated when loading them.
+    for(auto &addresses : relocation.largeObjectAddresses)
+    {
+        auto object = Oop::fromPointer(addresses.second);
+        pointerSlotsDo(object, [&](Oop &slot) {
+            if(slot.isPointer())
+                slot.pointer = reinterpret_cast<uint8_t*> (uintptr_t(relocation.relocate(reinterpret_cast<uintptr_t> (slot.pointer))));
+        });
+        nativePointerWordsDo(object, [&](uint8_t *word) {
+            memset(word, 0, sizeof(uint64_t));
+        });
+    }
+
+    // Restore the class table.
+    std::vector<Oop> classes(header.classTableSize);
+    for(size_t i = 0; i < classes.size(); ++i)
+    {
+        if(!relocateRoot(classes[i], classAddresses[i]))
+            return false;
+    }
+    memoryManager->getClassTable()->restore(classes);
+
+    // Restore the symbol table.
+    Oop symbolTable;
+    if(!relocateRoot(symbolTable, header.symbolTable))
+        return false;
+    memoryManager->getSymbolTable()->restore(symbolTable, header.symbolCount);
+
+    // The identity hash of the special objects is kept from the saved process.
+    nilOop().header->identityHash = header.nilIdentityHash;
+    trueOop().header->identityHash = header.trueIdentityHash;
+    falseOop().header->identityHash = header.falseIdentityHash;
+
+    if(!relocateRoot(globalDictionary, header.globalDictionary))
+        return false;
+
+    // The loaded objects are the live objects of the heap sizing policy.
+    gc->sizingPolicy.collectionCycleFinished(header.heapSize + gc->largeObjectSpaceSize);
+    return true;
+}
+
+bool ImageSnapshot::relocateRoot(Oop &root, uint64_t address)
+{
+    root.pointer = reinterpret_cast<uint8_t*> (uintptr_t(address));
+    if(!root.isPointer())
+    {
+        fprintf(stderr, "The image contains an invalid root 0x%llx.\n", (unsigned long long)address);
+        return false;
+    }
+
+    root.pointer = reinterpret_cast<uint8_t*> (uintptr_t(relocation.relocate(address)));
+    return true;
+}
+
+bool ImageSnapshot::readHeader(FILE *file)
+{
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, ImageMagic, sizeof(header.magic)))
+    {
+        fprintf(stderr, "The file is not a Lodtalk image.\n");
+        return false;
+    }
+
+    if(header.version != ImageFormatVersion || header.wordSize != sizeof(void*))
+    {
+        fprintf(stderr, "Unsupported image version %d with %d bytes words.\n", header.version, header.wordSize);
+        return false;
+    }
+
+    // The image is loaded into an empty object memory.
+    auto gc = memoryManager->getGarbageCollector();
+    auto heap = memoryManager->getHeap();
+    if(heap->getCapacity() != 0 || !gc->largeObjects.empty())
+    {
+        fprintf(stderr, "An image can only be loaded into an empty object memory.\n");
+        return false;
+    }
+
+    if(getMappedHeapSize() > heap->getMaxCapacity())
+    {
+        fprintf(stderr, "The VM heap is too small for the image.\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool ImageSnapshot::readLargeObjects(FILE *file)
+{
+    auto gc = memoryManager->getGarbageCollector();
+    auto &largeObjectAddresses = relocation.largeObjectAddresses;
+    largeObjectAddresses.reserve(header.largeObjectCount);
+    for(size_t i = 0; i < header.largeObjectCount; ++i)
+    {
+        uint64_t address;
+        uint64_t allocationSize;
+        if(!readWord(file, address) || !readWord(file, allocationSize) || allocationSize < 8 + sizeof(ObjectHeader))
+            return false;
+
+        auto object = gc->allocateLargeObject(allocationSize - 8);
+        if(!object)
+        {
+            fprintf(stderr, "Failed to allocate the pages of a large object.\n");
+            return false;
+        }
+
+        if(fread(object - 8, 1, allocationSize, file) != allocationSize)
+            return false;
+
+        largeObjectAddresses.push_back(std::make_pair(address, object));
+    }
+
+    std::sort(largeObjectAddresses.begin(), largeObjectAddresses.end());
+    return true;
+}
+
+bool ImageSnapshot::readHeap(FILE *file)
+{
+    auto heap = memoryManager->getHeap();
+    auto heapStart = heap->allocate(header.heapSize);
+    if(!heapStart)
+    {
+        fprintf(stderr, "The VM heap is too small for the image.\n");
+        return false;
+    }
+
+    if(fseek(file, long(header.heapOffset), SEEK_SET) != 0 ||
+       fread(heapStart, 1, header.heapSize, file) != header.heapSize)
+    {
+        fprintf(stderr, "The image heap is truncated.\n");
+        return false;
+    }
+
+    return true;
+}
+
+bool ImageSnapshot::relocateHeap(FILE *file)
+{
+    bool needsRelocation = false;
+    for(auto flags : blockFlags)
+        needsRelocation = needsRelocation || (flags & relocation.changedPointers) != 0;
+    if(!needsRelocation)
+        return true;
+
+    std::vector<uint64_t> bitmap(getBitmapSize() / sizeof(uint64_t));
+    if(fseek(file, long(header.heapOffset + getMappedHeapSize()), SEEK_SET) != 0 ||
+       fread(bitmap.data(), sizeof(uint64_t), bitmap.size(), file) != bitmap.size())
+    {
+        fprintf(stderr, "The image heap is truncated.\n");
+        return false;
+    }
+
+    // Relocate the blocks whose pointers have changed.
+    for(size_t i = 0; i < blockFlags.size(); ++i)
+    {
+        if(blockFlags[i] & relocation.changedPointers)
+            relocation.relocateBlock(relocation.newHeapBase + i*ImageBlockSize, &bitmap[i*ImageBlockBitmapWordCount]);
+    }
+
+    return true;
+}
+
+#ifdef __linux__
+bool ImageSnapshot::mapHeap(FILE *file)
+{
+    auto heap = memoryManager->getHeap();
+    auto heapStart = heap->getAddressSpace();
+    auto mappedSize = getMappedHeapSize();
+    if(mappedSize == 0)
+        return false;
+
+    // Map the heap copy on write, so its pages are shared until they are modified.
+    if(mmap(heapStart, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), header.heapOffset) == MAP_FAILED)
+    {
+        // Reserve the address space again.
+        mmap(heapStart, mappedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        return false;
+    }
+
+    heap->setMappedImage(header.heapSize, mappedSize);
+    return true;
+}
+#else
+bool ImageSnapshot::mapHeap(FILE *file)
+{
+    // The image is read instead.
+    return false;
+}
+#endif
+
+} // End of namespace Lodtalk
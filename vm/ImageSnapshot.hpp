@@ -0,0 +1,143 @@
+#ifndef LODTALK_IMAGE_SNAPSHOT_HPP
+#define LODTALK_IMAGE_SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdio.h>
+#include <stdint.h>
+#include "Lodtalk/ObjectModel.hpp"
+
+namespace Lodtalk
+{
+class VMContext;
+class MemoryManager;
+
+// The image file identification.
+static const char ImageMagic[8] = {'L', 'O', 'D', 'T', 'A', 'L', 'K', 0};
+static constexpr uint32_t ImageFormatVersion = 2;
+
+// The heap of an image is mapped and relocated in blocks of this size. It is a multiple of the page size.
+static constexpr size_t ImageBlockSize = 64*1024;
+static constexpr size_t ImageBlockWordCount = ImageBlockSize / sizeof(uint64_t);
+static constexpr size_t ImageBlockBitmapWordCount = ImageBlockWordCount / 64;
+
+// The kinds of pointers in an image block.
+enum ImageBlockFlags
+{
+    IBF_HeapPointers = 1<<0,
+    IBF_SpecialObjectPointers = 1<<1,
+    IBF_LargeObjectPointers = 1<<2,
+};
+
+/**
+ * The header of an image file. The addresses are the ones of the saved
+ * process, and they are used for relocating the pointers when loading.
+ *
+ * The heap starts at a block aligned offset, so it can be mapped from the
+ * file. It is followed by a bitmap with the pointer slots of the heap, the
+ * flags of each heap block, the first object of each compaction region,
+ * the large objects and the class table.
+ */
+struct ImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t wordSize;
+
+    uint64_t heapBase;
+    uint64_t heapSize;
+    uint64_t heapOffset;
+    uint64_t regionCount;
+    uint64_t largeObjectCount;
+    uint64_t classTableSize;
+
+    // The special objects, which are not in the image.
+    uint64_t nilAddress;
+    uint64_t trueAddress;
+    uint64_t falseAddress;
+    uint32_t nilIdentityHash;
+    uint32_t trueIdentityHash;
+    uint32_t falseIdentityHash;
+    uint32_t reserved;
+
+    // The roots.
+    uint64_t globalDictionary;
+    uint64_t symbolTable;
+    uint64_t symbolCount;
+};
+
+/**
+ * The relocation of the pointers of an image. A pointer is relocated by
+ * its value, so the slots can be relocated without parsing the objects.
+ */
+struct ImageRelocation
+{
+    ImageRelocation();
+
+    uint64_t relocate(uint64_t address) const;
+    void relocateBlock(uint8_t *block, const uint64_t *blockBitmap) const;
+
+    uint64_t oldHeapBase;
+    uint64_t heapSize;
+    uint8_t *newHeapBase;
+    uint64_t oldSpecialObjectAddresses[3];
+    uint8_t *newSpecialObjectAddresses[3];
+
+    // The new address of each large object, sorted by the old address.
+    std::vector<std::pair<uint64_t, uint8_t*>> largeObjectAddresses;
+
+    // The block flags of the pointers whose value changes.
+    unsigned int changedPointers;
+};
+
+/**
+ * Image snapshot. It saves the object memory into a file, and loads it back
+ * into a new context. The image contains the VM heap, the large objects,
+ * the class table and the symbol table. The special objects nil, true and
+ * false are not in the image. Like the heap, they are at a fixed address
+ * when it is free, so the pointers to them are only relocated when a
+ * process cannot get that address.
+ *
+ * Where it is supported, the heap is mapped copy on write from the image.
+ * The blocks whose pointers have changed are relocated when loading, so
+ * only these blocks stop being shared with the other processes.
+ */
+class ImageSnapshot
+{
+public:
+    ImageSnapshot(VMContext *context);
+    ~ImageSnapshot();
+
+    // Saves the object memory. It must be called outside of the interpreter.
+    // The global dictionary is read from its root after the collection.
+    bool save(const std::string &fileName, Oop *globalDictionary);
+
+    // Loads the object memory into an empty context. It returns the global dictionary.
+    bool load(const std::string &fileName, Oop &globalDictionary);
+
+private:
+    bool describeHeap(std::vector<uint64_t> &bitmap, std::vector<uint8_t> &blockFlags, std::vector<size_t> &nativePointerOffsets);
+    bool writeHeap(FILE *file, const std::vector<size_t> &nativePointerOffsets);
+
+    bool readHeader(FILE *file);
+    bool readLargeObjects(FILE *file);
+    bool mapHeap(FILE *file);
+    bool readHeap(FILE *file);
+    bool relocateHeap(FILE *file);
+    bool relocateRoot(Oop &root, uint64_t address);
+
+    size_t getMappedHeapSize() const;
+    size_t getBitmapSize() const;
+
+    VMContext *context;
+    MemoryManager *memoryManager;
+
+    ImageHeader header;
+    ImageRelocation relocation;
+    std::vector<uint8_t> blockFlags;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_IMAGE_SNAPSHOT_HPP
@@ -20,8 +20,32 @@ public:
 	static int stStderr(InterpreterProxy *interpreter);
 
 	static int stWriteOffsetSizeTo(InterpreterProxy *interpreter);
+	static int stReadOffsetSizeFrom(InterpreterProxy *interpreter);
+
+    // Gets the byte range of an indexable native buffer. A pinned buffer keeps its address across the GC safe points.
+    static bool getBufferRange(Oop bufferOop, Oop offsetOop, Oop sizeOop, uint8_t *&start, size_t &size);
 };
 
+inline bool OSIO::getBufferRange(Oop bufferOop, Oop offsetOop, Oop sizeOop, uint8_t *&start, size_t &size)
+{
+	if(!bufferOop.isIndexableNativeData() || !offsetOop.isSmallInteger() || !sizeOop.isSmallInteger())
+		return false;
+
+	auto offset = offsetOop.decodeSmallInteger();
+	auto count = sizeOop.decodeSmallInteger();
+	if(offset < 0 || count < 0)
+		return false;
+
+	// The range must be inside of the buffer.
+	auto bufferSize = bufferOop.getNumberOfElements() * variableSlotSizeFor((ObjectFormat)bufferOop.header->objectFormat);
+	if(size_t(offset) > bufferSize || size_t(count) > bufferSize - offset)
+		return false;
+
+	start = reinterpret_cast<uint8_t*> (bufferOop.getFirstFieldPointer()) + offset;
+	size = count;
+	return true;
+}
+
 } // End of namespace Lodtalk
 
 #endif //LODTALK_INPUT_OUTPUT_HPP
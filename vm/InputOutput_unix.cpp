@@ -15,12 +15,12 @@ int OSIO::stStdout(InterpreterProxy *interpreter)
 
 int OSIO::stStdin(InterpreterProxy *interpreter)
 {
-    return interpreter->returnSmallInteger(STDOUT_FILENO);
+    return interpreter->returnSmallInteger(STDIN_FILENO);
 }
 
 int OSIO::stStderr(InterpreterProxy *interpreter)
 {
-    return interpreter->returnSmallInteger(STDOUT_FILENO);
+    return interpreter->returnSmallInteger(STDERR_FILENO);
 }
 
 // Oop bufferOop, Oop offsetOop, Oop sizeOop, Oop fileOop
@@ -34,31 +34,47 @@ int OSIO::stWriteOffsetSizeTo(InterpreterProxy *interpreter)
     Oop sizeOop = interpreter->getTemporary(2);
     Oop fileOop = interpreter->getTemporary(3);
 
-	// Check the arguments.
-	if(!bufferOop.isIndexableNativeData() || !offsetOop.isSmallInteger() || !sizeOop.isSmallInteger() || !fileOop.isSmallInteger())
+	// Check and decode the arguments.
+	uint8_t *buffer;
+	size_t size;
+	if(!fileOop.isSmallInteger() || !getBufferRange(bufferOop, offsetOop, sizeOop, buffer, size))
 		return interpreter->primitiveFailed();
-
-	// Decode the arguments
-	auto buffer = reinterpret_cast<uint8_t *> (bufferOop.getFirstFieldPointer());
-	auto offset = offsetOop.decodeSmallInteger();
-	auto size = sizeOop.decodeSmallInteger();
 	auto file = fileOop.decodeSmallInteger();
 
-	// Validate some of the arguments.
-	if(offset < 0)
+	// Perform the write
+	auto res = write(file, buffer, size);
+	return interpreter->returnSmallInteger(res);
+}
+
+int OSIO::stReadOffsetSizeFrom(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 4)
+        return interpreter->primitiveFailed();
+
+    Oop bufferOop = interpreter->getTemporary(0);
+    Oop offsetOop = interpreter->getTemporary(1);
+    Oop sizeOop = interpreter->getTemporary(2);
+    Oop fileOop = interpreter->getTemporary(3);
+
+	// Check and decode the arguments.
+	uint8_t *buffer;
+	size_t size;
+	if(!fileOop.isSmallInteger() || !getBufferRange(bufferOop, offsetOop, sizeOop, buffer, size))
 		return interpreter->primitiveFailed();
+	auto file = fileOop.decodeSmallInteger();
 
-	// Perform the write
-	auto res = write(file, buffer + offset, size);
+	// Perform the read
+	auto res = read(file, buffer, size);
 	return interpreter->returnSmallInteger(res);
 }
 
 NativeClassFactory OSIO::Factory("OSIO", &Object::Factory, [](ClassBuilder &builder) {
     builder
         .addClassMethod("stdout", OSIO::stStdout)
-        .addClassMethod("stdin", OSIO::stStdout)
-        .addClassMethod("stderr", OSIO::stStdout)
-        .addClassMethod("write:offset:size:to:", OSIO::stWriteOffsetSizeTo);
+        .addClassMethod("stdin", OSIO::stStdin)
+        .addClassMethod("stderr", OSIO::stStderr)
+        .addClassMethod("write:offset:size:to:", OSIO::stWriteOffsetSizeTo)
+        .addClassMethod("read:offset:size:from:", OSIO::stReadOffsetSizeFrom);
 });
 }
 
@@ -34,35 +34,55 @@ int OSIO::stWriteOffsetSizeTo(InterpreterProxy *interpreter)
     Oop sizeOop = interpreter->getTemporary(2);
     Oop fileOop = interpreter->getTemporary(3);
 
-	// Check the arguments.
-	if(!bufferOop.isIndexableNativeData() || !offsetOop.isSmallInteger() || !sizeOop.isSmallInteger() || !fileOop.isExternalHandle())
+	// Check and decode the arguments.
+	uint8_t *buffer;
+	size_t size;
+	if(!fileOop.isExternalHandle() || !getBufferRange(bufferOop, offsetOop, sizeOop, buffer, size))
 		return interpreter->primitiveFailed();
-
-	// Decode the arguments
-	auto buffer = reinterpret_cast<uint8_t*> (bufferOop.getFirstFieldPointer());
-	auto offset = offsetOop.decodeSmallInteger();
-	auto size = sizeOop.decodeSmallInteger();
 	auto file = fileOop.decodeExternalHandle();
 
-	// Validate some of the arguments.
-	if(offset < 0)
-		return interpreter->primitiveFailed();
-
 	// Perform the write
     DWORD written;
-    auto success = WriteFile(file, buffer + offset, size, &written, nullptr);
+    auto success = WriteFile(file, buffer, (DWORD)size, &written, nullptr);
     if (success == FALSE)
         return interpreter->primitiveFailedWithCode(GetLastError());
 
     return interpreter->returnSmallInteger(written);
 }
 
+int OSIO::stReadOffsetSizeFrom(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 4)
+        return interpreter->primitiveFailed();
+
+    Oop bufferOop = interpreter->getTemporary(0);
+    Oop offsetOop = interpreter->getTemporary(1);
+    Oop sizeOop = interpreter->getTemporary(2);
+    Oop fileOop = interpreter->getTemporary(3);
+
+	// Check and decode the arguments.
+	uint8_t *buffer;
+	size_t size;
+	if(!fileOop.isExternalHandle() || !getBufferRange(bufferOop, offsetOop, sizeOop, buffer, size))
+		return interpreter->primitiveFailed();
+	auto file = fileOop.decodeExternalHandle();
+
+	// Perform the read
+    DWORD read;
+    auto success = ReadFile(file, buffer, (DWORD)size, &read, nullptr);
+    if (success == FALSE)
+        return interpreter->primitiveFailedWithCode(GetLastError());
+
+    return interpreter->returnSmallInteger(read);
+}
+
 NativeClassFactory OSIO::Factory("OSIO", &Object::Factory, [](ClassBuilder &builder) {
     builder
         .addClassMethod("stdout", OSIO::stStdout)
-        .addClassMethod("stdin", OSIO::stStdout)
-        .addClassMethod("stderr", OSIO::stStdout)
-        .addClassMethod("write:offset:size:to:", OSIO::stWriteOffsetSizeTo);
+        .addClassMethod("stdin", OSIO::stStdin)
+        .addClassMethod("stderr", OSIO::stStderr)
+        .addClassMethod("write:offset:size:to:", OSIO::stWriteOffsetSizeTo)
+        .addClassMethod("read:offset:size:from:", OSIO::stReadOffsetSizeFrom);
 });
 
 }
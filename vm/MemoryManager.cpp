@@ -1,6 +1,7 @@
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <intrin.h>
 
 #undef min
 #undef max
@@ -12,9 +13,14 @@
 #include "Lodtalk/VMContext.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <string.h>
 #include "Method.hpp"
+#include "AllocationProfiler.hpp"
 #include "MemoryManager.hpp"
+#include "WorkerPool.hpp"
 
 namespace Lodtalk
 {
@@ -77,21 +83,37 @@ void ClassTable::setClassAtIndex(ClassDescription *description, size_t index)
     pageTable[pageIndex][elementIndex] = Oop::fromPointer(description);
 }
 
+size_t ClassTable::getSize()
+{
+    ReadLock<SharedMutex> l(sharedMutex);
+    return size;
+}
+
+void ClassTable::restore(const std::vector<Oop> &classes)
+{
+    WriteLock<SharedMutex> l(sharedMutex);
+    for(size_t i = pageTable.size()*OopsPerPage; i < classes.size(); i += OopsPerPage)
+        allocatePage();
+
+    // The identity hash of each class is already its index.
+    for(size_t i = 0; i < classes.size(); ++i)
+        pageTable[i / OopsPerPage][i % OopsPerPage] = classes[i];
+    size = classes.size();
+}
+
 void ClassTable::allocatePage()
 {
     pageTable.push_back(new Oop[OopsPerPage]);
 }
 
-// Extra forwarding pointer used for compaction
+// The layout of an object in the heap. Big objects have their slot count before the header.
 struct AllocatedObject
 {
-    uint64_t rawForwardingPointer;
-
     union
     {
         struct
         {
-            uint64_t extraSlotCount;
+            uint64_t slotCountWord;
             ObjectHeader header;
         } bigObject;
 
@@ -103,9 +125,9 @@ struct AllocatedObject
 
     size_t computeSize() const
     {
-        auto size = 8 + sizeof(ObjectHeader);
+        auto size = sizeof(ObjectHeader);
         if(isBigObject())
-            size += 8 + bigObject.extraSlotCount*sizeof(void*);
+            size += 8 + decodeBigObjectSlotCount(bigObject.slotCountWord)*sizeof(void*);
         else
             size += smallObject.header.slotCount*sizeof(void*);
 
@@ -114,42 +136,174 @@ struct AllocatedObject
 
     bool isBigObject() const
     {
-        return (rawForwardingPointer & 1) != 0;
+        // The slot count word of a big object looks like a header with 255 slots.
+        return smallObject.header.slotCount == BigObjectSlotCountMarker;
     }
 
-    void *getForwardingPointer() const
+    ObjectHeader &header()
     {
-        return reinterpret_cast<void*> (uintptr_t(rawForwardingPointer & (-ObjectAlignment)));
+        return isBigObject() ? bigObject.header : smallObject.header;
     }
 
-    void *getForwardingDestination() const
+    uint64_t slotCount()
     {
-        auto offset = isBigObject() ? 16 : 8;
-        return reinterpret_cast<uint8_t*> (getForwardingPointer()) - offset;
+        return isBigObject() ? decodeBigObjectSlotCount(bigObject.slotCountWord) : smallObject.header.slotCount;
     }
+};
 
-    void setForwardingPointer(void *newPointer)
+inline unsigned int populationCount(uint64_t value)
+{
+#ifdef _MSC_VER
+    return (unsigned int)__popcnt64(value);
+#else
+    return (unsigned int)__builtin_popcountll(value);
+#endif
+}
+
+inline unsigned int countTrailingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (unsigned int)index;
+#else
+    return (unsigned int)__builtin_ctzll(value);
+#endif
+}
+
+inline uint64_t elapsedMicroseconds(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Turns a range of dead objects into a single free chunk that can be parsed as an object.
+inline uint8_t *makeFreeChunk(uint8_t *start, size_t size)
+{
+    auto wordCount = size / sizeof(uint64_t);
+    auto header = reinterpret_cast<ObjectHeader*> (start);
+    size_t slotCount = wordCount - 1;
+    bool isBig = slotCount >= BigObjectSlotCountMarker;
+    if(isBig)
     {
-        auto newPointerValue = reinterpret_cast<uintptr_t> (newPointer) & (-ObjectAlignment);
-        newPointerValue |= rawForwardingPointer & (ObjectAlignment - 1);
-        rawForwardingPointer = newPointerValue;
+        // The chunk has the layout of a big object, even when its slots would fit in the small header.
+        slotCount = wordCount - 2;
+        *reinterpret_cast<uint64_t*> (start) = encodeBigObjectSlotCount(slotCount);
+        ++header;
     }
 
-    ObjectHeader &header()
+    *header = {0};
+    header->slotCount = isBig ? BigObjectSlotCountMarker : slotCount;
+    header->isFreeChunk = true;
+    header->objectFormat = OF_EMPTY;
+    return start;
+}
+
+// The link to the next free chunk is stored in the first slot.
+inline uint8_t *&nextFreeChunkOf(uint8_t *chunk)
+{
+    return *reinterpret_cast<uint8_t**> (&reinterpret_cast<AllocatedObject*> (chunk)->header() + 1);
+}
+
+// Free chunk lists
+FreeChunkLists::FreeChunkLists()
+{
+    clear();
+}
+
+void FreeChunkLists::clear()
+{
+    for(size_t i = 0; i < FreeListSizeClassCount; ++i)
+        heads[i] = tails[i] = nullptr;
+    nonEmptyMask = 0;
+}
+
+void FreeChunkLists::add(uint8_t *chunk)
+{
+    // Chunks with a single word do not have space for the link.
+    auto wordCount = reinterpret_cast<AllocatedObject*> (chunk)->computeSize() / sizeof(uint64_t);
+    if(wordCount < 2)
+        return;
+
+    auto sizeClass = wordCount < FreeListSizeClassCount ? wordCount : 0;
+    nextFreeChunkOf(chunk) = heads[sizeClass];
+    if(!heads[sizeClass])
+        tails[sizeClass] = chunk;
+    heads[sizeClass] = chunk;
+    nonEmptyMask |= uint64_t(1) << sizeClass;
+}
+
+void FreeChunkLists::append(FreeChunkLists &other)
+{
+    for(size_t i = 0; i < FreeListSizeClassCount; ++i)
     {
-        return isBigObject() ? bigObject.header : smallObject.header;
+        if(!other.heads[i])
+            continue;
+
+        if(tails[i])
+            nextFreeChunkOf(tails[i]) = other.heads[i];
+        else
+            heads[i] = other.heads[i];
+        tails[i] = other.tails[i];
     }
 
-    uint64_t slotCount()
+    nonEmptyMask |= other.nonEmptyMask;
+    other.clear();
+}
+
+uint8_t *FreeChunkLists::allocate(size_t wordCount)
+{
+    // Use the smallest exact size list that is big enough.
+    if(wordCount < FreeListSizeClassCount)
     {
-        return isBigObject() ? bigObject.extraSlotCount : smallObject.header.slotCount;
+        auto candidates = nonEmptyMask & (~uint64_t(0) << wordCount) & ~uint64_t(1);
+        if(candidates)
+        {
+            auto sizeClass = countTrailingZeros(candidates);
+            auto chunk = heads[sizeClass];
+            heads[sizeClass] = nextFreeChunkOf(chunk);
+            if(!heads[sizeClass])
+            {
+                tails[sizeClass] = nullptr;
+                nonEmptyMask &= ~(uint64_t(1) << sizeClass);
+            }
+            return chunk;
+        }
     }
-};
+
+    // First fit in the list of the big chunks.
+    uint8_t *previous = nullptr;
+    for(auto chunk = heads[0]; chunk; previous = chunk, chunk = nextFreeChunkOf(chunk))
+    {
+        if(reinterpret_cast<AllocatedObject*> (chunk)->computeSize() < wordCount*sizeof(uint64_t))
+            continue;
+
+        auto next = nextFreeChunkOf(chunk);
+        if(previous)
+            nextFreeChunkOf(previous) = next;
+        else
+            heads[0] = next;
+        if(tails[0] == chunk)
+            tails[0] = previous;
+        if(!heads[0])
+            nonEmptyMask &= ~uint64_t(1);
+        return chunk;
+    }
+
+    return nullptr;
+}
 
 #ifdef _WIN32
 inline uint8_t *reserveVirtualAddressSpace(size_t size)
 {
-    return (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+    auto result = (uint8_t*)VirtualAlloc((void*)PreferredVMHeapAddress, size, MEM_RESERVE, PAGE_NOACCESS);
+    if(!result)
+        result = (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+    return result;
+}
+
+inline void releaseVirtualAddressSpace(uint8_t *addressSpace, size_t size)
+{
+    VirtualFree(addressSpace, 0, MEM_RELEASE);
 }
 
 inline bool allocateVirtualAddressRegion(uint8_t *addressSpace, size_t offset, size_t size)
@@ -163,6 +317,29 @@ inline bool freeVirtualAddressRegion(uint8_t *addressSpace, size_t offset, size_
     return VirtualFree(addressSpace + offset, size, MEM_DECOMMIT) == TRUE;
 }
 
+inline bool adviseHugePages(uint8_t *addressSpace, size_t size)
+{
+    return false;
+}
+
+inline uint8_t *allocateLargeObjectPages(size_t size)
+{
+    return (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+inline void freeLargeObjectPages(uint8_t *pages, size_t size)
+{
+    VirtualFree(pages, 0, MEM_RELEASE);
+}
+
+uint8_t *allocateSpecialObjectPages(size_t size)
+{
+    auto result = (uint8_t*)VirtualAlloc((void*)PreferredSpecialObjectsAddress, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if(!result)
+        result = (uint8_t*)VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    return result;
+}
+
 inline size_t getPageSize()
 {
     SYSTEM_INFO info;
@@ -173,10 +350,16 @@ inline size_t getPageSize()
 #else
 inline uint8_t *reserveVirtualAddressSpace(size_t size)
 {
-    auto result = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // The preferred address is only a hint.
+    auto result = mmap((void*)PreferredVMHeapAddress, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     return result != MAP_FAILED ? reinterpret_cast<uint8_t*> (result) : nullptr;
 }
 
+inline void releaseVirtualAddressSpace(uint8_t *addressSpace, size_t size)
+{
+    munmap(addressSpace, size);
+}
+
 inline bool allocateVirtualAddressRegion(uint8_t *addressSpace, size_t offset, size_t size)
 {
     return mprotect(addressSpace + offset, size, PROT_READ | PROT_WRITE) == 0;
@@ -184,9 +367,39 @@ inline bool allocateVirtualAddressRegion(uint8_t *addressSpace, size_t offset, s
 
 inline bool freeVirtualAddressRegion(uint8_t *addressSpace, size_t offset, size_t size)
 {
+    // Return the pages to the system before protecting them.
+    if(madvise(addressSpace + offset, size, MADV_DONTNEED) != 0)
+        return false;
     return mprotect(addressSpace + offset, size, PROT_NONE) == 0;
 }
 
+inline bool adviseHugePages(uint8_t *addressSpace, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    return madvise(addressSpace, size, MADV_HUGEPAGE) == 0;
+#else
+    return false;
+#endif
+}
+
+inline uint8_t *allocateLargeObjectPages(size_t size)
+{
+    auto result = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return result != MAP_FAILED ? reinterpret_cast<uint8_t*> (result) : nullptr;
+}
+
+inline void freeLargeObjectPages(uint8_t *pages, size_t size)
+{
+    munmap(pages, size);
+}
+
+uint8_t *allocateSpecialObjectPages(size_t size)
+{
+    // The preferred address is only a hint.
+    auto result = mmap((void*)PreferredSpecialObjectsAddress, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return result != MAP_FAILED ? reinterpret_cast<uint8_t*> (result) : nullptr;
+}
+
 inline size_t getPageSize()
 {
     auto pageSize = sysconf(_SC_PAGE_SIZE);
@@ -202,23 +415,29 @@ inline size_t getPageSize()
 
 
 VMHeap::VMHeap()
+    : addressSpace(nullptr), reservedCapacity(0)
 {
 }
 
 VMHeap::~VMHeap()
 {
+    if(addressSpace)
+        releaseVirtualAddressSpace(addressSpace, reservedCapacity);
 }
 
 void VMHeap::initialize()
 {
     // Get the page size.
     pageSize = getPageSize();
+    decommitGranularity = pageSize;
 
     // Allocate the virtual address space.
-    maxCapacity = DefaultMaxVMHeapSize;
+    reservedCapacity = DefaultMaxVMHeapSize;
+    maxCapacity = reservedCapacity;
     capacity = 0;
     size = 0;
-    addressSpace = reserveVirtualAddressSpace(maxCapacity);
+    mappedImageSize = 0;
+    addressSpace = reserveVirtualAddressSpace(reservedCapacity);
     if(!addressSpace)
     {
         fprintf(stderr, "Failed to reserve the VM heap memory address space.\n");
@@ -231,11 +450,39 @@ size_t VMHeap::getMaxCapacity()
     return maxCapacity;
 }
 
+void VMHeap::setMaxCapacity(size_t newMaxCapacity)
+{
+    // The heap cannot grow beyond its reserved address space.
+    maxCapacity = std::max(capacity, std::min(newMaxCapacity, reservedCapacity));
+}
+
 size_t VMHeap::getCapacity()
 {
     return capacity;
 }
 
+void VMHeap::enableHugePages()
+{
+    // Avoid splitting the huge pages when decommitting.
+    if(adviseHugePages(addressSpace, reservedCapacity))
+        decommitGranularity = std::max(pageSize, HugePageSize);
+}
+
+void VMHeap::shrinkCapacity(size_t minimumCapacity)
+{
+    auto newCapacity = (std::max(std::max(size, minimumCapacity), mappedImageSize) + decommitGranularity - 1) & (~ (decommitGranularity - 1));
+    if(newCapacity >= capacity)
+        return;
+
+    // Keep the excess committed when it is small, to avoid committing it again soon.
+    auto excess = capacity - newCapacity;
+    if(excess < std::max(newCapacity / HeapDecommitHysteresisDivisor, MinimumHeapDecommitSize))
+        return;
+
+    if(freeVirtualAddressRegion(addressSpace, newCapacity, capacity - newCapacity))
+        capacity = newCapacity;
+}
+
 size_t VMHeap::getSize()
 {
     return size;
@@ -253,7 +500,7 @@ uint8_t *VMHeap::getAddressSpace()
 
 uint8_t *VMHeap::getAddressSpaceEnd()
 {
-    return addressSpace + maxCapacity;
+    return addressSpace + reservedCapacity;
 }
 
 uint8_t *VMHeap::allocate(size_t objectSize)
@@ -270,6 +517,8 @@ uint8_t *VMHeap::allocate(size_t objectSize)
 
     // Compute the new capacity
     auto newCapacity = (newHeapSize + pageSize - 1) & (~ (pageSize - 1));
+    if(newCapacity > maxCapacity)
+        return nullptr;
     if(!allocateVirtualAddressRegion(addressSpace, capacity, newCapacity - capacity))
         return nullptr;
 
@@ -280,14 +529,170 @@ uint8_t *VMHeap::allocate(size_t objectSize)
     return result;
 }
 
+void VMHeap::setMappedImage(size_t usedSize, size_t mappedSize)
+{
+    assert(size == 0 && capacity == 0 && mappedSize <= maxCapacity);
+    size = usedSize;
+    capacity = mappedSize;
+    mappedImageSize = mappedSize;
+}
+
+// Heap sizing policy
+HeapSizingPolicy::HeapSizingPolicy()
+{
+    maxHeapSize = DefaultMaxVMHeapSize;
+    initialHeapSize = DefaultInitialHeapSize;
+    targetGCRatio = DefaultTargetGCRatio;
+    collectionThreshold = initialHeapSize;
+    liveSize = 0;
+    collectionTime = std::chrono::steady_clock::duration::zero();
+    cycleStartTime = std::chrono::steady_clock::now();
+}
+
+size_t HeapSizingPolicy::getMaxHeapSize()
+{
+    return maxHeapSize;
+}
+
+void HeapSizingPolicy::setMaxHeapSize(size_t newMaxHeapSize)
+{
+    maxHeapSize = newMaxHeapSize;
+    clampCollectionThreshold();
+}
+
+size_t HeapSizingPolicy::getInitialHeapSize()
+{
+    return initialHeapSize;
+}
+
+void HeapSizingPolicy::setInitialHeapSize(size_t newInitialHeapSize)
+{
+    initialHeapSize = newInitialHeapSize;
+    collectionThreshold = std::max(initialHeapSize, liveSize + liveSize / 2);
+    clampCollectionThreshold();
+}
+
+size_t HeapSizingPolicy::getTargetGCRatio()
+{
+    return targetGCRatio;
+}
+
+void HeapSizingPolicy::setTargetGCRatio(size_t percentage)
+{
+    targetGCRatio = std::max(size_t(1), std::min(percentage, size_t(100)));
+}
+
+size_t HeapSizingPolicy::getCollectionThreshold()
+{
+    return collectionThreshold;
+}
+
+size_t HeapSizingPolicy::getLiveSize()
+{
+    return liveSize;
+}
+
+void HeapSizingPolicy::addCollectionTime(std::chrono::steady_clock::duration time)
+{
+    collectionTime += time;
+}
+
+void HeapSizingPolicy::collectionCycleFinished(size_t newLiveSize)
+{
+    // Compute the fraction of the time spent in the GC during this cycle.
+    auto now = std::chrono::steady_clock::now();
+    auto cycleTime = now - cycleStartTime;
+    auto gcRatio = cycleTime.count() > 0 ? size_t(collectionTime.count()*100 / cycleTime.count()) : 0;
+
+    // Grow when collecting too often, and shrink when the GC is mostly idle.
+    if(gcRatio > targetGCRatio)
+        collectionThreshold += collectionThreshold / 2;
+    else if(gcRatio < targetGCRatio / 2)
+        collectionThreshold -= collectionThreshold / 5;
+
+    // Leave room for allocating at least half of the live size.
+    liveSize = newLiveSize;
+    collectionThreshold = std::max(collectionThreshold, liveSize + liveSize / 2);
+    collectionThreshold = std::max(collectionThreshold, initialHeapSize);
+    clampCollectionThreshold();
+
+    collectionTime = std::chrono::steady_clock::duration::zero();
+    cycleStartTime = now;
+}
+
+void HeapSizingPolicy::clampCollectionThreshold()
+{
+    collectionThreshold = std::min(collectionThreshold, maxHeapSize);
+}
+
+// GC statistics
+GCStatistics::GCStatistics()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+GCTotals::GCTotals()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+void GCTotals::add(const GCStatistics &collection)
+{
+    ++collectionCount;
+    if(collection.compacted)
+        ++compactionCount;
+    else
+        ++sweepCount;
+
+    pauseTime += collection.pauseTime;
+    maxPauseTime = std::max(maxPauseTime, collection.pauseTime);
+    markTime += collection.markTime;
+    forwardTime += collection.forwardTime;
+    updateTime += collection.updateTime;
+    moveTime += collection.moveTime;
+    sweepTime += collection.sweepTime;
+    incrementalMarkingTime += collection.incrementalMarkingTime;
+
+    auto sizeBefore = collection.heapSizeBefore + collection.largeObjectSpaceSizeBefore;
+    auto sizeAfter = collection.heapSizeAfter + collection.largeObjectSpaceSizeAfter;
+    if(sizeBefore > sizeAfter)
+        bytesReclaimed += sizeBefore - sizeAfter;
+    objectsMoved += collection.objectsMoved;
+    objectsFreed += collection.objectsFreed;
+}
+
 GarbageCollector::GarbageCollector(MemoryManager *memoryManager)
 	: memoryManager(memoryManager), firstReference(nullptr), lastReference(nullptr), disableCount(0)
 {
     garbageCollectionQueued = false;
+    explicitCollectionQueued = false;
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+    compactionBase = nullptr;
+    markedBytes = 0;
+    compactionThreshold = DefaultCompactionThreshold;
+    largeObjectPageSize = getPageSize();
+    largeObjectSpaceSize = 0;
+    markingLargeObjectCount = 0;
+    allocatedSinceCollection = 0;
+    pendingIncrementalMarkingTime = 0;
+    logFile = nullptr;
+    incrementalMarkingEnabled = false;
+    incrementalMarkingPauseBudget = DefaultIncrementalMarkingPauseBudget;
+    markingInProgress = false;
+    markingHeapTop = 0;
+    allocatedSinceMarkingStep = 0;
 }
 
 GarbageCollector::~GarbageCollector()
 {
+    for(auto largeObject : largeObjects)
+        freeLargeObjectPages(largeObject, largeObjectPagesSize(largeObject));
+
+    for(auto &threadArena : handleArenas)
+        delete threadArena.second;
+
+    if(logFile)
+        fclose(logFile);
 }
 
 void GarbageCollector::initialize()
@@ -306,26 +711,58 @@ void GarbageCollector::disable()
     ++disableCount;
 }
 
-uint8_t *GarbageCollector::allocateObjectMemory(size_t objectSize, bool bigObject)
+uint8_t *GarbageCollector::allocateObjectMemory(size_t objectSize, bool bigObject, bool pinned)
 {
     std::unique_lock<std::mutex> l(controlMutex);
 
     auto heap = memoryManager->getHeap();
 	assert(objectSize >= sizeof(ObjectHeader));
     // Should I enqueue a garbage collection?
-    if (!heap->hasCapacityThresholdBeenReached())
+    allocatedSinceCollection += objectSize;
+    if(markingInProgress)
+    {
+        // Pace the incremental marking with the allocation.
+        allocatedSinceMarkingStep += objectSize;
+        if(allocatedSinceMarkingStep >= IncrementalMarkingAllocationQuantum)
+            queueGarbageCollection();
+    }
+    else if(sizingPolicy.isCollectionNeeded(allocatedSinceCollection))
         queueGarbageCollection();
 
-    // Add a forwarding slot, used by compaction.
-    auto extraHeaderSize = 8;
-    if(bigObject)
-        extraHeaderSize += 8;
+    // Big objects have their own pages, and their slot count before the header.
+    // The large objects are never moved, so the pinned objects are also placed there.
+    if(bigObject || pinned)
+    {
+        auto result = allocateLargeObject(objectSize);
+        if(!result)
+        {
+            fprintf(stderr, "Failed to allocate the pages of a large object.\n");
+            abort();
+        }
+
+        return result;
+    }
+
+    auto allocationSize = objectSize;
+
+    // Reuse the free chunks. The objects allocated during the incremental
+    // marking must stay above the marking heap top.
+    uint8_t *result = nullptr;
+    if(!markingInProgress)
+        result = allocateFromFreeLists(allocationSize);
 
 	// Allocate from the VM heap.
-    auto result = memoryManager->getHeap()->allocate(objectSize + extraHeaderSize);
-    auto allocatedObjectHeader = reinterpret_cast<AllocatedObject*> (result);
-    allocatedObjectHeader->rawForwardingPointer = bigObject ? 1 : 0;
-    result += extraHeaderSize;
+    if(!result)
+    {
+        result = heap->allocate(allocationSize);
+        if(!result)
+        {
+            fprintf(stderr, "The VM heap is exhausted.\n");
+            abort();
+        }
+
+        recordAllocatedObject(result);
+    }
 
 	auto header = reinterpret_cast<ObjectHeader*> (result);
 	*header = {0};
@@ -333,6 +770,77 @@ uint8_t *GarbageCollector::allocateObjectMemory(size_t objectSize, bool bigObjec
 	return result;
 }
 
+uint8_t *GarbageCollector::allocateLargeObject(size_t objectSize)
+{
+    auto pagesSize = (objectSize + 8 + largeObjectPageSize - 1) & (~(largeObjectPageSize - 1));
+    auto pages = allocateLargeObjectPages(pagesSize);
+    if(!pages)
+        return nullptr;
+
+    largeObjects.push_back(pages);
+    largeObjectSpaceSize += pagesSize;
+    *reinterpret_cast<uint64_t*> (pages) = encodeBigObjectSlotCount((objectSize - sizeof(ObjectHeader)) / sizeof(void*));
+
+    auto header = reinterpret_cast<ObjectHeader*> (pages + 8);
+    *header = {0};
+    return pages + 8;
+}
+
+size_t GarbageCollector::largeObjectPagesSize(uint8_t *largeObject)
+{
+    auto size = reinterpret_cast<AllocatedObject*> (largeObject)->computeSize();
+    return (size + largeObjectPageSize - 1) & (~(largeObjectPageSize - 1));
+}
+
+ObjectHeader *GarbageCollector::largeObjectHeader(uint8_t *largeObject)
+{
+    return &reinterpret_cast<AllocatedObject*> (largeObject)->header();
+}
+
+void GarbageCollector::sweepLargeObjects()
+{
+    // Return the pages of the dead large objects to the system.
+    size_t destIndex = 0;
+    for(auto largeObject : largeObjects)
+    {
+        auto header = largeObjectHeader(largeObject);
+        if(header->gcColor == White)
+        {
+            auto pagesSize = largeObjectPagesSize(largeObject);
+            largeObjectSpaceSize -= pagesSize;
+            freeLargeObjectPages(largeObject, pagesSize);
+            continue;
+        }
+
+        header->gcColor = White;
+        largeObjects[destIndex++] = largeObject;
+    }
+
+    largeObjects.resize(destIndex);
+}
+
+uint8_t *GarbageCollector::allocateFromFreeLists(size_t size)
+{
+    auto chunk = freeLists.allocate(size / sizeof(uint64_t));
+    if(!chunk)
+        return nullptr;
+
+    // Return the remaining part of the chunk.
+    auto chunkSize = reinterpret_cast<AllocatedObject*> (chunk)->computeSize();
+    if(chunkSize > size)
+        freeLists.add(makeFreeChunk(chunk + size, chunkSize - size));
+
+    return chunk;
+}
+
+void GarbageCollector::recordAllocatedObject(uint8_t *allocatedObject)
+{
+    // Objects are bump allocated, so the first object of a region is the first one allocated after its start.
+    auto offset = size_t(allocatedObject - memoryManager->getHeap()->getAddressSpace());
+    while(regionFirstObjects.size()*CompactionRegionSize <= offset)
+        regionFirstObjects.push_back(allocatedObject);
+}
+
 void GarbageCollector::registerOopReference(OopRef *ref)
 {
 	std::unique_lock<std::mutex> l(controlMutex);
@@ -370,6 +878,15 @@ void GarbageCollector::unregisterOopReference(OopRef *ref)
 		lastReference = ref->prevReference_;
 }
 
+HandleArena *GarbageCollector::getThreadHandleArena()
+{
+	std::unique_lock<std::mutex> l(controlMutex);
+    auto &arena = handleArenas[std::this_thread::get_id()];
+    if(!arena)
+        arena = new HandleArena(memoryManager->getContext());
+    return arena;
+}
+
 void GarbageCollector::registerGCRoot(Oop *gcroot, size_t size)
 {
 	std::unique_lock<std::mutex> l(controlMutex);
@@ -400,11 +917,172 @@ bool GarbageCollector::collectionSafePoint()
         return false;
 
     //printf("GC time\n");
-    internalPerformCollection();
     garbageCollectionQueued = false;
+    if(explicitCollectionQueued)
+    {
+        explicitCollectionQueued = false;
+        performFullCollection();
+        return true;
+    }
+
+    if(incrementalMarkingEnabled)
+        return incrementalCollectionStep();
+
+    internalPerformCollection(GCC_Allocation);
     return true;
 }
 
+void GarbageCollector::setIncrementalMarking(bool enabled, size_t pauseBudgetMicroseconds)
+{
+    std::unique_lock<std::mutex> l(controlMutex);
+    incrementalMarkingEnabled = enabled;
+    incrementalMarkingPauseBudget = pauseBudgetMicroseconds;
+}
+
+void GarbageCollector::setCompactionThreshold(size_t percentage)
+{
+    std::unique_lock<std::mutex> l(controlMutex);
+    compactionThreshold = percentage;
+}
+
+bool GarbageCollector::getVMParameter(int index, int64_t &result)
+{
+    std::unique_lock<std::mutex> l(controlMutex);
+    auto heap = memoryManager->getHeap();
+    switch(index)
+    {
+    case VMP_MaxHeapSize: result = sizingPolicy.getMaxHeapSize(); return true;
+    case VMP_InitialHeapSize: result = sizingPolicy.getInitialHeapSize(); return true;
+    case VMP_TargetGCRatio: result = sizingPolicy.getTargetGCRatio(); return true;
+    case VMP_CompactionThreshold: result = compactionThreshold; return true;
+    case VMP_HeapSize: result = heap->getSize(); return true;
+    case VMP_HeapCapacity: result = heap->getCapacity(); return true;
+    case VMP_CollectionThreshold: result = sizingPolicy.getCollectionThreshold(); return true;
+    case VMP_LiveSize: result = sizingPolicy.getLiveSize(); return true;
+    default: return false;
+    }
+}
+
+bool GarbageCollector::setVMParameter(int index, int64_t value)
+{
+    if(value < 0)
+        return false;
+
+    std::unique_lock<std::mutex> l(controlMutex);
+    switch(index)
+    {
+    case VMP_MaxHeapSize:
+        memoryManager->getHeap()->setMaxCapacity(value);
+        sizingPolicy.setMaxHeapSize(memoryManager->getHeap()->getMaxCapacity());
+        return true;
+    case VMP_InitialHeapSize:
+        sizingPolicy.setInitialHeapSize(value);
+        return true;
+    case VMP_TargetGCRatio:
+        sizingPolicy.setTargetGCRatio(value);
+        return true;
+    case VMP_CompactionThreshold:
+        compactionThreshold = value;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool GarbageCollector::setLogFile(const std::string &fileName)
+{
+    std::unique_lock<std::mutex> l(controlMutex);
+    if(logFile)
+        fclose(logFile);
+
+    logFile = fopen(fileName.c_str(), "w");
+    return logFile != nullptr;
+}
+
+void GarbageCollector::getStatisticsCounters(std::vector<int64_t> &counters)
+{
+    std::unique_lock<std::mutex> l(controlMutex);
+
+    // The cumulative totals.
+    counters.push_back(totals.collectionCount);
+    counters.push_back(totals.compactionCount);
+    counters.push_back(totals.sweepCount);
+    counters.push_back(totals.pauseTime);
+    counters.push_back(totals.maxPauseTime);
+    counters.push_back(totals.markTime);
+    counters.push_back(totals.forwardTime);
+    counters.push_back(totals.updateTime);
+    counters.push_back(totals.moveTime);
+    counters.push_back(totals.sweepTime);
+    counters.push_back(totals.incrementalMarkingTime);
+    counters.push_back(totals.bytesReclaimed);
+    counters.push_back(totals.objectsMoved);
+    counters.push_back(totals.objectsFreed);
+
+    // The last collection.
+    counters.push_back(lastCollection.cause);
+    counters.push_back(lastCollection.pauseTime);
+    counters.push_back(lastCollection.markTime);
+    counters.push_back(lastCollection.forwardTime);
+    counters.push_back(lastCollection.updateTime);
+    counters.push_back(lastCollection.moveTime);
+    counters.push_back(lastCollection.sweepTime);
+    counters.push_back(lastCollection.heapSizeBefore);
+    counters.push_back(lastCollection.heapSizeAfter);
+    counters.push_back(lastCollection.objectsMoved);
+    counters.push_back(lastCollection.objectsFreed);
+    counters.push_back(lastCollection.stackRootCount);
+    counters.push_back(lastCollection.oopReferenceCount);
+    counters.push_back(lastCollection.symbolCount);
+    counters.push_back(lastCollection.handleCount);
+}
+
+void GarbageCollector::countRoots(GCStatistics &statistics)
+{
+    for(auto &rootSize : rootPointers)
+        statistics.globalRootCount += rootSize.second;
+
+    for(auto stack : currentStacks)
+    {
+        stack->stackFramesDo([&](StackFrame &stackFrame) {
+            stackFrame.oopElementsDo([&](Oop&) {
+                ++statistics.stackRootCount;
+            });
+        });
+    }
+
+    for(auto pos = firstReference; pos; pos = pos->nextReference_)
+        ++statistics.oopReferenceCount;
+
+    for(auto &threadArena : handleArenas)
+    {
+        threadArena.second->handlesDo([&](Oop&) {
+            ++statistics.handleCount;
+        });
+    }
+
+    statistics.symbolCount = memoryManager->getSymbolTable()->getSymbolCount();
+}
+
+void GarbageCollector::logCollection(const GCStatistics &statistics)
+{
+    static const char *causeNames[] = {"allocation", "incremental-marking", "explicit"};
+    fprintf(logFile, "gc %zu cause=%s kind=%s pause=%llu mark=%llu forward=%llu update=%llu move=%llu sweep=%llu incremental-mark=%llu "
+        "heap-before=%zu heap-after=%zu large-before=%zu large-after=%zu live=%zu moved=%zu freed=%zu weak-cleared=%zu ephemerons-cleared=%zu "
+        "stack-roots=%zu oop-refs=%zu handles=%zu symbols=%zu global-roots=%zu\n",
+        statistics.collectionIndex, causeNames[statistics.cause], statistics.compacted ? "compact" : "sweep",
+        (unsigned long long)statistics.pauseTime, (unsigned long long)statistics.markTime,
+        (unsigned long long)statistics.forwardTime, (unsigned long long)statistics.updateTime,
+        (unsigned long long)statistics.moveTime, (unsigned long long)statistics.sweepTime,
+        (unsigned long long)statistics.incrementalMarkingTime,
+        statistics.heapSizeBefore, statistics.heapSizeAfter,
+        statistics.largeObjectSpaceSizeBefore, statistics.largeObjectSpaceSizeAfter, statistics.liveSize,
+        statistics.objectsMoved, statistics.objectsFreed,
+        statistics.weakReferencesCleared, statistics.ephemeronsCleared,
+        statistics.stackRootCount, statistics.oopReferenceCount, statistics.handleCount, statistics.symbolCount, statistics.globalRootCount);
+    fflush(logFile);
+}
+
 void GarbageCollector::registerNativeObject(Oop object)
 {
     std::unique_lock<std::mutex> l(controlMutex);
@@ -414,10 +1092,28 @@ void GarbageCollector::registerNativeObject(Oop object)
 void GarbageCollector::performCollection()
 {
     std::unique_lock<std::mutex> l(controlMutex);
-    internalPerformCollection();
+    performFullCollection();
+}
+
+void GarbageCollector::performFullCollection()
+{
+    // The objects allocated during an incremental marking are kept alive
+    // by it, so finish that cycle before collecting the whole heap.
+    if(markingInProgress)
+        internalPerformCollection(GCC_IncrementalMarking);
+    internalPerformCollection(GCC_Explicit);
+}
+
+void GarbageCollector::queueExplicitCollection()
+{
+    // The collection is performed in the next safe point, where the
+    // interpreter expects the objects to move.
+    std::unique_lock<std::mutex> l(controlMutex);
+    explicitCollectionQueued = true;
+    garbageCollectionQueued = true;
 }
 
-void GarbageCollector::internalPerformCollection()
+void GarbageCollector::internalPerformCollection(GCCause cause)
 {
     if(disableCount > 0)
         return;
@@ -425,9 +1121,103 @@ void GarbageCollector::internalPerformCollection()
 	// Get the current stacks
 	currentStacks = memoryManager->getStackMemories()->getAll();
 
+    // Start recording the statistics.
+    auto heap = memoryManager->getHeap();
+    lastCollection = GCStatistics();
+    lastCollection.collectionIndex = totals.collectionCount + 1;
+    lastCollection.cause = cause;
+    lastCollection.heapSizeBefore = heap->getSize();
+    lastCollection.largeObjectSpaceSizeBefore = largeObjectSpaceSize;
+    lastCollection.incrementalMarkingTime = pendingIncrementalMarkingTime;
+    pendingIncrementalMarkingTime = 0;
+    countRoots(lastCollection);
+
 	// TODO: Suspend the other GC threads.
-	mark();
-	compact();
+    auto startTime = std::chrono::steady_clock::now();
+    if(markingInProgress)
+        finishIncrementalMarking();
+    else
+        mark();
+    lastCollection.markTime = elapsedMicroseconds(startTime);
+    reclaim();
+
+    // Record the statistics.
+    lastCollection.pauseTime = elapsedMicroseconds(startTime);
+    lastCollection.heapSizeAfter = heap->getSize();
+    lastCollection.largeObjectSpaceSizeAfter = largeObjectSpaceSize;
+    lastCollection.liveSize = markedBytes + largeObjectSpaceSize;
+    totals.add(lastCollection);
+    if(logFile)
+        logCollection(lastCollection);
+
+    // Adapt the heap size to the time spent in the GC.
+    sizingPolicy.addCollectionTime(std::chrono::steady_clock::now() - startTime);
+    sizingPolicy.collectionCycleFinished(markedBytes + largeObjectSpaceSize);
+    allocatedSinceCollection = 0;
+    memoryManager->getHeap()->shrinkCapacity(sizingPolicy.getCollectionThreshold());
+}
+
+bool GarbageCollector::incrementalCollectionStep()
+{
+    if(!markingInProgress)
+        startIncrementalMarking();
+
+    // Mark until the pause budget is consumed.
+    allocatedSinceMarkingStep = 0;
+    auto startTime = std::chrono::steady_clock::now();
+    auto finished = drainMarkStack(incrementalMarkingPauseBudget);
+    sizingPolicy.addCollectionTime(std::chrono::steady_clock::now() - startTime);
+    pendingIncrementalMarkingTime += elapsedMicroseconds(startTime);
+    if(!finished)
+        return false;
+
+    // The marking has finished. Reclaim the memory.
+    internalPerformCollection(GCC_IncrementalMarking);
+    return true;
+}
+
+void GarbageCollector::startIncrementalMarking()
+{
+    // Take the snapshot of the roots.
+	currentStacks = memoryManager->getStackMemories()->getAll();
+    markedBytes = 0;
+	onRootsDo([this](Oop root) {
+		markObject(root);
+	});
+
+    // The objects allocated from now are considered as alive.
+    markingHeapTop = memoryManager->getHeap()->getSize();
+    markingLargeObjectCount = largeObjects.size();
+    allocatedSinceMarkingStep = 0;
+    markingInProgress = true;
+}
+
+void GarbageCollector::finishIncrementalMarking()
+{
+    // Scan again the roots.
+	onRootsDo([this](Oop root) {
+		markObject(root);
+	});
+
+    // Scan the objects allocated during the marking. This catches the
+    // references stored in them by native code without a write barrier.
+    auto heap = memoryManager->getHeap();
+    auto live = heap->getAddressSpace() + markingHeapTop;
+    auto endAddress = heap->getAddressSpace() + heap->getSize();
+    while(live < endAddress)
+    {
+        auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
+        markObject(Oop::fromPointer(&liveHeader->header()));
+        live += liveHeader->computeSize();
+    }
+    assert(live == endAddress);
+
+    for(auto i = markingLargeObjectCount; i < largeObjects.size(); ++i)
+        markObject(Oop::fromPointer(largeObjectHeader(largeObjects[i])));
+
+    drainMarkStack(0);
+    processWeakObjects();
+    markingInProgress = false;
 }
 
 void GarbageCollector::queueGarbageCollection()
@@ -438,15 +1228,17 @@ void GarbageCollector::queueGarbageCollection()
 void GarbageCollector::mark()
 {
 	// Mark from the root objects.
+    markedBytes = 0;
 	onRootsDo([this](Oop root) {
 		markObject(root);
 	});
+
+    drainMarkStack(0);
+    processWeakObjects();
 }
 
 void GarbageCollector::markObject(Oop objectPointer)
 {
-	// TODO: Use the schorr-waite algorithm.
-
 	// mark pointer objects.
 	if(!objectPointer.isPointer())
 		return;
@@ -456,25 +1248,61 @@ void GarbageCollector::markObject(Oop objectPointer)
 	if(header->gcColor)
 		return;
 
-	// Mark gray
+	// Mark gray, and scan it later.
 	header->gcColor = Gray;
+    markStack.push_back(objectPointer);
+}
 
-	// Mark recursively the children
+bool GarbageCollector::drainMarkStack(size_t budgetMicroseconds)
+{
+    // A zero budget means draining the whole stack.
+    auto startTime = std::chrono::steady_clock::now();
+    size_t scannedCount = 0;
+    while(!markStack.empty())
+    {
+        auto object = markStack.back();
+        markStack.pop_back();
+        scanObject(object);
+
+        // Check the elapsed time from time to time.
+        if(budgetMicroseconds && (++scannedCount % 64) == 0)
+        {
+            auto elapsedTime = std::chrono::steady_clock::now() - startTime;
+            if(std::chrono::duration_cast<std::chrono::microseconds> (elapsedTime).count() >= (long long)budgetMicroseconds)
+                return markStack.empty();
+        }
+    }
+
+    return true;
+}
+
+void GarbageCollector::scanObject(Oop objectPointer)
+{
+	auto header = objectPointer.header;
+
+	// Mark the children
 	auto format = header->objectFormat;
 	if(format == OF_FIXED_SIZE ||
 	   format == OF_VARIABLE_SIZE_NO_IVARS ||
 	   format == OF_VARIABLE_SIZE_IVARS)
 	{
-		auto slotCount = header->slotCount;
-		auto headerSize = sizeof(ObjectHeader);
-		if(slotCount == 255)
-            slotCount = reinterpret_cast<uint64_t*> (header)[-1];
-
-		// Traverse the slots.
-		auto slots = reinterpret_cast<Oop*> (objectPointer.pointer + headerSize);
-		for(size_t i = 0; i < slotCount; ++i)
-			markObject(slots[i]);
+		markSlots(objectPointer, 0, objectPointer.getSlotCount());
 	}
+    else if(format == OF_WEAK_VARIABLE_SIZE)
+    {
+        // Only the fixed instance variables are strong. The indexable slots are cleared after the marking.
+        auto fixedSlotCount = objectPointer.getFixedSlotCount(memoryManager->getContext());
+        markSlots(objectPointer, 0, std::min(fixedSlotCount, objectPointer.getSlotCount()));
+        weakObjects.push_back(objectPointer);
+    }
+    else if(format == OF_EPHEMERON)
+    {
+        // An ephemeron is only traced when its key is reached from other objects.
+        if(isEphemeronKeyMarked(objectPointer))
+            markSlots(objectPointer, 0, objectPointer.getSlotCount());
+        else
+            pendingEphemerons.push_back(objectPointer);
+    }
 
 	// Special handilng of compiled method literals
 	if(format >= OF_COMPILED_METHOD)
@@ -488,70 +1316,337 @@ void GarbageCollector::markObject(Oop objectPointer)
 
 	// Mark as black before ending.
 	header->gcColor = Black;
+    if(memoryManager->getHeap()->containsPointer(objectPointer.pointer))
+        markedBytes += sizeof(ObjectHeader) + objectPointer.getSlotCount()*sizeof(void*) + (header->slotCount == 255 ? 8 : 0);
 }
 
-void GarbageCollector::compact()
+void GarbageCollector::markSlots(Oop objectPointer, size_t firstSlot, size_t endSlot)
 {
-    auto heap = memoryManager->getHeap();
-    auto lowestAddress = heap->getAddressSpace();
-    auto endAddress = lowestAddress + heap->getSize();
+    auto slots = reinterpret_cast<Oop*> (objectPointer.pointer + sizeof(ObjectHeader));
+    for(size_t i = firstSlot; i < endSlot; ++i)
+        markObject(slots[i]);
+}
 
-    //--------------------------------------------------------------------------
-    // First Pass
-    // Compute the forwarding locations.
-    auto freeAddress = lowestAddress;
-    auto live = lowestAddress;
-    uint64_t freeCount = 0;
-    while(live < endAddress)
+bool GarbageCollector::isEphemeronKeyMarked(Oop ephemeron)
+{
+    // The key is the first instance variable.
+    if(!ephemeron.getSlotCount())
+        return true;
+
+    auto key = reinterpret_cast<Oop*> (ephemeron.pointer + sizeof(ObjectHeader))[0];
+    return !key.isPointer() || key.header->gcColor != White;
+}
+
+void GarbageCollector::processWeakObjects()
+{
+    // Trace the ephemerons whose keys have been reached, until no more keys are reached.
+    bool keyReached = true;
+    while(keyReached)
     {
-        auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
-        auto liveSize = liveHeader->computeSize();
+        keyReached = false;
+        size_t pendingCount = 0;
+        for(size_t i = 0; i < pendingEphemerons.size(); ++i)
+        {
+            auto ephemeron = pendingEphemerons[i];
+            if(isEphemeronKeyMarked(ephemeron))
+            {
+                markSlots(ephemeron, 0, ephemeron.getSlotCount());
+                keyReached = true;
+            }
+            else
+            {
+                pendingEphemerons[pendingCount++] = ephemeron;
+            }
+        }
 
-        // Is this object not condemned?
-        if(liveHeader->header().gcColor != White)
+        pendingEphemerons.resize(pendingCount);
+        drainMarkStack(0);
+    }
+
+    // The keys of the remaining ephemerons are only reachable from ephemerons.
+    // Clearing the whole ephemeron also drops the value.
+    for(auto ephemeron : pendingEphemerons)
+    {
+        auto slots = reinterpret_cast<Oop*> (ephemeron.pointer + sizeof(ObjectHeader));
+        auto slotCount = ephemeron.getSlotCount();
+        for(size_t i = 0; i < slotCount; ++i)
+            slots[i] = Oop();
+    }
+    lastCollection.ephemeronsCleared = pendingEphemerons.size();
+    pendingEphemerons.clear();
+
+    // Clear the weak references to the objects that are going to be freed.
+    // The unused symbols are removed from the symbol table without breaking its probe sequences.
+    size_t clearedCount = memoryManager->getSymbolTable()->removeSymbolsIf([](Oop symbol) {
+        return symbol.isPointer() && symbol.header->gcColor == White;
+    });
+    for(auto weakObject : weakObjects)
+    {
+        auto slots = reinterpret_cast<Oop*> (weakObject.pointer + sizeof(ObjectHeader));
+        auto slotCount = weakObject.getSlotCount();
+        auto fixedSlotCount = weakObject.getFixedSlotCount(memoryManager->getContext());
+        for(size_t i = fixedSlotCount; i < slotCount; ++i)
         {
-            liveHeader->setForwardingPointer(freeAddress + sizeof(void*));
-            freeAddress += liveSize;
+            if(slots[i].isPointer() && slots[i].header->gcColor == White)
+            {
+                slots[i] = Oop();
+                ++clearedCount;
+            }
         }
-        else
+    }
+    lastCollection.weakReferencesCleared = clearedCount;
+    weakObjects.clear();
+}
+
+// A compaction region
+struct CompactionRegion
+{
+    uint8_t *start;
+    uint8_t *end;
+    uint8_t *destination;
+    size_t liveSize;
+    size_t freeCount;
+    size_t freedObjectCount;
+    size_t movedObjectCount;
+    std::atomic<bool> moved;
+
+    template<typename FT>
+    void objectsDo(const FT &f)
+    {
+        auto live = start;
+        while(live < end)
         {
-            //printf("Free %s\n", memoryManager->getContext()->getClassNameOfObject(Oop::fromPointer(&liveHeader->header)).c_str());
-            liveHeader->setForwardingPointer(nullptr);
-            ++freeCount;
+            auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
+            auto liveSize = liveHeader->computeSize();
+            f(liveHeader, liveSize);
+            live += liveSize;
         }
+        assert(live == end);
+    }
+};
 
-        // Process the next object.
-        live += liveSize;
+template<typename FT>
+void GarbageCollector::parallelRegionsDo(size_t regionCount, const FT &f)
+{
+    // The regions are claimed in ascending order by the persistent workers and the current thread.
+    memoryManager->getWorkerPool()->parallelFor(regionCount, threadCount, f);
+}
+
+void GarbageCollector::reclaim()
+{
+    // Only compact the heap when it is fragmented enough.
+    auto heapSize = memoryManager->getHeap()->getSize();
+    auto deadBytes = heapSize > markedBytes ? heapSize - markedBytes : 0;
+    lastCollection.compacted = deadBytes*100 >= heapSize*compactionThreshold;
+    if(lastCollection.compacted)
+        compact();
+    else
+        sweep();
+
+    // The large objects are never moved.
+    auto startTime = std::chrono::steady_clock::now();
+    sweepLargeObjects();
+    lastCollection.sweepTime += elapsedMicroseconds(startTime);
+}
+
+void GarbageCollector::sweep()
+{
+    auto heap = memoryManager->getHeap();
+    auto endAddress = heap->getAddressSpace() + heap->getSize();
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Turn the runs of dead objects into free chunks. A run does not cross
+    // a region boundary, so the first object of each region stays valid.
+    auto regionCount = regionFirstObjects.size();
+    std::vector<FreeChunkLists> regionFreeLists(regionCount);
+    std::vector<size_t> regionFreedCounts(regionCount);
+    parallelRegionsDo(regionCount, [&](size_t regionIndex) {
+        auto &regionLists = regionFreeLists[regionIndex];
+        auto &freedCount = regionFreedCounts[regionIndex];
+        auto live = regionFirstObjects[regionIndex];
+        auto regionEnd = regionIndex + 1 < regionCount ? regionFirstObjects[regionIndex + 1] : endAddress;
+        uint8_t *freeStart = nullptr;
+        while(live < regionEnd)
+        {
+            auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
+            auto liveSize = liveHeader->computeSize();
+            if(liveHeader->header().gcColor != White)
+            {
+                // Clear the color of the object for the next garbage collection.
+                liveHeader->header().gcColor = White;
+                if(freeStart)
+                {
+                    regionLists.add(makeFreeChunk(freeStart, live - freeStart));
+                    freeStart = nullptr;
+                }
+            }
+            else
+            {
+                if(!freeStart)
+                    freeStart = live;
+                if(!liveHeader->header().isFreeChunk)
+                    ++freedCount;
+            }
+
+            live += liveSize;
+        }
+        assert(live == regionEnd);
+
+        if(freeStart)
+            regionLists.add(makeFreeChunk(freeStart, regionEnd - freeStart));
+    });
+
+    // Collect the free chunks in address order.
+    freeLists.clear();
+    for(auto &regionLists : regionFreeLists)
+        freeLists.append(regionLists);
+    for(auto freedCount : regionFreedCounts)
+        lastCollection.objectsFreed += freedCount;
+
+    // Set the white color of the native objects.
+    for(auto &nativeObject : nativeObjects)
+        nativeObject.header->gcColor = White;
+
+    lastCollection.sweepTime = elapsedMicroseconds(startTime);
+}
+
+void GarbageCollector::compact()
+{
+    auto heap = memoryManager->getHeap();
+    auto lowestAddress = heap->getAddressSpace();
+    auto endAddress = lowestAddress + heap->getSize();
+
+    // Partition the heap in regions.
+    auto regionCount = regionFirstObjects.size();
+    std::vector<CompactionRegion> regions(regionCount);
+    for(size_t i = 0; i < regionCount; ++i)
+    {
+        auto &region = regions[i];
+        region.start = regionFirstObjects[i];
+        region.end = i + 1 < regionCount ? regionFirstObjects[i + 1] : endAddress;
+        region.liveSize = 0;
+        region.freeCount = 0;
+        region.freedObjectCount = 0;
+        region.movedObjectCount = 0;
+        region.moved = false;
     }
 
-    assert(freeAddress <= live);
-    assert(live == endAddress);
+    // The free chunks are removed by the compaction.
+    auto startTime = std::chrono::steady_clock::now();
+    freeLists.clear();
+
+    // Create the side tables used for forwarding.
+    auto blockCount = (heap->getSize() + CompactionBlockSize - 1) / CompactionBlockSize;
+    compactionBase = lowestAddress;
+    {
+        std::vector<std::atomic<uint64_t>> newLiveWordBitmap(blockCount);
+        liveWordBitmap.swap(newLiveWordBitmap);
+    }
+    blockDestinations.resize(blockCount);
+
+    //--------------------------------------------------------------------------
+    // First Pass
+    // Record the words of the live objects.
+    parallelRegionsDo(regionCount, [&](size_t regionIndex) {
+        auto &region = regions[regionIndex];
+        region.objectsDo([&](AllocatedObject *liveHeader, size_t liveSize) {
+            // Is this object not condemned?
+            if(liveHeader->header().gcColor != White)
+            {
+                auto firstWord = size_t(reinterpret_cast<uint8_t*> (liveHeader) - lowestAddress) / sizeof(uint64_t);
+                setLiveWords(firstWord, firstWord + liveSize / sizeof(uint64_t));
+                region.liveSize += liveSize;
+            }
+            else
+            {
+                ++region.freeCount;
+                if(!liveHeader->header().isFreeChunk)
+                    ++region.freedObjectCount;
+            }
+        });
+    });
+
+    size_t freeCount = 0;
+    for(auto &region : regions)
+        freeCount += region.freeCount;
 
     // Are we freeing objects.
     if(!freeCount)
     {
         // Abort the compaction.
+        releaseCompactionTables();
         abortCompaction();
         return;
     }
 
-    //--------------------------------------------------------------------------
-    // Second Pass
-    // Update the object pointers.
-    live = lowestAddress;
-    while(live < endAddress)
+    // The destination of each block is the prefix sum of the live words.
+    // Compute it in two levels, with chunks of the size of a compaction region.
+    const size_t blocksPerChunk = CompactionRegionSize / CompactionBlockSize;
+    auto chunkCount = (blockCount + blocksPerChunk - 1) / blocksPerChunk;
+    std::vector<size_t> chunkLiveWords(chunkCount);
+    parallelRegionsDo(chunkCount, [&](size_t chunkIndex) {
+        size_t liveWords = 0;
+        auto lastBlock = std::min(blockCount, (chunkIndex + 1)*blocksPerChunk);
+        for(auto i = chunkIndex*blocksPerChunk; i < lastBlock; ++i)
+            liveWords += populationCount(liveWordBitmap[i].load(std::memory_order_relaxed));
+        chunkLiveWords[chunkIndex] = liveWords;
+    });
+
+    std::vector<uint8_t*> chunkDestinations(chunkCount);
+    auto freeAddress = lowestAddress;
+    for(size_t i = 0; i < chunkCount; ++i)
     {
-        auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
-        auto liveSize = liveHeader->computeSize();
+        chunkDestinations[i] = freeAddress;
+        freeAddress += chunkLiveWords[i]*sizeof(uint64_t);
+    }
 
-        // Is this object not condemned?
-        if(liveHeader->header().gcColor != White)
-            updatePointersOf(Oop::fromPointer(&liveHeader->header()));
+    assert(freeAddress <= endAddress);
 
-        // Process the next object.
-        live += liveSize;
-    }
-    assert(live == endAddress);
+    parallelRegionsDo(chunkCount, [&](size_t chunkIndex) {
+        auto destination = chunkDestinations[chunkIndex];
+        auto lastBlock = std::min(blockCount, (chunkIndex + 1)*blocksPerChunk);
+        for(auto i = chunkIndex*blocksPerChunk; i < lastBlock; ++i)
+        {
+            blockDestinations[i] = destination;
+            destination += populationCount(liveWordBitmap[i].load(std::memory_order_relaxed))*sizeof(uint64_t);
+        }
+    });
+
+    // The destination of a region is the destination of its first live object.
+    for(auto &region : regions)
+        region.destination = forwardingAddressOf(region.start);
+    lastCollection.forwardTime = elapsedMicroseconds(startTime);
+    startTime = std::chrono::steady_clock::now();
+
+    //--------------------------------------------------------------------------
+    // Second Pass
+    // Update the object pointers, and compute the regions of the compacted heap.
+    auto newSize = size_t(freeAddress - lowestAddress);
+    std::vector<uint8_t*> newRegionFirstObjects((newSize + CompactionRegionSize - 1) / CompactionRegionSize);
+    if(!newRegionFirstObjects.empty())
+        newRegionFirstObjects[0] = lowestAddress;
+
+    parallelRegionsDo(regionCount, [&](size_t regionIndex) {
+        auto &region = regions[regionIndex];
+        auto destination = region.destination;
+        region.objectsDo([&](AllocatedObject *liveHeader, size_t liveSize) {
+            // Is this object not condemned?
+            if(liveHeader->header().gcColor != White)
+            {
+                updatePointersOf(Oop::fromPointer(&liveHeader->header()));
+
+                // The next object is the first one of the regions starting inside of this one.
+                auto objectStart = size_t(destination - lowestAddress);
+                auto objectEnd = objectStart + liveSize;
+                for(auto i = objectStart / CompactionRegionSize + 1; i <= objectEnd / CompactionRegionSize && i < newRegionFirstObjects.size(); ++i)
+                    newRegionFirstObjects[i] = destination + liveSize;
+
+                destination += liveSize;
+            }
+        });
+
+        assert(destination == region.destination + region.liveSize);
+    });
 
     // Update the root pointers.
     onRootsDo([&](Oop &pointer) {
@@ -562,61 +1657,124 @@ void GarbageCollector::compact()
     for(auto &nativeObject : nativeObjects)
         updatePointersOf(nativeObject);
 
+    // Update the pointers of the live large objects.
+    parallelRegionsDo(largeObjects.size(), [&](size_t largeObjectIndex) {
+        auto header = largeObjectHeader(largeObjects[largeObjectIndex]);
+        if(header->gcColor != White)
+            updatePointersOf(Oop::fromPointer(header));
+    });
+
+    lastCollection.updateTime = elapsedMicroseconds(startTime);
+    startTime = std::chrono::steady_clock::now();
+
     //--------------------------------------------------------------------------
     // Third Pass
     // Move the objects
-    live = lowestAddress;
-    while(live < endAddress)
-    {
-        auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
-        auto liveSize = liveHeader->computeSize();
+    parallelRegionsDo(regionCount, [&](size_t regionIndex) {
+        auto &region = regions[regionIndex];
 
-        // Is this object not condemned?
-        if(liveHeader->header().gcColor != White)
+        // Wait for the previous regions that are overwritten by this one.
+        for(auto i = regionIndex; i > 0 && regions[i - 1].end > region.destination; --i)
         {
-            // Clear the color of the object for the next garbage collection.
-            liveHeader->header().gcColor = White;
-
-            // Move the object.
-            auto destination = liveHeader->getForwardingDestination();
-            //printf("Move %p %p\n", destination, liveHeader);
-            memmove(destination, liveHeader, liveSize);
-
+            while(!regions[i - 1].moved.load(std::memory_order_acquire))
+                std::this_thread::yield();
         }
 
-        // Process the next object.
-        live += liveSize;
-    }
-    assert(live == endAddress);
+        auto destination = region.destination;
+        region.objectsDo([&](AllocatedObject *liveHeader, size_t liveSize) {
+            // Is this object not condemned?
+            if(liveHeader->header().gcColor != White)
+            {
+                // Clear the color of the object for the next garbage collection.
+                liveHeader->header().gcColor = White;
+
+                // Move the object.
+                if(destination != reinterpret_cast<uint8_t*> (liveHeader))
+                {
+                    memmove(destination, liveHeader, liveSize);
+                    ++region.movedObjectCount;
+                }
+                destination += liveSize;
+            }
+        });
+
+        region.moved.store(true, std::memory_order_release);
+    });
 
     // Set the white color of the native objects.
     for(auto &nativeObject : nativeObjects)
         nativeObject.header->gcColor = White;
 
     // Set the new heap size.
-    heap->setSize(freeAddress - lowestAddress);
-    //printf("Compaction ended\n");
+    heap->setSize(newSize);
+    regionFirstObjects.swap(newRegionFirstObjects);
+    releaseCompactionTables();
+
+    for(auto &region : regions)
+    {
+        lastCollection.objectsFreed += region.freedObjectCount;
+        lastCollection.objectsMoved += region.movedObjectCount;
+    }
+    lastCollection.moveTime = elapsedMicroseconds(startTime);
 }
 
-void GarbageCollector::abortCompaction()
+void GarbageCollector::setLiveWords(size_t firstWord, size_t endWord)
 {
-    auto heap = memoryManager->getHeap();
-    auto lowestAddress = heap->getAddressSpace();
-    auto endAddress = lowestAddress + heap->getSize();
-
-    auto live = lowestAddress;
-    while(live < endAddress)
+    // Objects may share their first or last bitmap word with an object of another region.
+    while(firstWord < endWord)
     {
-        auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
-        auto liveSize = liveHeader->computeSize();
+        auto bitIndex = firstWord % 64;
+        auto bitCount = std::min(64 - bitIndex, endWord - firstWord);
+        auto mask = bitCount == 64 ? ~uint64_t(0) : ((uint64_t(1) << bitCount) - 1) << bitIndex;
+        liveWordBitmap[firstWord / 64].fetch_or(mask, std::memory_order_relaxed);
+        firstWord += bitCount;
+    }
+}
 
-        // Set the color to white.
-        liveHeader->header().gcColor = White;
+uint8_t *GarbageCollector::forwardingAddressOf(uint8_t *address)
+{
+    // The new address is the block destination plus the live words that precede it in the block.
+    auto wordIndex = size_t(address - compactionBase) / sizeof(uint64_t);
+    auto blockIndex = wordIndex / 64;
 
-        // Process the next object.
-        live += liveSize;
+    // The end of the heap, such as the start of a region after the last object, is forwarded to the end of the compacted heap.
+    if(blockIndex >= blockDestinations.size())
+    {
+        auto lastBlock = blockDestinations.size() - 1;
+        return blockDestinations[lastBlock] + populationCount(liveWordBitmap[lastBlock].load(std::memory_order_relaxed))*sizeof(uint64_t);
     }
-    assert(live == endAddress);
+
+    auto precedingWordsMask = (uint64_t(1) << (wordIndex % 64)) - 1;
+    auto precedingWords = populationCount(liveWordBitmap[blockIndex].load(std::memory_order_relaxed) & precedingWordsMask);
+    return blockDestinations[blockIndex] + precedingWords*sizeof(uint64_t);
+}
+
+void GarbageCollector::releaseCompactionTables()
+{
+    std::vector<std::atomic<uint64_t>> emptyLiveWordBitmap;
+    liveWordBitmap.swap(emptyLiveWordBitmap);
+    std::vector<uint8_t*> emptyBlockDestinations;
+    blockDestinations.swap(emptyBlockDestinations);
+}
+
+void GarbageCollector::abortCompaction()
+{
+    auto heap = memoryManager->getHeap();
+    auto endAddress = heap->getAddressSpace() + heap->getSize();
+
+    // Set the color to white.
+    auto regionCount = regionFirstObjects.size();
+    parallelRegionsDo(regionCount, [&](size_t regionIndex) {
+        auto live = regionFirstObjects[regionIndex];
+        auto regionEnd = regionIndex + 1 < regionCount ? regionFirstObjects[regionIndex + 1] : endAddress;
+        while(live < regionEnd)
+        {
+            auto liveHeader = reinterpret_cast<AllocatedObject*> (live);
+            liveHeader->header().gcColor = White;
+            live += liveHeader->computeSize();
+        }
+        assert(live == regionEnd);
+    });
 
     // Set the white color of the native objects.
     for(auto &nativeObject : nativeObjects)
@@ -641,9 +1799,8 @@ void GarbageCollector::updatePointer(Oop *pointer)
     if(!heap->containsPointer(pointer->pointer))
         return;
 
-    // Use the forwarding pointer.
-    uint8_t **forwardingPointer = reinterpret_cast<uint8_t**> (pointer->pointer - sizeof(uint8_t*));
-    pointer->pointer = *forwardingPointer;
+    // Use the forwarding side table.
+    pointer->pointer = forwardingAddressOf(pointer->pointer);
 }
 
 void GarbageCollector::updatePointersOf(Oop object)
@@ -657,12 +1814,12 @@ void GarbageCollector::updatePointersOf(Oop object)
 	   format == OF_VARIABLE_SIZE_NO_IVARS ||
 	   format == OF_VARIABLE_SIZE_IVARS ||
        format == OF_WEAK_VARIABLE_SIZE ||
-       format == OF_WEAK_FIXED_SIZE )
+       format == OF_EPHEMERON )
 	{
 		auto slotCount = header->slotCount;
 		auto headerSize = sizeof(ObjectHeader);
 		if(slotCount == 255)
-            slotCount = reinterpret_cast<uint64_t*> (header)[-1];
+            slotCount = decodeBigObjectSlotCount(reinterpret_cast<uint64_t*> (header)[-1]);
 
 		// Traverse the slots.
 		auto slots = reinterpret_cast<Oop*> (object.pointer + headerSize);
@@ -693,6 +1850,53 @@ void OopRef::unregisterSelf()
 	context_->getMemoryManager()->getGarbageCollector()->unregisterOopReference(this);
 }
 
+// HandleArena
+HandleArena::HandleArena(VMContext *context)
+    : context(context), chunkCount(0), top(nullptr), limit(nullptr)
+{
+}
+
+HandleArena::~HandleArena()
+{
+    for(auto chunk : chunks)
+        delete [] chunk;
+}
+
+void HandleArena::addChunk()
+{
+    // The chunks released by the scopes are reused.
+    if(chunkCount == chunks.size())
+        chunks.push_back(new Oop[HandleArenaChunkSize]);
+
+    top = chunks[chunkCount++];
+    limit = top + HandleArenaChunkSize;
+}
+
+static thread_local HandleArena *currentHandleArena = nullptr;
+
+void GarbageCollector::releaseThreadHandleArena()
+{
+    std::unique_lock<std::mutex> l(controlMutex);
+    auto it = handleArenas.find(std::this_thread::get_id());
+    if(it == handleArenas.end())
+        return;
+
+    if(currentHandleArena == it->second)
+        currentHandleArena = nullptr;
+    delete it->second;
+    handleArenas.erase(it);
+}
+
+HandleArena *getHandleArena(VMContext *context)
+{
+    if(currentHandleArena && currentHandleArena->getContext() == context)
+        return currentHandleArena;
+
+    // The arena of the thread is only looked up when the thread changes of context.
+    currentHandleArena = context->getMemoryManager()->getGarbageCollector()->getThreadHandleArena();
+    return currentHandleArena;
+}
+
 /**
  * Memory manager
  */
@@ -705,10 +1909,20 @@ MemoryManager::MemoryManager(VMContext *context)
     classTable = new ClassTable();
     stackMemories = new StackMemories();
     garbageCollector = new GarbageCollector(this);
+    allocationProfiler = new AllocationProfiler(context);
+    symbolTable = new SymbolTable(this);
+    workerPool = new WorkerPool(context);
 }
 
 MemoryManager::~MemoryManager()
 {
+    delete workerPool;
+    delete symbolTable;
+    delete allocationProfiler;
+    delete garbageCollector;
+    delete stackMemories;
+    delete classTable;
+    delete heap;
 }
 
 VMContext *MemoryManager::getContext()
@@ -736,9 +1950,19 @@ StackMemories *MemoryManager::getStackMemories()
     return stackMemories;
 }
 
-MemoryManager::SymbolDictionary &MemoryManager::getSymbolDictionary()
+WorkerPool *MemoryManager::getWorkerPool()
+{
+    return workerPool;
+}
+
+AllocationProfiler *MemoryManager::getAllocationProfiler()
+{
+    return allocationProfiler;
+}
+
+SymbolTable *MemoryManager::getSymbolTable()
 {
-    return symbolDictionary;
+    return symbolTable;
 }
 
 }
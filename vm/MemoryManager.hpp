@@ -2,14 +2,20 @@
 #define LODTALK_MEMORY_MANAGER_HPP
 
 #include <list>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <utility>
 #include <mutex>
+#include <stdio.h>
 #include <unordered_map>
 
 #include "Lodtalk/ObjectModel.hpp"
 #include "Constants.hpp"
 #include "StackMemory.hpp"
+#include "SymbolTable.hpp"
 #include "Lodtalk/Synchronization.hpp"
 
 namespace Lodtalk
@@ -20,16 +26,142 @@ static constexpr size_t DefaultMaxVMHeapSize = size_t(16)*1024*1024*1024; // 16
 static constexpr size_t DefaultMaxVMHeapSize = size_t(512)*1024*1024; // 512 MB
 #endif
 
+// The heap is reserved at this address when it is free, so the heap pointers
+// of an image that is mapped by another process do not have to be relocated.
+#ifdef OBJECT_MODEL_SPUR_64
+static constexpr uintptr_t PreferredVMHeapAddress = uintptr_t(0x200000000000);
+#else
+static constexpr uintptr_t PreferredVMHeapAddress = 0;
+#endif
+
+// The special objects nil, true and false are placed below the heap for the same reason.
+static constexpr uintptr_t PreferredSpecialObjectsAddress = PreferredVMHeapAddress ? PreferredVMHeapAddress - 64*1024 : 0;
+
+// Allocates the pages of the special objects, which are never released.
+uint8_t *allocateSpecialObjectPages(size_t size);
+
+// Heap sizing policy defaults.
+static constexpr size_t DefaultInitialHeapSize = 16*1024*1024; // 16 MB
+static constexpr size_t DefaultTargetGCRatio = 5; // Percentage of the time spent in the GC
+
+// The committed memory above the heap target is only released when it exceeds
+// both the minimum size and a fraction of the target.
+static constexpr size_t MinimumHeapDecommitSize = 1024*1024; // 1 MB
+static constexpr size_t HeapDecommitHysteresisDivisor = 4;
+static constexpr size_t HugePageSize = 2*1024*1024; // 2 MB
+
+// The heap is partitioned in regions of this size for the parallel compaction.
+static constexpr size_t CompactionRegionSize = 256*1024; // 256 KB
+
+// The forwarding side table has one live word bitmap and one destination per block.
+static constexpr size_t CompactionBlockSize = 64*sizeof(uint64_t); // 512 bytes
+
+// Free chunks smaller than this number of words are kept in exact size lists.
+static constexpr size_t FreeListSizeClassCount = 64;
+
+// The heap is compacted instead of swept when this percentage of it is not alive.
+static constexpr size_t DefaultCompactionThreshold = 30;
+
+// Incremental marking parameters.
+static constexpr size_t DefaultIncrementalMarkingPauseBudget = 1000; // 1 ms
+static constexpr size_t IncrementalMarkingAllocationQuantum = 256*1024; // 256 KB
+
+// The parameters of the VM that can be accessed from Smalltalk.
+enum VMParameterIndex
+{
+    VMP_MaxHeapSize = 1,
+    VMP_InitialHeapSize,
+    VMP_TargetGCRatio,
+    VMP_CompactionThreshold,
+    VMP_HeapSize,
+    VMP_HeapCapacity,
+    VMP_CollectionThreshold,
+    VMP_LiveSize,
+};
+
+// The reason of a garbage collection.
+enum GCCause
+{
+    GCC_Allocation = 0,
+    GCC_IncrementalMarking,
+    GCC_Explicit,
+};
+
+/**
+ * The statistics of a single garbage collection. The times are in microseconds.
+ */
+struct GCStatistics
+{
+    GCStatistics();
+
+    size_t collectionIndex;
+    GCCause cause;
+    bool compacted;
+
+    uint64_t pauseTime;
+    uint64_t markTime;
+    uint64_t forwardTime;
+    uint64_t updateTime;
+    uint64_t moveTime;
+    uint64_t sweepTime;
+    uint64_t incrementalMarkingTime;
+
+    size_t heapSizeBefore;
+    size_t heapSizeAfter;
+    size_t largeObjectSpaceSizeBefore;
+    size_t largeObjectSpaceSizeAfter;
+    size_t liveSize;
+    size_t objectsMoved;
+    size_t objectsFreed;
+    size_t weakReferencesCleared;
+    size_t ephemeronsCleared;
+
+    size_t stackRootCount;
+    size_t oopReferenceCount;
+    size_t handleCount;
+    size_t symbolCount;
+    size_t globalRootCount;
+};
+
+/**
+ * The cumulative statistics of the garbage collector.
+ */
+struct GCTotals
+{
+    GCTotals();
+
+    void add(const GCStatistics &collection);
+
+    size_t collectionCount;
+    size_t compactionCount;
+    size_t sweepCount;
+
+    uint64_t pauseTime;
+    uint64_t maxPauseTime;
+    uint64_t markTime;
+    uint64_t forwardTime;
+    uint64_t updateTime;
+    uint64_t moveTime;
+    uint64_t sweepTime;
+    uint64_t incrementalMarkingTime;
+
+    size_t bytesReclaimed;
+    size_t objectsMoved;
+    size_t objectsFreed;
+};
+
 class VMHeap;
 class ClassTable;
 class GarbageCollector;
 class StackMemories;
+class AllocationProfiler;
+class SymbolTable;
+class ImageSnapshot;
+class WorkerPool;
 
 class MemoryManager
 {
 public:
-    typedef std::unordered_map<std::string, Oop> SymbolDictionary;
-
     MemoryManager(VMContext *context);
     ~MemoryManager();
 
@@ -38,7 +170,9 @@ public:
     ClassTable *getClassTable();
     GarbageCollector *getGarbageCollector();
     StackMemories *getStackMemories();
-    SymbolDictionary &getSymbolDictionary();
+    SymbolTable *getSymbolTable();
+    AllocationProfiler *getAllocationProfiler();
+    WorkerPool *getWorkerPool();
 
 private:
     VMContext *context;
@@ -46,7 +180,9 @@ private:
     ClassTable *classTable;
     GarbageCollector *garbageCollector;
     StackMemories *stackMemories;
-    SymbolDictionary symbolDictionary;
+    AllocationProfiler *allocationProfiler;
+    SymbolTable *symbolTable;
+    WorkerPool *workerPool;
 };
 
 
@@ -65,6 +201,11 @@ public:
     void addSpecialClass(ClassDescription *description, size_t index);
     void setClassAtIndex(ClassDescription *description, size_t index);
 
+    size_t getSize();
+
+    // Replaces the content of the table with the classes of an image.
+    void restore(const std::vector<Oop> &classes);
+
 private:
     void allocatePage();
 
@@ -89,7 +230,10 @@ public:
     void initialize();
 
     size_t getMaxCapacity();
+    void setMaxCapacity(size_t newMaxCapacity);
     size_t getCapacity();
+    void shrinkCapacity(size_t minimumCapacity);
+    void enableHugePages();
     size_t getSize();
     void setSize(size_t newSize);
 
@@ -98,6 +242,9 @@ public:
 
     uint8_t *allocate(size_t size);
 
+    // Accounts the pages of an image that were mapped at the start of the address space.
+    void setMappedImage(size_t usedSize, size_t mappedSize);
+
     inline bool containsPointer(uint8_t *pointer)
     {
         return getAddressSpace() <= pointer && pointer < getAddressSpaceEnd();
@@ -108,18 +255,75 @@ public:
         return size + newSize <= capacity;
     }
 
-    inline bool hasCapacityThresholdBeenReached()
-    {
-        return size > capacity * 4 / 5;
-    }
-
 private:
 
     uint8_t *addressSpace;
+    size_t reservedCapacity;
     size_t maxCapacity;
     size_t capacity;
     size_t size;
     size_t pageSize;
+    size_t decommitGranularity;
+
+    // The pages mapped from an image are relocated lazily, so they are never decommitted.
+    size_t mappedImageSize;
+};
+
+/**
+ * The heap sizing policy. It adapts the amount of memory that is used before
+ * triggering a collection, so that the time spent in the GC stays near its target.
+ */
+class HeapSizingPolicy
+{
+public:
+    HeapSizingPolicy();
+
+    size_t getMaxHeapSize();
+    void setMaxHeapSize(size_t newMaxHeapSize);
+    size_t getInitialHeapSize();
+    void setInitialHeapSize(size_t newInitialHeapSize);
+    size_t getTargetGCRatio();
+    void setTargetGCRatio(size_t percentage);
+
+    size_t getCollectionThreshold();
+    size_t getLiveSize();
+
+    inline bool isCollectionNeeded(size_t allocatedSize)
+    {
+        return liveSize + allocatedSize >= collectionThreshold;
+    }
+
+    void addCollectionTime(std::chrono::steady_clock::duration time);
+    void collectionCycleFinished(size_t newLiveSize);
+
+private:
+    void clampCollectionThreshold();
+
+    size_t maxHeapSize;
+    size_t initialHeapSize;
+    size_t targetGCRatio;
+    size_t collectionThreshold;
+    size_t liveSize;
+    std::chrono::steady_clock::duration collectionTime;
+    std::chrono::steady_clock::time_point cycleStartTime;
+};
+
+/**
+ * Segregated lists of the free chunks left by the sweeping. The first list
+ * contains the chunks that are too big for an exact size list.
+ */
+struct FreeChunkLists
+{
+    FreeChunkLists();
+
+    void clear();
+    void add(uint8_t *chunk);
+    void append(FreeChunkLists &other);
+    uint8_t *allocate(size_t wordCount);
+
+    uint8_t *heads[FreeListSizeClassCount];
+    uint8_t *tails[FreeListSizeClassCount];
+    uint64_t nonEmptyMask;
 };
 
 /**
@@ -140,13 +344,19 @@ public:
 
     void initialize();
 
-	uint8_t *allocateObjectMemory(size_t objectSize, bool bigObject);
+	uint8_t *allocateObjectMemory(size_t objectSize, bool bigObject, bool pinned = false);
 
 	void performCollection();
+    void queueExplicitCollection();
 
 	void registerOopReference(OopRef *ref);
 	void unregisterOopReference(OopRef *ref);
 
+    HandleArena *getThreadHandleArena();
+
+    // Releases the handle arena of a thread that is going to finish.
+    void releaseThreadHandleArena();
+
 	void registerGCRoot(Oop *gcroot, size_t size);
 	void unregisterGCRoot(Oop *gcroot);
 
@@ -159,9 +369,54 @@ public:
     void enable();
     void disable();
 
+    void setIncrementalMarking(bool enabled, size_t pauseBudgetMicroseconds = DefaultIncrementalMarkingPauseBudget);
+    void setCompactionThreshold(size_t percentage);
+
+    bool getVMParameter(int index, int64_t &result);
+    bool setVMParameter(int index, int64_t value);
+
+    bool setLogFile(const std::string &fileName);
+
+    bool isMarkingInProgress() const
+    {
+        return markingInProgress;
+    }
+
+    // The cumulative totals, followed by the statistics of the last collection.
+    void getStatisticsCounters(std::vector<int64_t> &counters);
+
+    // Snapshot at the beginning write barrier. It receives the value that is going to be overwritten.
+    // The stored value is also shaded, because it could have been read from a weak slot. It
+    // can be omitted when it is an object allocated after the start of the marking.
+    inline void writeBarrier(Oop oldValue, Oop newValue = Oop())
+    {
+        if(!markingInProgress)
+            return;
+
+        if(oldValue.isPointer() && oldValue.header->gcColor == White)
+            markObject(oldValue);
+        if(newValue.isPointer() && newValue.header->gcColor == White)
+            markObject(newValue);
+    }
+
 private:
-    void internalPerformCollection();
+    void internalPerformCollection(GCCause cause);
+    void performFullCollection();
     void queueGarbageCollection();
+    void countRoots(GCStatistics &statistics);
+    void logCollection(const GCStatistics &statistics);
+    bool incrementalCollectionStep();
+    void startIncrementalMarking();
+    void finishIncrementalMarking();
+    void recordAllocatedObject(uint8_t *allocatedObject);
+    uint8_t *allocateFromFreeLists(size_t size);
+    uint8_t *allocateLargeObject(size_t objectSize);
+    size_t largeObjectPagesSize(uint8_t *largeObject);
+    ObjectHeader *largeObjectHeader(uint8_t *largeObject);
+    void sweepLargeObjects();
+
+    template<typename FT>
+    void parallelRegionsDo(size_t regionCount, const FT &f);
 
 	template<typename FT>
 	void onRootsDo(const FT &f)
@@ -198,21 +453,32 @@ private:
 			f(pos->oop);
 		}
 
-        // Traverse the symbol dictionary.
-        {
-            auto &symbolDict = memoryManager->getSymbolDictionary();
-            auto it = symbolDict.begin();
-            for(; it != symbolDict.end(); ++it)
-                f(it->second);
-        }
+        // Traverse the handles
+        for(auto &threadArena : handleArenas)
+            threadArena.second->handlesDo(f);
+
+        // Traverse the symbol table. Its symbols are weak references.
+        f(memoryManager->getSymbolTable()->getTableOop());
 	}
 
 	void mark();
 	void markObject(Oop objectPointer);
+    void scanObject(Oop objectPointer);
+    void markSlots(Oop objectPointer, size_t firstSlot, size_t endSlot);
+    bool isEphemeronKeyMarked(Oop ephemeron);
+    void processWeakObjects();
+    bool drainMarkStack(size_t budgetMicroseconds);
     void updatePointer(Oop *pointer);
     void updatePointersOf(Oop object);
+    void reclaim();
+    void sweep();
 	void compact();
     void abortCompaction();
+    void setLiveWords(size_t firstWord, size_t endWord);
+    uint8_t *forwardingAddressOf(uint8_t *address);
+    void releaseCompactionTables();
+
+    friend class ImageSnapshot;
 
     MemoryManager *memoryManager;
 	std::mutex controlMutex;
@@ -221,8 +487,54 @@ private:
 	std::vector<StackMemory*> currentStacks;
 	OopRef *firstReference;
 	OopRef *lastReference;
+    std::map<std::thread::id, HandleArena*> handleArenas;
     int disableCount;
     volatile bool garbageCollectionQueued;
+    volatile bool explicitCollectionQueued;
+
+    // The first object allocated at or after the start of each compaction region.
+    std::vector<uint8_t*> regionFirstObjects;
+    size_t threadCount;
+
+    // The forwarding side tables, which are only alive during the compaction.
+    uint8_t *compactionBase;
+    std::vector<std::atomic<uint64_t>> liveWordBitmap;
+    std::vector<uint8_t*> blockDestinations;
+
+    // The gray objects that are pending to be scanned.
+    std::vector<Oop> markStack;
+    size_t markedBytes;
+
+    // The weak objects found by the marking. The ephemerons wait there until their key is marked.
+    std::vector<Oop> weakObjects;
+    std::vector<Oop> pendingEphemerons;
+
+    // The free chunks of the swept heap.
+    FreeChunkLists freeLists;
+    size_t compactionThreshold;
+
+    // The large object space. Each big or pinned object has its own pages, and it is never moved.
+    std::vector<uint8_t*> largeObjects;
+    size_t largeObjectPageSize;
+    size_t largeObjectSpaceSize;
+    size_t markingLargeObjectCount;
+
+    // The statistics.
+    GCStatistics lastCollection;
+    GCTotals totals;
+    uint64_t pendingIncrementalMarkingTime;
+    FILE *logFile;
+
+    // The heap sizing.
+    HeapSizingPolicy sizingPolicy;
+    size_t allocatedSinceCollection;
+
+    // Incremental marking state.
+    bool incrementalMarkingEnabled;
+    size_t incrementalMarkingPauseBudget;
+    bool markingInProgress;
+    size_t markingHeapTop;
+    size_t allocatedSinceMarkingStep;
 };
 
 } // End of namespace Lodtalk
@@ -3,6 +3,8 @@
 #include "Method.hpp"
 #include "StackInterpreter.hpp"
 #include "BytecodeSets.hpp"
+#include "MemoryManager.hpp"
+#include "AllocationProfiler.hpp"
 
 namespace Lodtalk
 {
@@ -51,7 +53,7 @@ CompiledMethod *CompiledMethod::newMethodWithHeader(VMContext *context, size_t n
 	objectHeader->objectFormat = (unsigned int)(OF_COMPILED_METHOD + extraFormatBits);
 	objectHeader->classIndex = SCI_CompiledMethod;
 	if(bigObject)
-        reinterpret_cast<uint64_t*> (objectHeader)[-1] = slotCount;
+        reinterpret_cast<uint64_t*> (objectHeader)[-1] = encodeBigObjectSlotCount(slotCount);
 
 	// Initialize the literals to nil
 	auto methodBody = reinterpret_cast<Oop*> (methodData + headerSize);
@@ -63,6 +65,9 @@ CompiledMethod *CompiledMethod::newMethodWithHeader(VMContext *context, size_t n
 	auto methodHeader = reinterpret_cast<CompiledMethodHeader*> (methodBody);
 	*methodHeader = header;
 
+    // Sample the allocation.
+    context->getMemoryManager()->getAllocationProfiler()->objectAllocated(objectSize, SCI_CompiledMethod);
+
 	// Return the compiled method.
 	return reinterpret_cast<CompiledMethod*> (methodData);
 }
@@ -131,7 +136,9 @@ int CompiledMethod::stObjectAtPut(InterpreterProxy *interpreter)
     if (index < 1 || index > (SmallIntegerValue)self->getLiteralCount() + 1)
         return interpreter->primitiveFailed();
 
-    reinterpret_cast<Oop*> (self->getFirstFieldPointer())[index - 1] = valueOop;
+    auto &slot = reinterpret_cast<Oop*> (self->getFirstFieldPointer())[index - 1];
+    interpreter->getContext()->writeBarrier(slot, valueOop);
+    slot = valueOop;
     return interpreter->returnOop(valueOop);
 }
 
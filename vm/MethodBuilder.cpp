@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
 #include "Lodtalk/VMContext.hpp"
 #include "MethodBuilder.hpp"
 #include "BytecodeSets.hpp"
+#include "SymbolTable.hpp"
 
 namespace Lodtalk
 {
@@ -58,6 +63,38 @@ public:
 		return isReturn;
 	}
 
+	virtual bool isPopStackTop() const
+	{
+		return bytecode == BytecodeSet::PopStackTop;
+	}
+
+	virtual bool isDuplicateStackTop() const
+	{
+		return bytecode == BytecodeSet::DuplicateStackTop;
+	}
+
+	virtual bool isPushWithoutSideEffects() const
+	{
+		switch(bytecode)
+		{
+		case BytecodeSet::PushReceiver:
+		case BytecodeSet::PushTrue:
+		case BytecodeSet::PushFalse:
+		case BytecodeSet::PushNil:
+		case BytecodeSet::PushZero:
+		case BytecodeSet::PushOne:
+		case BytecodeSet::DuplicateStackTop:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	virtual InstructionNode *copy(Arena &arena) const
+	{
+		return arena.make<SingleBytecodeInstruction> (bytecode, isReturn);
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
 		*buffer++ = (uint8_t)bytecode;
@@ -82,6 +119,11 @@ public:
 	PushReceiverVariable(int index, bool longInstruction)
 		: index(index), longInstruction(longInstruction) {}
 
+	virtual bool isPushWithoutSideEffects() const
+	{
+		return true;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
 		if(!longInstruction && index < BytecodeSet::PushReceiverVariableShortRangeSize)
@@ -117,6 +159,8 @@ public:
 	StoreReceiverVariable(int index, bool longInstruction)
 		: index(index), longInstruction(longInstruction) {}
 
+	virtual InstructionNode *makePopStore(Arena &arena) const;
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         buffer = encodeExtA(buffer, index / 256);
@@ -143,6 +187,11 @@ public:
 	PushLiteral(int index)
 		: index(index) {}
 
+	virtual bool isPushWithoutSideEffects() const
+	{
+		return true;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
 		if(index < BytecodeSet::PushLiteralShortRangeSize)
@@ -176,6 +225,11 @@ public:
 	PushLiteralVariable(int index)
 		: index(index) {}
 
+	virtual bool isPushWithoutSideEffects() const
+	{
+		return true;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
 		if(index < BytecodeSet::PushLiteralVariableShortRangeSize)
@@ -209,6 +263,8 @@ public:
 	StoreLiteralVariable(int index)
 		: index(index) {}
 
+	virtual InstructionNode *makePopStore(Arena &arena) const;
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         buffer = encodeExtA(buffer, index / 256);
@@ -227,6 +283,69 @@ private:
 	int index;
 };
 
+// PopStoreReceiverVariable
+class PopStoreReceiverVariable: public InstructionNode
+{
+public:
+	PopStoreReceiverVariable(int index, bool longInstruction)
+		: index(index), longInstruction(longInstruction) {}
+
+	virtual InstructionNode *makeStore(Arena &arena) const;
+
+	virtual uint8_t *encode(uint8_t *buffer)
+	{
+		if(!longInstruction && index < BytecodeSet::PopStoreReceiverVariableShortRangeSize)
+		{
+			*buffer++ = uint8_t(BytecodeSet::PopStoreReceiverVariableShortFirst + index);
+			return buffer;
+		}
+
+        buffer = encodeExtA(buffer, index / 256);
+        *buffer++ = BytecodeSet::PopStoreReceiverVariable;
+        *buffer++ = index % 256;
+        return buffer;
+	}
+
+protected:
+	virtual size_t computeMaxSize()
+	{
+		if(!longInstruction && index < BytecodeSet::PopStoreReceiverVariableShortRangeSize)
+			return 1;
+        return 2 + sizeofExtA(index / 256);
+	}
+
+private:
+	int index;
+    bool longInstruction;
+};
+
+// PopStoreLiteralVariable
+class PopStoreLiteralVariable: public InstructionNode
+{
+public:
+	PopStoreLiteralVariable(int index)
+		: index(index) {}
+
+	virtual InstructionNode *makeStore(Arena &arena) const;
+
+	virtual uint8_t *encode(uint8_t *buffer)
+	{
+        buffer = encodeExtA(buffer, index / 256);
+        *buffer++ = BytecodeSet::PopStoreLiteralVariable;
+        *buffer++ = index % 256;
+        return buffer;
+	}
+
+protected:
+	virtual size_t computeMaxSize()
+	{
+        return 2 + sizeofExtA(index / 256);
+	}
+
+private:
+	int index;
+};
+
 // Push temporal
 class PushTemporal: public InstructionNode
 {
@@ -234,6 +353,11 @@ public:
 	PushTemporal(int index)
 		: index(index) {}
 
+	virtual bool isPushWithoutSideEffects() const
+	{
+		return true;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
 		if(index < 12)
@@ -264,6 +388,8 @@ public:
 	StoreTemporal(int index)
 		: index(index) {}
 
+	virtual InstructionNode *makePopStore(Arena &arena) const;
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         *buffer++ = BytecodeSet::StoreTemporalVariable;
@@ -288,6 +414,8 @@ public:
 	PopStoreTemporal(int index)
 		: index(index) {}
 
+	virtual InstructionNode *makeStore(Arena &arena) const;
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         if(index < BytecodeSet::PopStoreTemporalVariableShortRangeSize)
@@ -344,6 +472,11 @@ public:
 	PushTemporalInVector(int index, int vectorIndex)
 		: index(index), vectorIndex(vectorIndex) {}
 
+	virtual bool isPushWithoutSideEffects() const
+	{
+		return true;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         *buffer++ = BytecodeSet::PushTemporaryInVector;
@@ -370,6 +503,8 @@ public:
 	StoreTemporalInVector(int index, int vectorIndex)
 		: index(index), vectorIndex(vectorIndex) {}
 
+	virtual InstructionNode *makePopStore(Arena &arena) const;
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         *buffer++ = BytecodeSet::StoreTemporalInVector;
@@ -396,6 +531,8 @@ public:
 	PopStoreTemporalInVector(int index, int vectorIndex)
 		: index(index), vectorIndex(vectorIndex) {}
 
+	virtual InstructionNode *makeStore(Arena &arena) const;
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         *buffer++ = BytecodeSet::PopStoreTemporalInVector;
@@ -446,6 +583,11 @@ public:
     PushClosure(int numCopied, int numArgs, Label *blockEnd, int numExtensions)
         : numCopied(numCopied), numArgs(numArgs), blockEnd(blockEnd), numExtensions(numExtensions) {}
 
+    virtual Label *getReferencedLabel() const
+    {
+        return blockEnd;
+    }
+
         virtual uint8_t *encode(uint8_t *buffer)
     	{
             buffer = encodeExtA(buffer, extendAValue());
@@ -610,6 +752,26 @@ public:
 	UnconditionalJump(Label *destination)
 		: destination(destination) {}
 
+	virtual bool isUnconditionalJump() const
+	{
+		return true;
+	}
+
+	virtual Label *getReferencedLabel() const
+	{
+		return destination;
+	}
+
+	virtual Label *getJumpDestination() const
+	{
+		return destination;
+	}
+
+	virtual void setJumpDestination(Label *newDestination)
+	{
+		destination = newDestination;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         auto delta = jumpDeltaValue();
@@ -665,6 +827,21 @@ public:
 	ConditionalJump(Label *destination, bool condition)
 		: destination(destination), condition(condition) {}
 
+	virtual Label *getReferencedLabel() const
+	{
+		return destination;
+	}
+
+	virtual Label *getJumpDestination() const
+	{
+		return destination;
+	}
+
+	virtual void setJumpDestination(Label *newDestination)
+	{
+		destination = newDestination;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
         auto delta = jumpDeltaValue();
@@ -717,6 +894,47 @@ private:
     bool condition;
 };
 
+// Store and pop store conversions
+InstructionNode *StoreReceiverVariable::makePopStore(Arena &arena) const
+{
+	return arena.make<PopStoreReceiverVariable> (index, longInstruction);
+}
+
+InstructionNode *PopStoreReceiverVariable::makeStore(Arena &arena) const
+{
+	return arena.make<StoreReceiverVariable> (index, longInstruction);
+}
+
+InstructionNode *StoreLiteralVariable::makePopStore(Arena &arena) const
+{
+	return arena.make<PopStoreLiteralVariable> (index);
+}
+
+InstructionNode *PopStoreLiteralVariable::makeStore(Arena &arena) const
+{
+	return arena.make<StoreLiteralVariable> (index);
+}
+
+InstructionNode *StoreTemporal::makePopStore(Arena &arena) const
+{
+	return arena.make<PopStoreTemporal> (index);
+}
+
+InstructionNode *PopStoreTemporal::makeStore(Arena &arena) const
+{
+	return arena.make<StoreTemporal> (index);
+}
+
+InstructionNode *StoreTemporalInVector::makePopStore(Arena &arena) const
+{
+	return arena.make<PopStoreTemporalInVector> (index, vectorIndex);
+}
+
+InstructionNode *PopStoreTemporalInVector::makeStore(Arena &arena) const
+{
+	return arena.make<StoreTemporalInVector> (index, vectorIndex);
+}
+
 // The assembler
 Assembler::Assembler(VMContext *context)
     : context(context)
@@ -739,19 +957,86 @@ InstructionNode *Assembler::addInstruction(InstructionNode *instruction)
     return instruction;
 }
 
-size_t Assembler::addLiteral(Oop newLiteral)
+// The literal strings and boxed numbers are compared by value. The other literals are compared by identity.
+static bool isLiteralComparedByValue(Oop literal)
+{
+	if(!literal.isPointer())
+		return false;
+
+	auto classIndex = classIndexOf(literal);
+	return classIndex == SCI_ByteString || classIndex == SCI_BoxedFloat;
+}
+
+static size_t literalByteSizeOf(Oop literal)
+{
+	return literal.getNumberOfElements() * variableSlotSizeFor((ObjectFormat)literal.header->objectFormat);
+}
+
+static uint32_t literalHashOf(Oop literal)
+{
+	if(isLiteralComparedByValue(literal))
+		return SymbolTable::hashOf(reinterpret_cast<const char*> (literal.getFirstFieldPointer()), literalByteSizeOf(literal));
+	return uint32_t(identityHashOf(literal));
+}
+
+static bool literalEquals(Oop a, Oop b)
 {
-	for (size_t i = 0; i < literals.size(); ++i)
+	if(a == b)
+		return true;
+	if(!isLiteralComparedByValue(a) || !isLiteralComparedByValue(b) || classIndexOf(a) != classIndexOf(b))
+		return false;
+
+	auto size = literalByteSizeOf(a);
+	return size == literalByteSizeOf(b) && !memcmp(a.getFirstFieldPointer(), b.getFirstFieldPointer(), size);
+}
+
+size_t Assembler::findLiteral(Oop literal, uint32_t hash)
+{
+	// The small literal frames are scanned.
+	if(literals.size() < LiteralIndexThreshold)
 	{
-		if(literals[i] == newLiteral)
-			return i;
+		for (size_t i = 0; i < literals.size(); ++i)
+		{
+			if(literalEquals(literals[i].oop, literal))
+				return i;
+		}
+		return literals.size();
 	}
 
+	// Index the literals when there are many of them.
+	if(literalIndices.empty())
+	{
+		for (size_t i = 0; i < literals.size(); ++i)
+			literalIndices.insert(std::make_pair(literalHashOf(literals[i].oop), i));
+	}
+
+	auto range = literalIndices.equal_range(hash);
+	for(auto it = range.first; it != range.second; ++it)
+	{
+		if(literalEquals(literals[it->second].oop, literal))
+			return it->second;
+	}
+	return literals.size();
+}
+
+size_t Assembler::appendLiteral(Oop literal, uint32_t hash)
+{
 	auto ret = literals.size();
-	literals.push_back(newLiteral);
+	literals.push_back(literal);
+	if(!literalIndices.empty())
+		literalIndices.insert(std::make_pair(hash, ret));
 	return ret;
 }
 
+size_t Assembler::addLiteral(Oop newLiteral)
+{
+	auto hash = literalHashOf(newLiteral);
+	auto index = findLiteral(newLiteral, hash);
+	if(index < literals.size())
+		return index;
+	return appendLiteral(newLiteral, hash);
+}
+
 size_t Assembler::addLiteral(const OopRef &newLiteral)
 {
 	return addLiteral(newLiteral.oop);
@@ -759,9 +1044,7 @@ size_t Assembler::addLiteral(const OopRef &newLiteral)
 
 size_t Assembler::addLiteralAlways(Oop newLiteral)
 {
-    auto ret = literals.size();
-	literals.push_back(newLiteral);
-	return ret;
+    return appendLiteral(newLiteral, literalHashOf(newLiteral));
 }
 
 size_t Assembler::addLiteralAlways(const OopRef &newLiteral)
@@ -771,7 +1054,7 @@ size_t Assembler::addLiteralAlways(const OopRef &newLiteral)
 
 Label *Assembler::makeLabel()
 {
-	return new Label();
+	return arena.make<Label> ();
 }
 
 Label *Assembler::makeLabelHere()
@@ -786,6 +1069,174 @@ void Assembler::putLabel(Label *label)
 	instructionStream.push_back(label);
 }
 
+void Assembler::optimizeInstructions()
+{
+	// Apply the peephole optimizations until nothing changes.
+	bool changed;
+	do
+	{
+		changed = threadJumps();
+		changed = removeDeadCode() || changed;
+		changed = combineInstructions() || changed;
+	} while(changed);
+}
+
+bool Assembler::threadJumps()
+{
+	bool changed = false;
+	std::unordered_map<InstructionNode*, size_t> labelIndices;
+	for(size_t i = 0; i < instructionStream.size(); ++i)
+	{
+		if(instructionStream[i]->isLabel())
+			labelIndices[instructionStream[i]] = i;
+	}
+
+	// The first instruction that is executed after a label.
+	auto instructionAt = [&](Label *label) -> InstructionNode* {
+		auto it = labelIndices.find(label);
+		if(it == labelIndices.end())
+			return nullptr;
+		for(auto i = it->second; i < instructionStream.size(); ++i)
+		{
+			auto instruction = instructionStream[i];
+			if(instruction && !instruction->isLabel())
+				return instruction;
+		}
+		return nullptr;
+	};
+
+	for(size_t i = 0; i < instructionStream.size(); ++i)
+	{
+		auto instruction = instructionStream[i];
+		auto destination = instruction->getJumpDestination();
+		if(!destination)
+			continue;
+
+		// Jump directly to the end of a chain of jumps. A cycle is left as it is.
+		std::unordered_set<Label*> visited;
+		auto finalDestination = destination;
+		for(;;)
+		{
+			auto target = instructionAt(finalDestination);
+			if(!target || !target->isUnconditionalJump())
+				break;
+			if(!visited.insert(finalDestination).second)
+			{
+				finalDestination = destination;
+				break;
+			}
+			finalDestination = target->getJumpDestination();
+		}
+
+		if(finalDestination != destination)
+		{
+			instruction->setJumpDestination(finalDestination);
+			destination = finalDestination;
+			changed = true;
+		}
+
+		// A jump to the next instruction does nothing, but a conditional jump still pops the condition.
+		auto nextIndex = i + 1;
+		while(nextIndex < instructionStream.size() && instructionStream[nextIndex]->isLabel() && instructionStream[nextIndex] != destination)
+			++nextIndex;
+		if(nextIndex < instructionStream.size() && instructionStream[nextIndex] == destination)
+		{
+			instructionStream[i] = instruction->isUnconditionalJump() ? nullptr : arena.make<SingleBytecodeInstruction> (BytecodeSet::PopStackTop);
+			changed = true;
+			continue;
+		}
+
+		// Return directly instead of jumping to a return.
+		auto target = instructionAt(destination);
+		if(instruction->isUnconditionalJump() && target && target->isReturnInstruction())
+		{
+			auto returnInstruction = target->copy(arena);
+			if(returnInstruction)
+			{
+				instructionStream[i] = returnInstruction;
+				changed = true;
+			}
+		}
+	}
+
+	// Remove the jumps that were dropped.
+	if(changed)
+		instructionStream.erase(std::remove(instructionStream.begin(), instructionStream.end(), nullptr), instructionStream.end());
+	return changed;
+}
+
+bool Assembler::removeDeadCode()
+{
+	// Find the labels that are still used.
+	std::unordered_set<InstructionNode*> referencedLabels;
+	for(auto instruction : instructionStream)
+	{
+		auto label = instruction->getReferencedLabel();
+		if(label)
+			referencedLabels.insert(label);
+	}
+
+	// The instructions after a return or a jump can only be reached through a label.
+	size_t destIndex = 0;
+	bool reachable = true;
+	for(auto instruction : instructionStream)
+	{
+		if(instruction->isLabel())
+		{
+			if(!referencedLabels.count(instruction))
+				continue;
+			reachable = true;
+		}
+		else if(!reachable)
+		{
+			continue;
+		}
+
+		instructionStream[destIndex++] = instruction;
+		if(instruction->isReturnInstruction() || instruction->isUnconditionalJump())
+			reachable = false;
+	}
+
+	auto changed = destIndex != instructionStream.size();
+	instructionStream.resize(destIndex);
+	return changed;
+}
+
+bool Assembler::combineInstructions()
+{
+	size_t destIndex = 0;
+	for(auto instruction : instructionStream)
+	{
+		if(destIndex > 0)
+		{
+			auto &previous = instructionStream[destIndex - 1];
+
+			// A value that is pushed and popped is not needed.
+			if(instruction->isPopStackTop() && previous->isPushWithoutSideEffects())
+			{
+				--destIndex;
+				continue;
+			}
+
+			// Fuse a store followed by a pop, and a duplicate followed by a pop and store.
+			auto fused = instruction->isPopStackTop() ? previous->makePopStore(arena) : nullptr;
+			if(!fused && previous->isDuplicateStackTop())
+				fused = instruction->makeStore(arena);
+			if(fused)
+			{
+				previous = fused;
+				continue;
+			}
+		}
+
+		instructionStream[destIndex++] = instruction;
+	}
+
+	auto changed = destIndex != instructionStream.size();
+	instructionStream.resize(destIndex);
+	return changed;
+}
+
 size_t Assembler::computeInstructionsSize()
 {
 	// Compute the max size.
@@ -815,6 +1266,7 @@ size_t Assembler::computeInstructionsSize()
 CompiledMethod *Assembler::generate(size_t temporalCount, size_t argumentCount, bool hasPrimitive, size_t extraSize)
 {
 	// Compute the method sizes.
+	optimizeInstructions();
 	auto instructionsSize = computeInstructionsSize();
 	auto literalCount = literals.size();
 	auto methodSize = literalCount*sizeof(void*) + instructionsSize + extraSize;
@@ -867,47 +1319,47 @@ bool Assembler::isLastReturn()
 
 InstructionNode *Assembler::returnReceiver()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::ReturnReceiver, true));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::ReturnReceiver, true));
 }
 
 InstructionNode *Assembler::returnTrue()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::ReturnTrue, true));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::ReturnTrue, true));
 }
 
 InstructionNode *Assembler::returnFalse()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::ReturnFalse, true));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::ReturnFalse, true));
 }
 
 InstructionNode *Assembler::returnNil()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::ReturnNil, true));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::ReturnNil, true));
 }
 
 InstructionNode *Assembler::returnTop()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::ReturnTop, true));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::ReturnTop, true));
 }
 
 InstructionNode *Assembler::blockReturnNil()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::BlockReturnNil, true));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::BlockReturnNil, true));
 }
 
 InstructionNode *Assembler::blockReturnTop()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::BlockReturnTop, true));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::BlockReturnTop, true));
 }
 
 InstructionNode *Assembler::popStackTop()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PopStackTop));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PopStackTop));
 }
 
 InstructionNode *Assembler::duplicateStackTop()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::DuplicateStackTop));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::DuplicateStackTop));
 }
 
 InstructionNode *Assembler::pushLiteral(Oop literal)
@@ -933,52 +1385,52 @@ InstructionNode *Assembler::pushLiteralVariable(Oop literalVariable)
 
 InstructionNode *Assembler::pushReceiverVariableIndex(int variableIndex)
 {
-	return addInstruction(new PushReceiverVariable(variableIndex, usingLongInstanceVariableAccessors));
+	return addInstruction(arena.make<PushReceiverVariable> (variableIndex, usingLongInstanceVariableAccessors));
 }
 
 InstructionNode *Assembler::pushLiteralIndex(int literalIndex)
 {
-	return addInstruction(new PushLiteral(literalIndex));
+	return addInstruction(arena.make<PushLiteral> (literalIndex));
 }
 
 InstructionNode *Assembler::pushLiteralVariableIndex(int literalVariableIndex)
 {
-	return addInstruction(new PushLiteralVariable(literalVariableIndex));
+	return addInstruction(arena.make<PushLiteralVariable> (literalVariableIndex));
 }
 
 InstructionNode *Assembler::pushTemporal(int temporalIndex)
 {
-	return addInstruction(new PushTemporal(temporalIndex));
+	return addInstruction(arena.make<PushTemporal> (temporalIndex));
 }
 
 InstructionNode *Assembler::pushNewArray(int arraySize)
 {
-    return addInstruction(new PushArray(arraySize));
+    return addInstruction(arena.make<PushArray> (arraySize));
 }
 
 InstructionNode *Assembler::pushTemporalInVector(int temporalIndex, int vectorIndex)
 {
-    return addInstruction(new PushTemporalInVector(temporalIndex, vectorIndex));
+    return addInstruction(arena.make<PushTemporalInVector> (temporalIndex, vectorIndex));
 }
 
 InstructionNode *Assembler::storeReceiverVariableIndex(int variableIndex)
 {
-    return addInstruction(new StoreReceiverVariable(variableIndex, usingLongInstanceVariableAccessors));
+    return addInstruction(arena.make<StoreReceiverVariable> (variableIndex, usingLongInstanceVariableAccessors));
 }
 
 InstructionNode *Assembler::storeLiteralVariableIndex(int literalVariableIndex)
 {
-    return addInstruction(new StoreLiteralVariable(literalVariableIndex));
+    return addInstruction(arena.make<StoreLiteralVariable> (literalVariableIndex));
 }
 
 InstructionNode *Assembler::storeTemporal(int temporalIndex)
 {
-    return addInstruction(new StoreTemporal(temporalIndex));
+    return addInstruction(arena.make<StoreTemporal> (temporalIndex));
 }
 
 InstructionNode *Assembler::popStoreTemporal(int temporalIndex)
 {
-    return addInstruction(new PopStoreTemporal(temporalIndex));
+    return addInstruction(arena.make<PopStoreTemporal> (temporalIndex));
 }
 
 InstructionNode *Assembler::storeLiteralVariable(Oop literalVariable)
@@ -988,112 +1440,117 @@ InstructionNode *Assembler::storeLiteralVariable(Oop literalVariable)
 
 InstructionNode *Assembler::pushNClosureTemps(int temporalCount)
 {
-    return addInstruction(new PushNClosureTemps(temporalCount));
+    return addInstruction(arena.make<PushNClosureTemps> (temporalCount));
 }
 
 InstructionNode *Assembler::storeTemporalInVector(int temporalIndex, int vectorIndex)
 {
-    return addInstruction(new StoreTemporalInVector(temporalIndex, vectorIndex));
+    return addInstruction(arena.make<StoreTemporalInVector> (temporalIndex, vectorIndex));
 }
 
 InstructionNode *Assembler::popStoreTemporalInVector(int temporalIndex, int vectorIndex)
 {
-    return addInstruction(new PopStoreTemporalInVector(temporalIndex, vectorIndex));
+    return addInstruction(arena.make<PopStoreTemporalInVector> (temporalIndex, vectorIndex));
 }
 
 InstructionNode *Assembler::pushClosure(int numCopied, int numArgs, Label *blockEnd, int numExtensions)
 {
-    return addInstruction(new PushClosure(numCopied, numArgs, blockEnd, numExtensions));
+    return addInstruction(arena.make<PushClosure> (numCopied, numArgs, blockEnd, numExtensions));
 }
 
 InstructionNode *Assembler::pushReceiver()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushReceiver, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushReceiver, false));
 }
 
 InstructionNode *Assembler::pushThisContext()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushThisContext, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushThisContext, false));
 }
 
 InstructionNode *Assembler::pushNil()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushNil, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushNil, false));
 }
 
 InstructionNode *Assembler::pushTrue()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushTrue, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushTrue, false));
 }
 
 InstructionNode *Assembler::pushFalse()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushFalse, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushFalse, false));
 }
 
 InstructionNode *Assembler::pushOne()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushOne, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushOne, false));
 }
 
 InstructionNode *Assembler::pushZero()
 {
-	return addInstruction(new SingleBytecodeInstruction(BytecodeSet::PushZero, false));
+	return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::PushZero, false));
 }
 
 InstructionNode *Assembler::sendValue()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageValue, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageValue, false));
 }
 
 InstructionNode *Assembler::sendValueWithArg()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageValueArg, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageValueArg, false));
 }
 
 InstructionNode *Assembler::add()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageAdd, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageAdd, false));
+}
+
+InstructionNode *Assembler::subtract()
+{
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageMinus, false));
 }
 
 InstructionNode *Assembler::greaterThan()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageGreaterThan, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageGreaterThan, false));
 }
 
 InstructionNode *Assembler::greaterEqual()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageGreaterEqual, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageGreaterEqual, false));
 }
 
 InstructionNode *Assembler::lessEqual()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageLessEqual, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageLessEqual, false));
 }
 
 InstructionNode *Assembler::lessThan()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageLessThan, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageLessThan, false));
 }
 
 InstructionNode *Assembler::equal()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageEqual, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageEqual, false));
 }
 
 InstructionNode *Assembler::notEqual()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageNotEqual, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageNotEqual, false));
 }
 
 InstructionNode *Assembler::identityEqual()
 {
-    return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageIdentityEqual, false));
+    return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageIdentityEqual, false));
 }
 
 InstructionNode *Assembler::callPrimitive(int primitiveIndex)
 {
-    return addInstruction(new CallPrimitiveInstruction(primitiveIndex));
+    return addInstruction(arena.make<CallPrimitiveInstruction> (primitiveIndex));
 }
 
 InstructionNode *Assembler::send(Oop selector, int argumentCount)
@@ -1102,29 +1559,29 @@ InstructionNode *Assembler::send(Oop selector, int argumentCount)
     {
         auto specialSelector = context->getSpecialMessageSelector(SpecialMessageSelector(i));
         if(selector == specialSelector)
-            return addInstruction(new SingleBytecodeInstruction(BytecodeSet::SpecialMessageAdd + i, false));
+            return addInstruction(arena.make<SingleBytecodeInstruction> (BytecodeSet::SpecialMessageAdd + i, false));
     }
-	return addInstruction(new SendMessage((int)addLiteral(selector), argumentCount));
+	return addInstruction(arena.make<SendMessage> ((int)addLiteral(selector), argumentCount));
 }
 
 InstructionNode *Assembler::superSend(Oop selector, int argumentCount)
 {
-	return addInstruction(new SuperSendMessage((int)addLiteral(selector), argumentCount));
+	return addInstruction(arena.make<SuperSendMessage> ((int)addLiteral(selector), argumentCount));
 }
 
 InstructionNode *Assembler::jump(Label *destination)
 {
-    return addInstruction(new UnconditionalJump(destination));
+    return addInstruction(arena.make<UnconditionalJump> (destination));
 }
 
 InstructionNode *Assembler::jumpOnTrue(Label *destination)
 {
-    return addInstruction(new ConditionalJump(destination, true));
+    return addInstruction(arena.make<ConditionalJump> (destination, true));
 }
 
 InstructionNode *Assembler::jumpOnFalse(Label *destination)
 {
-    return addInstruction(new ConditionalJump(destination, false));
+    return addInstruction(arena.make<ConditionalJump> (destination, false));
 }
 } // End of namespace MethodAssembler
 } // End of namespace Lodtalk
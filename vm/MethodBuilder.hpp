@@ -1,14 +1,20 @@
 #ifndef METHOD_BUILDER_HPP
 #define METHOD_BUILDER_HPP
 
+#include <unordered_map>
 #include "Lodtalk/Object.hpp"
 #include "Lodtalk/Collections.hpp"
+#include "Arena.hpp"
 #include "Method.hpp"
 
 namespace Lodtalk
 {
 namespace MethodAssembler
 {
+class Label;
+
+// The literals are indexed by hash when a method has this many of them.
+static constexpr size_t LiteralIndexThreshold = 16;
 
 /**
  * Method assembler node.
@@ -25,6 +31,64 @@ public:
 		return false;
 	}
 
+	// Queries for the peephole optimizer.
+	virtual bool isLabel() const
+	{
+		return false;
+	}
+
+	virtual bool isUnconditionalJump() const
+	{
+		return false;
+	}
+
+	virtual bool isPopStackTop() const
+	{
+		return false;
+	}
+
+	virtual bool isDuplicateStackTop() const
+	{
+		return false;
+	}
+
+	virtual bool isPushWithoutSideEffects() const
+	{
+		return false;
+	}
+
+	// The label used by a jump or by a closure.
+	virtual Label *getReferencedLabel() const
+	{
+		return nullptr;
+	}
+
+	virtual Label *getJumpDestination() const
+	{
+		return nullptr;
+	}
+
+	virtual void setJumpDestination(Label *newDestination)
+	{
+	}
+
+	// Creates a copy of the instruction, if it can be duplicated.
+	virtual InstructionNode *copy(Arena &arena) const
+	{
+		return nullptr;
+	}
+
+	// Creates the store that pops the value, or the other way around.
+	virtual InstructionNode *makePopStore(Arena &arena) const
+	{
+		return nullptr;
+	}
+
+	virtual InstructionNode *makeStore(Arena &arena) const
+	{
+		return nullptr;
+	}
+
 	size_t getPosition()
 	{
 		return position;
@@ -88,6 +152,11 @@ private:
 class Label: public InstructionNode
 {
 public:
+	virtual bool isLabel() const
+	{
+		return true;
+	}
+
 	virtual uint8_t *encode(uint8_t *buffer)
 	{
 		return buffer;
@@ -101,7 +170,11 @@ protected:
 };
 
 /**
- * Compiled method builder
+ * Compiled method builder. The instructions and the labels are allocated in
+ * the arena of the assembler, which releases them with the assembler.
+ * The literals of the large methods are indexed by their hash, so each one
+ * is added in constant time. The literal strings are shared when they are
+ * equal.
  */
 class Assembler
 {
@@ -178,6 +251,7 @@ public:
 	InstructionNode *superSend(Oop selector, int argumentCount);
 
     InstructionNode *add();
+    InstructionNode *subtract();
     InstructionNode *greaterEqual();
     InstructionNode *greaterThan();
     InstructionNode *lessEqual();
@@ -191,10 +265,19 @@ public:
     InstructionNode *jumpOnFalse(Label *destination);
 
 private:
+	void optimizeInstructions();
+	bool threadJumps();
+	bool removeDeadCode();
+	bool combineInstructions();
 	size_t computeInstructionsSize();
 
+	size_t findLiteral(Oop literal, uint32_t hash);
+	size_t appendLiteral(Oop literal, uint32_t hash);
+
     VMContext *context;
+    Arena arena;
 	std::vector<OopRef> literals;
+	std::unordered_multimap<uint32_t, size_t> literalIndices;
 	std::vector<InstructionNode*> instructionStream;
     bool usingLongInstanceVariableAccessors;
 };
@@ -5,6 +5,10 @@
 #include "Lodtalk/Exception.hpp"
 #include "Lodtalk/Math.hpp"
 #include "Method.hpp"
+#include "MemoryManager.hpp"
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
@@ -12,9 +16,30 @@ namespace Lodtalk
 {
 
 // Special object
-LODTALK_VM_EXPORT UndefinedObject NilObject;
-LODTALK_VM_EXPORT True TrueObject;
-LODTALK_VM_EXPORT False FalseObject;
+// They are placed at a fixed address when it is free, so the pointers to them in an image are valid in another process.
+struct SpecialObjects
+{
+    UndefinedObject nilObject;
+    True trueObject;
+    False falseObject;
+};
+
+static SpecialObjects *createSpecialObjects()
+{
+    auto pages = allocateSpecialObjectPages(sizeof(SpecialObjects));
+    if(!pages)
+    {
+        fprintf(stderr, "Failed to allocate the special objects.\n");
+        abort();
+    }
+
+    return new (pages) SpecialObjects();
+}
+
+static SpecialObjects *specialObjects = createSpecialObjects();
+LODTALK_VM_EXPORT UndefinedObject &NilObject = specialObjects->nilObject;
+LODTALK_VM_EXPORT True &TrueObject = specialObjects->trueObject;
+LODTALK_VM_EXPORT False &FalseObject = specialObjects->falseObject;
 
 // Proto object methods
 SpecialNativeClassFactory ProtoObject::Factory("ProtoObject", SCI_ProtoObject, nullptr, [](ClassBuilder &builder) {
@@ -48,20 +73,18 @@ int Object::stAt(InterpreterProxy *interpreter)
     if(interpreter->getArgumentCount() != 1)
         return interpreter->primitiveFailed();
 
-    interpreter->pushOop(interpreter->getReceiver());
-    auto error = stSize(interpreter);
-    if(error != 0)
-        return error;
-
     Oop self = interpreter->getReceiver();
     Oop indexOop = interpreter->getTemporary(0);
-    auto size = interpreter->popOop().decodeSmallInteger();
+    if(!self.isPointer() || !self.isIndexable() || !indexOop.isSmallInteger())
+        return interpreter->primitiveFailed();
+
+    auto context = interpreter->getContext();
+    auto size = (SmallIntegerValue)self.getNumberOfVariableElements(context);
 	auto index = indexOop.decodeSmallInteger() - 1;
-	if(index > size || index < 0)
+	if(index >= size || index < 0)
 		return interpreter->primitiveFailed();
 
     // Get the element.
-    auto context = interpreter->getContext();
     auto firstIndexableField = self.getFirstIndexableFieldPointer(context);
     auto format = self.header->objectFormat;
     if(format < OF_INDEXABLE_64)
@@ -108,26 +131,25 @@ int Object::stAtPut(InterpreterProxy *interpreter)
     if(interpreter->getArgumentCount() != 2)
         return interpreter->primitiveFailed();
 
-    interpreter->pushOop(interpreter->getReceiver());
-    auto error = stSize(interpreter);
-    if(error != 0)
-        return error;
-
     auto self = interpreter->getReceiver();
     auto indexOop = interpreter->getTemporary(0);
     auto value = interpreter->getTemporary(1);
-	auto size = interpreter->popOop().decodeSmallInteger();
+    if(!self.isPointer() || !self.isIndexable() || !indexOop.isSmallInteger())
+        return interpreter->primitiveFailed();
+
+    auto context = interpreter->getContext();
+	auto size = (SmallIntegerValue)self.getNumberOfVariableElements(context);
 	auto index = indexOop.decodeSmallInteger() - 1;
-	if(index > size || index < 0)
+	if(index >= size || index < 0)
 		return interpreter->primitiveFailed();
 
     // Set the element.
-    auto context = interpreter->getContext();
     auto firstIndexableField = self.getFirstIndexableFieldPointer(context);
     auto format = self.header->objectFormat;
     if(format < OF_INDEXABLE_64)
     {
         auto oopData = reinterpret_cast<Oop*> (firstIndexableField);
+        context->writeBarrier(oopData[index], value);
         oopData[index] = value;
     }
     else if(format >= OF_INDEXABLE_8)
@@ -190,6 +212,11 @@ int Object::stIdentityHash(InterpreterProxy *interpreter)
     return interpreter->returnSmallInteger(identityHashOf(receiver));
 }
 
+int Object::stIsPinned(InterpreterProxy *interpreter)
+{
+    return interpreter->returnBoolean(interpreter->getReceiver().isPinned());
+}
+
 // Object
 SpecialNativeClassFactory Object::Factory("Object", SCI_Object, &ProtoObject::Factory, [](ClassBuilder &builder) {
     builder
@@ -199,6 +226,7 @@ SpecialNativeClassFactory Object::Factory("Object", SCI_Object, &ProtoObject::Fa
         .addPrimitiveMethod(75, "identityHash", Object::stIdentityHash)
         .addPrimitiveMethod(110, "==", Object::stIdentityEqual)
         .addPrimitiveMethod(111, "class", Object::stClass)
+        .addPrimitiveMethod(183, "isPinned", Object::stIsPinned)
 
         .addMethod("at:", Object::stAt)
         .addMethod("at:put:", Object::stAtPut)
@@ -230,6 +258,28 @@ int Behavior::stBasicNewSize(InterpreterProxy *interpreter)
     return interpreter->returnOop(Oop::fromPointer(self->basicNativeNew(interpreter->getContext(), size.decodeSmallInteger())));
 }
 
+int Behavior::stBasicNewPinned(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 0)
+        return interpreter->primitiveFailed();
+
+    auto self = reinterpret_cast<Behavior*> (interpreter->getReceiver().pointer);
+    return interpreter->returnOop(Oop::fromPointer(self->basicNativeNewPinned(interpreter->getContext(), 0)));
+}
+
+int Behavior::stBasicNewPinnedSize(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 1)
+        return interpreter->primitiveFailed();
+
+    Oop size = interpreter->getTemporary(0);
+    if(!size.isSmallInteger() || size.decodeSmallInteger() < 0)
+        return interpreter->primitiveFailed();
+
+    auto self = reinterpret_cast<Behavior*> (interpreter->getReceiver().pointer);
+    return interpreter->returnOop(Oop::fromPointer(self->basicNativeNewPinned(interpreter->getContext(), size.decodeSmallInteger())));
+}
+
 int Behavior::stRegisterInClassTable(InterpreterProxy *interpreter)
 {
     if(interpreter->getArgumentCount() != 0)
@@ -248,34 +298,42 @@ Object *Behavior::basicNativeNew(VMContext *context, size_t indexableSize)
 	return reinterpret_cast<Object*> (context->newObject(fixedSlotCount, indexableSize, theFormat, classIndex));
 }
 
+Object *Behavior::basicNativeNewPinned(VMContext *context, size_t indexableSize)
+{
+	auto theFormat = (ObjectFormat)format.decodeSmallInteger();
+	auto fixedSlotCount = fixedVariableCount.decodeSmallInteger();
+	auto classIndex = object_header_.identityHash;
+	return reinterpret_cast<Object*> (context->newPinnedObject(fixedSlotCount, indexableSize, theFormat, classIndex));
+}
+
 Object *Behavior::basicNativeNew(VMContext *context)
 {
 	return basicNativeNew(context, 0);
 }
 
-Oop Behavior::superLookupSelector(Oop selector)
+Oop Behavior::superLookupSelector(VMContext *context, Oop selector)
 {
 	// Find in the super class.
 	if(isNil(superclass))
 		return nilOop();
-	return superclass->lookupSelector(selector);
+	return superclass->lookupSelector(context, selector);
 }
 
-Oop Behavior::lookupSelector(Oop selector)
+Oop Behavior::lookupSelector(VMContext *context, Oop selector)
 {
 	// Sanity check.
 	if(isNil(methodDict))
 		return nilOop();
 
 	// Look the method in the dictionary.
-	auto method = methodDict->atOrNil(selector);
+	auto method = methodDict->atOrNil(context, selector);
 	if(!isNil(method))
 		return method;
 
 	// Find in the super class.
 	if(isNil(superclass))
 		return nilOop();
-	return superclass->lookupSelector(selector);
+	return superclass->lookupSelector(context, selector);
 }
 
 Oop Behavior::getBinding(VMContext *context)
@@ -302,6 +360,8 @@ SpecialNativeClassFactory Behavior::Factory("Behavior", SCI_Behavior, &Object::F
     builder
         .addPrimitiveMethod(70, "basicNew", Behavior::stBasicNew)
         .addPrimitiveMethod(71, "basicNew:", Behavior::stBasicNewSize)
+        .addPrimitiveMethod(596, "basicNewPinned", Behavior::stBasicNewPinned)
+        .addPrimitiveMethod(597, "basicNewPinned:", Behavior::stBasicNewPinnedSize)
         .addMethod("registerInClassTable", Behavior::stRegisterInClassTable);
 });
 
@@ -1076,6 +1136,84 @@ int SmalltalkImage::stWordSize(InterpreterProxy *interpreter)
     return interpreter->returnSmallInteger(sizeof(void*));
 }
 
+int SmalltalkImage::stVMParameterAt(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 1)
+        return interpreter->primitiveFailed();
+
+    auto index = interpreter->getTemporary(0);
+    if(!index.isSmallInteger())
+        return interpreter->primitiveFailed();
+
+    int64_t value;
+    if(!interpreter->getContext()->getVMParameter((int)index.decodeSmallInteger(), value))
+        return interpreter->primitiveFailed();
+
+    return interpreter->returnSmallInteger(value);
+}
+
+int SmalltalkImage::stVMParameterAtPut(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 2)
+        return interpreter->primitiveFailed();
+
+    auto index = interpreter->getTemporary(0);
+    auto value = interpreter->getTemporary(1);
+    if(!index.isSmallInteger() || !value.isSmallInteger())
+        return interpreter->primitiveFailed();
+
+    if(!interpreter->getContext()->setVMParameter((int)index.decodeSmallInteger(), value.decodeSmallInteger()))
+        return interpreter->primitiveFailed();
+
+    return interpreter->returnOop(value);
+}
+
+int SmalltalkImage::stGCStatistics(InterpreterProxy *interpreter)
+{
+    auto context = interpreter->getContext();
+    std::vector<int64_t> counters;
+    context->getGCStatistics(counters);
+
+    auto result = Array::basicNativeNew(context, counters.size());
+    auto elements = reinterpret_cast<Oop*> (result->getFirstFieldPointer());
+    for(size_t i = 0; i < counters.size(); ++i)
+        elements[i] = Oop::encodeSmallInteger(counters[i]);
+
+    return interpreter->returnOop(Oop::fromPointer(result));
+}
+
+int SmalltalkImage::stGarbageCollect(InterpreterProxy *interpreter)
+{
+    // The collection happens in the next message send.
+    interpreter->getContext()->collectGarbage();
+    return interpreter->returnReceiver();
+}
+
+int SmalltalkImage::stAllocationSamplingIntervalPut(InterpreterProxy *interpreter)
+{
+    if(interpreter->getArgumentCount() != 1)
+        return interpreter->primitiveFailed();
+
+    auto interval = interpreter->getTemporary(0);
+    if(!interval.isSmallInteger() || interval.decodeSmallInteger() < 0)
+        return interpreter->primitiveFailed();
+
+    interpreter->getContext()->setAllocationSamplingInterval(interval.decodeSmallInteger());
+    return interpreter->returnReceiver();
+}
+
+int SmalltalkImage::stWriteAllocationProfile(InterpreterProxy *interpreter)
+{
+    interpreter->getContext()->writeAllocationProfile(stderr);
+    return interpreter->returnReceiver();
+}
+
+int SmalltalkImage::stResetAllocationProfile(InterpreterProxy *interpreter)
+{
+    interpreter->getContext()->resetAllocationProfile();
+    return interpreter->returnReceiver();
+}
+
 SpecialNativeClassFactory SmalltalkImage::Factory("SmalltalkImage", SCI_SmalltalkImage, &Object::Factory, [](ClassBuilder &builder) {
     builder
         .addInstanceVariables("globals")
@@ -1084,7 +1222,14 @@ SpecialNativeClassFactory SmalltalkImage::Factory("SmalltalkImage", SCI_Smalltal
         .addPrimitiveMethod(114, "exitToDebugger", &stExitToDebugger)
 
         .addMethod("nativeBreakpoint", &stNativeBreakpoint)
-        .addMethod("wordSize", &stWordSize);
+        .addMethod("wordSize", &stWordSize)
+        .addMethod("vmParameterAt:", &stVMParameterAt)
+        .addMethod("vmParameterAt:put:", &stVMParameterAtPut)
+        .addMethod("gcStatistics", &stGCStatistics)
+        .addMethod("garbageCollect", &stGarbageCollect)
+        .addMethod("allocationSamplingInterval:", &stAllocationSamplingIntervalPut)
+        .addMethod("writeAllocationProfile", &stWriteAllocationProfile)
+        .addMethod("resetAllocationProfile", &stResetAllocationProfile);
 });
 
 // External handle
@@ -9,6 +9,7 @@
 #include "Compiler.hpp"
 #include "InputOutput.hpp"
 #include "MemoryManager.hpp"
+#include "AllocationProfiler.hpp"
 #include "StackMemory.hpp"
 #include "SpecialRuntimeObjects.hpp"
 
@@ -16,6 +17,16 @@ namespace Lodtalk
 {
 
 ObjectHeader *VMContext::newObject(size_t fixedSlotCount, size_t indexableSize, ObjectFormat format, int classIndex, int identityHash)
+{
+    return allocateObject(fixedSlotCount, indexableSize, format, classIndex, identityHash, false);
+}
+
+ObjectHeader *VMContext::newPinnedObject(size_t fixedSlotCount, size_t indexableSize, ObjectFormat format, int classIndex)
+{
+    return allocateObject(fixedSlotCount, indexableSize, format, classIndex, -1, true);
+}
+
+ObjectHeader *VMContext::allocateObject(size_t fixedSlotCount, size_t indexableSize, ObjectFormat format, int classIndex, int identityHash, bool pinned)
 {
 	// Compute the header size.
 	size_t indexableSlotCount = 0;
@@ -55,7 +66,7 @@ ObjectHeader *VMContext::newObject(size_t fixedSlotCount, size_t indexableSize,
 	auto objectSize = headerSize + bodySize;
 
 	// Allocate the object memory
-	auto data = allocateObjectMemory(objectSize, bigObject);
+	auto data = allocateObjectMemory(objectSize, bigObject, pinned);
 	auto header = reinterpret_cast<ObjectHeader*> (data);
 
 	// Generate a hash if requested.
@@ -68,8 +79,9 @@ ObjectHeader *VMContext::newObject(size_t fixedSlotCount, size_t indexableSize,
 	header->identityHash = identityHash;
 	header->objectFormat = format + indexableFormatExtraBits;
 	header->classIndex = classIndex;
+    header->isPinned = pinned;
 	if(bigObject)
-        reinterpret_cast<uint64_t*> (header)[-1] = totalSlotCount;
+        reinterpret_cast<uint64_t*> (header)[-1] = encodeBigObjectSlotCount(totalSlotCount);
 
 	// Initialize the slots.
 	auto slotStarts = data + headerSize;
@@ -84,6 +96,9 @@ ObjectHeader *VMContext::newObject(size_t fixedSlotCount, size_t indexableSize,
 		memset(slotStarts, 0, bodySize);
 	}
 
+    // Sample the allocation.
+    memoryManager->getAllocationProfiler()->objectAllocated(objectSize, classIndex);
+
 	// Return the object.
 	return header;
 }
@@ -189,11 +204,26 @@ Oop VMContext::makeByteSymbol(const std::string &content)
 	return ByteSymbol::fromNative(this, content);
 }
 
+Oop VMContext::makeByteSymbol(const char *data, size_t size)
+{
+	return ByteSymbol::fromNativeRange(this, data, size);
+}
+
 Oop VMContext::makeSelector(const std::string &content)
 {
 	return makeByteSymbol(content);
 }
 
+Oop VMContext::makeSelector(const char *data, size_t size)
+{
+	return makeByteSymbol(data, size);
+}
+
+Oop VMContext::findByteSymbol(const char *data, size_t size)
+{
+	return memoryManager->getSymbolTable()->lookup(data, size);
+}
+
 // Get a class from its index
 Oop VMContext::getClassFromIndex(int classIndex)
 {
@@ -248,19 +278,25 @@ Oop VMContext::setGlobalVariable(Oop symbol, Oop value)
 	auto globalVar = globalDictionary->getNativeAssociationOrNil(symbol);
 	if(classIndexOf(Oop::fromPointer(globalVar)) == SCI_GlobalVariable)
 	{
+        writeBarrier(globalVar->value, value);
 		globalVar->value = value;
 		return Oop::fromPointer(globalVar);
 	}
 
 	// Create the global variable
-	Ref<Association> newGlobalVar(this, GlobalVariable::make(this, symbol, value));
+	HandleScope scope(this);
+	Handle<Association> newGlobalVar(this, GlobalVariable::make(this, symbol, value));
 	globalDictionary->putNativeAssociation(this, newGlobalVar.get());
 	return newGlobalVar.getOop();
 }
 
 Oop VMContext::getGlobalFromName(const char *name)
 {
-	return getGlobalFromSymbol(makeByteSymbol(name));
+	// There cannot be a global without its symbol.
+	auto symbol = findByteSymbol(name, strlen(name));
+	if(isNil(symbol))
+		return nilOop();
+	return getGlobalFromSymbol(symbol);
 }
 
 Oop VMContext::getGlobalFromSymbol(Oop symbol)
@@ -270,7 +306,10 @@ Oop VMContext::getGlobalFromSymbol(Oop symbol)
 
 Oop VMContext::getGlobalValueFromName(const char *name)
 {
-	return getGlobalValueFromSymbol(ByteSymbol::fromNative(this, name));
+	auto symbol = findByteSymbol(name, strlen(name));
+	if(isNil(symbol))
+		return nilOop();
+	return getGlobalValueFromSymbol(symbol);
 }
 
 Oop VMContext::getGlobalValueFromSymbol(Oop symbol)
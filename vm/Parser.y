@@ -25,11 +25,15 @@ using namespace Lodtalk::AST;
 extern int yylex(LODTALK_STYPE * yylval_param, LODTALK_LTYPE * yylloc_param , yyscan_t yyscanner);
 extern void yyerror(LODTALK_LTYPE * yylloc_param , yyscan_t scanner, ParserScannerExtraData *, const char *message);
 
-inline std::string readStringValue(char* stringValue)
+inline std::string readStringValue(const ParserScannerSpan &stringValue)
 {
-    std::string result = stringValue;
-    free(stringValue);
-    return result;
+    return std::string(stringValue.start, stringValue.size);
+}
+
+template<typename T, typename... Args>
+inline T *newNode(ParserScannerExtraData *extraData, Args&&... args)
+{
+    return extraData->arena->make<T> (std::forward<Args> (args)...);
 }
 
 #ifdef _WIN32
@@ -47,7 +51,7 @@ inline std::string readStringValue(char* stringValue)
 %union {
 	int integerValue;
 	double floatingValue;
-	char *stringValue;
+	ParserScannerSpan stringValue;
     Lodtalk::AST::Node *node;
     Lodtalk::AST::SequenceNode *sequenceNode;
     Lodtalk::AST::MessageSendNode *messageSendNode;
@@ -113,10 +117,10 @@ top: DO_IT blockContent { extraData->astResult = $2; }
 
 sourceFile: sourceFileStatementList {$$ = $1; }
           | sourceFileStatementList DOT {$$ = $1; }
-          |                         {$$ = new SequenceNode(); }
+          |                         {$$ = newNode<SequenceNode>(extraData); }
           ;
 
-sourceFileStatementList: sourceFileStatement                                {$$ = new SequenceNode($1); }
+sourceFileStatementList: sourceFileStatement                                {$$ = newNode<SequenceNode>(extraData, $1); }
                        | sourceFileStatementList DOT sourceFileStatement    {
                             $$ = $1;
                             $$->addStatement($3);
@@ -124,51 +128,51 @@ sourceFileStatementList: sourceFileStatement                                {$$
                        ;
 
 sourceFileStatement: statement  { $$ = $1; }
-                   | unaryMessage IDENTIFIER LBRACKET method RBRACKET  { $$ = new MessageSendNode(readStringValue($2) + ":", $1, $4); }
+                   | unaryMessage IDENTIFIER LBRACKET method RBRACKET  { $$ = newNode<MessageSendNode>(extraData, readStringValue($2) + ":", $1, $4); }
                    ;
 
-method: methodHeader methodPragmas blockContent { $$ = new MethodAST(extraData->context, $1, $2, $3); }
+method: methodHeader methodPragmas blockContent { $$ = newNode<MethodAST>(extraData, extraData->context, $1, $2, $3); }
       ;
 
-methodHeader: IDENTIFIER                    { $$ = new MethodHeader(readStringValue($1)); }
-            | binarySelector IDENTIFIER     { $$ = new MethodHeader(readStringValue($1), new ArgumentList(new Argument(readStringValue($2)))); }
+methodHeader: IDENTIFIER                    { $$ = newNode<MethodHeader>(extraData, readStringValue($1)); }
+            | binarySelector IDENTIFIER     { $$ = newNode<MethodHeader>(extraData, readStringValue($1), newNode<ArgumentList>(extraData, newNode<Argument>(extraData, readStringValue($2)))); }
             | keywordMethodHeader           { $$ = $1; }
             ;
 
-keywordMethodHeader: MESSAGE_KEYWORD IDENTIFIER                         { $$ = new MethodHeader(readStringValue($1), new ArgumentList(new Argument(readStringValue($2)))); }
+keywordMethodHeader: MESSAGE_KEYWORD IDENTIFIER                         { $$ = newNode<MethodHeader>(extraData, readStringValue($1), newNode<ArgumentList>(extraData, newNode<Argument>(extraData, readStringValue($2)))); }
                    | keywordMethodHeader MESSAGE_KEYWORD IDENTIFIER     {
                         $$ =  $1;
-                        $$->appendSelectorAndArgument(readStringValue($2), new Argument(readStringValue($3)));
+                        $$->appendSelectorAndArgument(readStringValue($2), newNode<Argument>(extraData, readStringValue($3)));
                    }
                    ;
 
-methodPragmas: { $$ = new PragmaList(); }
+methodPragmas: { $$ = newNode<PragmaList>(extraData); }
              | methodPragmas methodPragma { $$ = $1; $$->addPragma($2); }
              ;
 
-methodPragma: LT IDENTIFIER GT              { $$ = new PragmaDefinition(extraData->context, readStringValue($2)); }
+methodPragma: LT IDENTIFIER GT              { $$ = newNode<PragmaDefinition>(extraData, extraData->context, readStringValue($2)); }
             | LT keywordPragmaContent GT    { $$ = $2; }
             ;
 
-keywordPragmaContent: MESSAGE_KEYWORD pragmaLiteral                 { $$ = new PragmaDefinition(extraData->context); $$->appendParameter(readStringValue($1), $2); }
+keywordPragmaContent: MESSAGE_KEYWORD pragmaLiteral                 { $$ = newNode<PragmaDefinition>(extraData, extraData->context); $$->appendParameter(readStringValue($1), $2); }
             | keywordPragmaContent MESSAGE_KEYWORD pragmaLiteral { $$ = $1; $$->appendParameter(readStringValue($2), $3); }
             ;
 
 pragmaLiteral: literal  { $$ = $1; }
-             | IDENTIFIER { $$ = new LiteralNode(ByteSymbol::fromNative(extraData->context, readStringValue($1))); }
+             | IDENTIFIER { $$ = newNode<LiteralNode>(extraData, ByteSymbol::fromNativeRange(extraData->context, $1.start, $1.size)); }
              ;
 
-block: LBRACKET blockArguments blockContent RBRACKET  { $$ = new BlockExpression($2, $3); }
+block: LBRACKET blockArguments blockContent RBRACKET  { $$ = newNode<BlockExpression>(extraData, $2, $3); }
      ;
 
 blockArguments: blockArgumentList VERTICAL_BAR
               | { $$ = nullptr; }
               ;
 
-blockArgumentList: BLOCK_ARGUMENT                       { $$ = new ArgumentList(new Argument(readStringValue($1))); }
+blockArgumentList: BLOCK_ARGUMENT                       { $$ = newNode<ArgumentList>(extraData, newNode<Argument>(extraData, readStringValue($1))); }
                  | blockArgumentList BLOCK_ARGUMENT     {
                     $$ = $1;
-                    $$->appendArgument(new Argument(readStringValue($2)));
+                    $$->appendArgument(newNode<Argument>(extraData, readStringValue($2)));
                  }
                  ;
 
@@ -184,21 +188,21 @@ localDeclarations: VERTICAL_BAR localList VERTICAL_BAR  { $$ = $2; }
 
 localList: localList IDENTIFIER {
             $$ = $1;
-            $$->appendLocal(new LocalDeclaration(readStringValue($2)));
+            $$->appendLocal(newNode<LocalDeclaration>(extraData, readStringValue($2)));
          }
-         |  { $$ = new LocalDeclarations(); }
+         |  { $$ = newNode<LocalDeclarations>(extraData); }
          ;
 
 statementListNonEmpty: statementListNonEmpty DOT statement {
         $$ = $1;
         $1->addStatement($3);
     }
-    | statement { $$ = new SequenceNode($1);}
+    | statement { $$ = newNode<SequenceNode>(extraData, $1);}
     ;
 
 statementList: statementListNonEmpty { $$ = $1; }
              | statementListNonEmpty DOT { $$ = $1; }
-             |                       {$$ = new SequenceNode(); }
+             |                       {$$ = newNode<SequenceNode>(extraData); }
              ;
 
 statement: expression { $$ = $1; }
@@ -210,7 +214,7 @@ expression: assignment      { $$ = $1; }
           | messageChain    { $$ = $1; }
           ;
 
-assignment: referenceExpression ASSIGNMENT expression { $$ = new AssignmentExpression($1, $3); }
+assignment: referenceExpression ASSIGNMENT expression { $$ = newNode<AssignmentExpression>(extraData, $1, $3); }
           ;
 
 operand: literal { $$ = $1; }
@@ -221,14 +225,14 @@ operand: literal { $$ = $1; }
        ;
 
 unaryMessage: operand                   { $$ = $1; }
-            | unaryMessage IDENTIFIER   { $$ = new MessageSendNode(readStringValue($2), $1); }
+            | unaryMessage IDENTIFIER   { $$ = newNode<MessageSendNode>(extraData, readStringValue($2), $1); }
             ;
 
 binaryMessage: unaryMessage                   { $$ = $1; }
-            | binaryMessage binarySelector unaryMessage   { $$ = new MessageSendNode(readStringValue($2), $1, $3); }
+            | binaryMessage binarySelector unaryMessage   { $$ = newNode<MessageSendNode>(extraData, readStringValue($2), $1, $3); }
             ;
 
-messageChainElement: MESSAGE_KEYWORD binaryMessage { $$ = new MessageSendNode(readStringValue($1), nullptr, $2); }
+messageChainElement: MESSAGE_KEYWORD binaryMessage { $$ = newNode<MessageSendNode>(extraData, readStringValue($1), nullptr, $2); }
             | messageChainElement MESSAGE_KEYWORD binaryMessage  {
                 $$ = $1;
                 $$->appendSelector(readStringValue($2));
@@ -246,35 +250,35 @@ messageChain: binaryMessage messageChainElement {
             }
             | messageChain SEMICOLON IDENTIFIER {
                 $$ = $1;
-                $$->appendChained(new MessageSendNode(readStringValue($3), nullptr));
+                $$->appendChained(newNode<MessageSendNode>(extraData, readStringValue($3), nullptr));
             }
             ;
 
-referenceExpression: IDENTIFIER { $$ = new IdentifierExpression(readStringValue($1)); }
+referenceExpression: IDENTIFIER { $$ = newNode<IdentifierExpression>(extraData, readStringValue($1)); }
                    ;
 
-returnStatement: RETURN expression { $$ = new ReturnStatement($2); }
+returnStatement: RETURN expression { $$ = newNode<ReturnStatement>(extraData, $2); }
                ;
 
-specialIdentifiers: KSELF           { $$ = new SelfReference(); }
-                  | KSUPER          { $$ = new SuperReference(); }
-                  | KTRUE           { $$ = new LiteralNode(&TrueObject); }
-                  | KFALSE          { $$ = new LiteralNode(&FalseObject); }
-                  | KNIL            { $$ = new LiteralNode(&NilObject); }
-                  | KTHIS_CONTEXT   { $$ = new ThisContextReference(); }
+specialIdentifiers: KSELF           { $$ = newNode<SelfReference>(extraData); }
+                  | KSUPER          { $$ = newNode<SuperReference>(extraData); }
+                  | KTRUE           { $$ = newNode<LiteralNode>(extraData, &TrueObject); }
+                  | KFALSE          { $$ = newNode<LiteralNode>(extraData, &FalseObject); }
+                  | KNIL            { $$ = newNode<LiteralNode>(extraData, &NilObject); }
+                  | KTHIS_CONTEXT   { $$ = newNode<ThisContextReference>(extraData); }
                   ;
 
-literal: INTEGER    { $$ = new LiteralNode(extraData->context->signedInt64ObjectFor($1)); }
-    | REAL          { $$ = new LiteralNode(extraData->context->floatObjectFor($1)); }
-    | STRING        { $$ = new LiteralNode(ByteString::fromNative(extraData->context, readStringValue($1)).getOop()); }
-    | CHARACTER     { $$ = new LiteralNode(Oop::encodeCharacter($1)); }
-    | SYMBOL        { $$ = new LiteralNode(ByteSymbol::fromNative(extraData->context, readStringValue($1))); }
+literal: INTEGER    { $$ = newNode<LiteralNode>(extraData, extraData->context->signedInt64ObjectFor($1)); }
+    | REAL          { $$ = newNode<LiteralNode>(extraData, extraData->context->floatObjectFor($1)); }
+    | STRING        { $$ = newNode<LiteralNode>(extraData, Oop::fromPointer(ByteString::fromNativeRange(extraData->context, $1.start, $1.size))); }
+    | CHARACTER     { $$ = newNode<LiteralNode>(extraData, Oop::encodeCharacter($1)); }
+    | SYMBOL        { $$ = newNode<LiteralNode>(extraData, ByteSymbol::fromNativeRange(extraData->context, $1.start, $1.size)); }
     ;
 
 binarySelector: BINARY_SELECTOR { $$ = $1; }
-              | VERTICAL_BAR    { $$ = strdup("|"); }
-              | LT              { $$ = strdup("<"); }
-              | GT              { $$ = strdup(">"); }
+              | VERTICAL_BAR    { $$ = makeParserScannerSpan("|", 1); }
+              | LT              { $$ = makeParserScannerSpan("<", 1); }
+              | GT              { $$ = makeParserScannerSpan(">", 1); }
               ;
 
 %%
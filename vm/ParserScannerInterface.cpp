@@ -8,6 +8,7 @@ typedef void *yyscan_t;
 #endif
 
 #include "ParserScannerInterface.hpp"
+#include "SourceBuffer.hpp"
 #include "Parser.hpp"
 #define YYSTYPE LODTALK_STYPE
 #define YYLTYPE LODTALK_LTYPE
@@ -19,17 +20,7 @@ namespace Lodtalk
 namespace AST
 {
 
-static Node *doParse(yyscan_t scanner, ParserScannerExtraData *extraData)
-{
-	auto result = Lodtalk_parse(scanner, extraData);
-	Lodtalk_lex_destroy(scanner);
-	if(result || extraData->errorCount > 0)
-        return nullptr;
-
-	return extraData->astResult;
-}
-
-Node *parseSourceFromFile(VMContext *context, FILE *input)
+static Node *parseFromBuffer(VMContext *context, SourceBuffer &source, Arena &arena, int startToken)
 {
     yyscan_t scanner;
     if(Lodtalk_lex_init(&scanner))
@@ -37,41 +28,52 @@ Node *parseSourceFromFile(VMContext *context, FILE *input)
 
     ParserScannerExtraData extraData;
     memset(&extraData, 0, sizeof(extraData));
-    extraData.startToken = SOURCE_FILE;
+    extraData.startToken = startToken;
     extraData.context = context;
+    extraData.arena = &arena;
     Lodtalk_set_extra(&extraData, scanner);
-    Lodtalk_set_in(input, scanner);
-	return doParse(scanner, &extraData);
+    if(!Lodtalk__scan_buffer(source.getScannerBuffer(), source.getScannerBufferSize(), scanner))
+    {
+        Lodtalk_lex_destroy(scanner);
+        return nullptr;
+    }
+
+	auto result = Lodtalk_parse(scanner, &extraData);
+	Lodtalk_lex_destroy(scanner);
+	if(result || extraData.errorCount > 0)
+        return nullptr;
+
+	return extraData.astResult;
 }
 
-Node *parseMethodFromFile(VMContext *context, FILE *input)
+static Node *parseFromFile(VMContext *context, FILE *input, Arena &arena, int startToken)
 {
-    yyscan_t scanner;
-    if(Lodtalk_lex_init(&scanner))
+    // The tokens refer to the source buffer, so it has to outlive the parser.
+    SourceBuffer source;
+    if(!source.load(input))
         return nullptr;
 
-    ParserScannerExtraData extraData;
-    memset(&extraData, 0, sizeof(extraData));
-    extraData.startToken = METHOD_DEFINITION;
-    extraData.context = context;
-    Lodtalk_set_extra(&extraData, scanner);
-    Lodtalk_set_in(input, scanner);
-	return doParse(scanner, &extraData);
+    return parseFromBuffer(context, source, arena, startToken);
 }
 
-Node *parseDoItFromFile(VMContext *context, FILE *input)
+Node *parseSourceFromBuffer(VMContext *context, SourceBuffer &source, Arena &arena)
 {
-    yyscan_t scanner;
-    if(Lodtalk_lex_init(&scanner))
-        return nullptr;
+    return parseFromBuffer(context, source, arena, SOURCE_FILE);
+}
 
-    ParserScannerExtraData extraData;
-    memset(&extraData, 0, sizeof(extraData));
-    extraData.startToken = DO_IT;
-    extraData.context = context;
-    Lodtalk_set_extra(&extraData, scanner);
-    Lodtalk_set_in(input, scanner);
-	return doParse(scanner, &extraData);
+Node *parseSourceFromFile(VMContext *context, FILE *input, Arena &arena)
+{
+    return parseFromFile(context, input, arena, SOURCE_FILE);
+}
+
+Node *parseMethodFromFile(VMContext *context, FILE *input, Arena &arena)
+{
+    return parseFromFile(context, input, arena, METHOD_DEFINITION);
+}
+
+Node *parseDoItFromFile(VMContext *context, FILE *input, Arena &arena)
+{
+    return parseFromFile(context, input, arena, DO_IT);
 }
 
 } // End of namespace AST
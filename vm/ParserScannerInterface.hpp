@@ -2,8 +2,24 @@
 #define LODTALK_PARSER_SCANNER_INTERFACE_HPP
 
 #include "Lodtalk/VMContext.hpp"
+#include "Arena.hpp"
 #include "AST.hpp"
 
+// A token value, which refers to the text of the token in the source buffer.
+struct ParserScannerSpan
+{
+    const char *start;
+    size_t size;
+};
+
+inline ParserScannerSpan makeParserScannerSpan(const char *start, size_t size)
+{
+    ParserScannerSpan span;
+    span.start = start;
+    span.size = size;
+    return span;
+}
+
 struct ParserScannerExtraData
 {
 	int startToken;
@@ -11,30 +27,23 @@ struct ParserScannerExtraData
     int columnCount;
 	Lodtalk::AST::Node *astResult;
     Lodtalk::VMContext *context;
+    Lodtalk::Arena *arena;
 };
 
 namespace Lodtalk
 {
+class SourceBuffer;
+
 namespace AST
 {
-Node *parseSourceFromFile(VMContext *context, FILE *input);
-Node *parseMethodFromFile(VMContext *context, FILE *input);
-Node *parseDoItFromFile(VMContext *context, FILE *input);
+// The nodes are allocated in the arena, which owns the parsed tree.
+// The whole input is loaded in a source buffer, which is scanned in place.
+Node *parseSourceFromBuffer(VMContext *context, SourceBuffer &source, Arena &arena);
+Node *parseSourceFromFile(VMContext *context, FILE *input, Arena &arena);
+Node *parseMethodFromFile(VMContext *context, FILE *input, Arena &arena);
+Node *parseDoItFromFile(VMContext *context, FILE *input, Arena &arena);
 
 } // End of namespace AST
 } // End of names Lodtalk
 
-#ifdef _WIN32
-inline char *my_strdup(const char *string)
-{
-    size_t length = strlen(string);
-    char *buffer = (char*)malloc(length + 1);
-    strncpy(buffer, string, length);
-    buffer[length] = 0;
-    return buffer;
-}
-
-#define strdup my_strdup
-#endif
-
 #endif //LODTALK_PARSER_SCANNER_INTERFACE_HPP
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <string.h>
+#include "Lodtalk/VMContext.hpp"
+#include "Lodtalk/Collections.hpp"
+#include "ScriptCache.hpp"
+#include "SourceBuffer.hpp"
+#include "BytecodeSets.hpp"
+#include "FileSystem.hpp"
+#include "Method.hpp"
+#include "RAII.hpp"
+
+namespace Lodtalk
+{
+
+// The kinds of the literals of a cached method.
+enum ScriptCacheLiteralKind
+{
+    SCLK_Immediate = 0,
+    SCLK_Nil,
+    SCLK_True,
+    SCLK_False,
+    SCLK_BoxedFloat,
+    SCLK_ByteSymbol,
+    SCLK_ByteString,
+    SCLK_Array,
+
+    // An association of the global dictionary, which is stored by its key.
+    SCLK_GlobalVariable,
+
+    // The binding of the class of the method, which is the last literal.
+    SCLK_ClassBinding,
+
+    // The selector and the pragmas of a method.
+    SCLK_AdditionalMethodState,
+};
+
+// FNV-1a hash.
+static uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    auto bytes = reinterpret_cast<const uint8_t*> (data);
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// The hash of the instance variable names of a class, which are used by its compiled methods.
+static uint64_t instanceVariablesHashOf(Oop clazz)
+{
+    uint64_t hash = hashBytes(nullptr, 0);
+    for(auto pos = reinterpret_cast<ClassDescription*> (clazz.pointer); !isNil(pos); pos = reinterpret_cast<ClassDescription*> (pos->superclass))
+    {
+        auto names = pos->instanceVariables;
+        if(!isNil(names))
+        {
+            auto count = names.getNumberOfElements();
+            auto nameArray = reinterpret_cast<Oop*> (names.getFirstFieldPointer());
+            for(size_t i = 0; i < count; ++i)
+            {
+                hash = hashBytes(nameArray[i].getFirstFieldPointer(), nameArray[i].getNumberOfElements(), hash);
+                hash = hashBytes(" ", 1, hash);
+            }
+        }
+
+        hash = hashBytes("|", 1, hash);
+    }
+
+    return hash;
+}
+
+/**
+ * Writes the compiled methods of the statements.
+ */
+class ScriptCacheWriter
+{
+public:
+    ScriptCacheWriter(VMContext *context, std::string &out)
+        : context(context), out(out) {}
+
+    bool writeMethod(CompiledMethod *method, uint64_t layoutHash);
+
+private:
+    bool writeLiteral(Oop literal);
+    bool writeObjectBytes(Oop object);
+
+    template<typename T>
+    void write(T value)
+    {
+        out.append(reinterpret_cast<const char*> (&value), sizeof(value));
+    }
+
+    void writeKind(ScriptCacheLiteralKind kind)
+    {
+        write(uint8_t(kind));
+    }
+
+    VMContext *context;
+    std::string &out;
+};
+
+bool ScriptCacheWriter::writeMethod(CompiledMethod *method, uint64_t layoutHash)
+{
+    auto literalCount = method->getLiteralCount();
+    auto literals = method->getFirstLiteralPointer();
+    write(layoutHash);
+    write(uint64_t(method->getHeader()->oop.uintValue));
+    write(uint32_t(literalCount));
+    for(size_t i = 0; i < literalCount; ++i)
+    {
+        // The class binding is created again for the class of the method.
+        if(i + 1 == literalCount)
+        {
+            writeKind(SCLK_ClassBinding);
+            break;
+        }
+
+        if(!writeLiteral(literals[i]))
+            return false;
+    }
+
+    auto bytecodeSize = method->getByteDataSize();
+    write(uint32_t(bytecodeSize));
+    out.append(reinterpret_cast<const char*> (method->getFirstBCPointer()), bytecodeSize);
+    return true;
+}
+
+bool ScriptCacheWriter::writeLiteral(Oop literal)
+{
+    if(!literal.isPointer())
+    {
+        writeKind(SCLK_Immediate);
+        write(uint64_t(literal.uintValue));
+        return true;
+    }
+
+    if(literal.isNil())
+    {
+        writeKind(SCLK_Nil);
+        return true;
+    }
+    if(literal.isTrue())
+    {
+        writeKind(SCLK_True);
+        return true;
+    }
+    if(literal.isFalse())
+    {
+        writeKind(SCLK_False);
+        return true;
+    }
+
+    switch(classIndexOf(literal))
+    {
+    case SCI_BoxedFloat:
+        writeKind(SCLK_BoxedFloat);
+        write(context->floatValueOf(literal));
+        return true;
+    case SCI_ByteSymbol:
+        writeKind(SCLK_ByteSymbol);
+        return writeObjectBytes(literal);
+    case SCI_ByteString:
+        writeKind(SCLK_ByteString);
+        return writeObjectBytes(literal);
+    case SCI_Array:
+        {
+            auto count = literal.getNumberOfElements();
+            auto elements = reinterpret_cast<Oop*> (literal.getFirstFieldPointer());
+            writeKind(SCLK_Array);
+            write(uint32_t(count));
+            for(size_t i = 0; i < count; ++i)
+            {
+                if(!writeLiteral(elements[i]))
+                    return false;
+            }
+        }
+        return true;
+    case SCI_Association:
+    case SCI_GlobalVariable:
+        {
+            // Only the variables of the global dictionary can be bound by name.
+            auto key = getLookupKeyKey(literal);
+            if(classIndexOf(key) != SCI_ByteSymbol || context->getGlobalFromSymbol(key) != literal)
+                return false;
+            writeKind(SCLK_GlobalVariable);
+            return writeObjectBytes(key);
+        }
+    case SCI_AdditionalMethodState:
+        {
+            auto methodState = reinterpret_cast<AdditionalMethodState*> (literal.pointer);
+            auto pragmaCount = literal.getNumberOfElements() - 2;
+            auto pragmas = methodState->getIndexableElements();
+            writeKind(SCLK_AdditionalMethodState);
+            if(!writeLiteral(methodState->getSelector()))
+                return false;
+
+            write(uint32_t(pragmaCount));
+            for(size_t i = 0; i < pragmaCount; ++i)
+            {
+                auto pragma = reinterpret_cast<Pragma*> (pragmas[i].pointer);
+                if(classIndexOf(pragmas[i]) != SCI_Pragma || !writeLiteral(pragma->keyword) || !writeLiteral(pragma->arguments))
+                    return false;
+            }
+        }
+        return true;
+    default:
+        // The other objects cannot be cached.
+        return false;
+    }
+}
+
+bool ScriptCacheWriter::writeObjectBytes(Oop object)
+{
+    auto size = object.getNumberOfElements();
+    write(uint32_t(size));
+    out.append(reinterpret_cast<const char*> (object.getFirstFieldPointer()), size);
+    return true;
+}
+
+/**
+ * Reads the compiled methods of the statements. The garbage collector has
+ * to be disabled while reading.
+ */
+class ScriptCacheReader
+{
+public:
+    ScriptCacheReader(VMContext *context, const std::string &in)
+        : context(context), position(in.data()), end(in.data() + in.size()) {}
+
+    CompiledMethod *readMethod(Oop clazz);
+
+private:
+    bool readLiteral(Oop &literal);
+    bool readBytes(const char *&bytes, size_t &size);
+
+    template<typename T>
+    bool read(T &value)
+    {
+        if(size_t(end - position) < sizeof(value))
+            return false;
+
+        memcpy(&value, position, sizeof(value));
+        position += sizeof(value);
+        return true;
+    }
+
+    VMContext *context;
+    const char *position;
+    const char *end;
+};
+
+CompiledMethod *ScriptCacheReader::readMethod(Oop clazz)
+{
+    // The instance variables used by the method must be at the same place.
+    uint64_t layoutHash;
+    uint64_t headerValue;
+    uint32_t literalCount;
+    if(!read(layoutHash) || !read(headerValue) || !read(literalCount) || literalCount == 0)
+        return nullptr;
+    if(layoutHash && layoutHash != instanceVariablesHashOf(clazz))
+        return nullptr;
+
+    Oop headerOop;
+    headerOop.uintValue = headerValue;
+    CompiledMethodHeader header(headerOop);
+    if(!headerOop.isSmallInteger() || header.getLiteralCount() != literalCount)
+        return nullptr;
+
+    // Read the literals.
+    std::vector<Oop> literals(literalCount);
+    for(size_t i = 0; i < literalCount; ++i)
+    {
+        if(!readLiteral(literals[i]))
+            return nullptr;
+    }
+
+    uint32_t bytecodeSize;
+    if(!read(bytecodeSize) || size_t(end - position) != bytecodeSize)
+        return nullptr;
+
+    // Create the method.
+    auto method = CompiledMethod::newMethodWithHeader(context, literalCount*sizeof(void*) + bytecodeSize, header);
+    auto literalData = method->getFirstLiteralPointer();
+    for(size_t i = 0; i < literalCount; ++i)
+        literalData[i] = literals[i];
+    literalData[literalCount - 1] = reinterpret_cast<Behavior*> (clazz.pointer)->getBinding(context);
+    memcpy(method->getFirstBCPointer(), position, bytecodeSize);
+
+    // Set the back pointers of the method state.
+    auto selector = literals[literalCount - 2];
+    if(classIndexOf(selector) == SCI_AdditionalMethodState)
+    {
+        auto methodState = reinterpret_cast<AdditionalMethodState*> (selector.pointer);
+        methodState->setMethod(Oop::fromPointer(method));
+        auto pragmaCount = selector.getNumberOfElements() - 2;
+        auto pragmas = methodState->getIndexableElements();
+        for(size_t i = 0; i < pragmaCount; ++i)
+            reinterpret_cast<Pragma*> (pragmas[i].pointer)->method = Oop::fromPointer(method);
+    }
+
+    return method;
+}
+
+bool ScriptCacheReader::readLiteral(Oop &literal)
+{
+    uint8_t kind;
+    if(!read(kind))
+        return false;
+
+    const char *bytes;
+    size_t size;
+    switch(kind)
+    {
+    case SCLK_Immediate:
+        {
+            uint64_t value;
+            if(!read(value))
+                return false;
+            literal.uintValue = value;
+            return !literal.isPointer();
+        }
+    case SCLK_Nil:
+        literal = nilOop();
+        return true;
+    case SCLK_True:
+        literal = trueOop();
+        return true;
+    case SCLK_False:
+        literal = falseOop();
+        return true;
+    case SCLK_BoxedFloat:
+        {
+            double value;
+            if(!read(value))
+                return false;
+            literal = context->floatObjectFor(value);
+            return true;
+        }
+    case SCLK_ByteSymbol:
+        if(!readBytes(bytes, size))
+            return false;
+        literal = context->makeByteSymbol(bytes, size);
+        return true;
+    case SCLK_ByteString:
+        if(!readBytes(bytes, size))
+            return false;
+        literal = Oop::fromPointer(ByteString::fromNativeRange(context, bytes, size));
+        return true;
+    case SCLK_Array:
+        {
+            uint32_t count;
+            if(!read(count) || count > size_t(end - position))
+                return false;
+
+            literal = Oop::fromPointer(Array::basicNativeNew(context, count));
+            auto elements = reinterpret_cast<Oop*> (literal.getFirstFieldPointer());
+            for(size_t i = 0; i < count; ++i)
+            {
+                if(!readLiteral(elements[i]))
+                    return false;
+            }
+        }
+        return true;
+    case SCLK_GlobalVariable:
+        {
+            // The global may not be defined anymore.
+            if(!readBytes(bytes, size))
+                return false;
+            auto symbol = context->findByteSymbol(bytes, size);
+            if(isNil(symbol))
+                return false;
+            literal = context->getGlobalFromSymbol(symbol);
+            return !isNil(literal);
+        }
+    case SCLK_ClassBinding:
+        // It is set with the method.
+        literal = nilOop();
+        return true;
+    case SCLK_AdditionalMethodState:
+        {
+            Oop selector;
+            uint32_t pragmaCount;
+            if(!readLiteral(selector) || !read(pragmaCount) || pragmaCount > size_t(end - position))
+                return false;
+
+            auto methodState = AdditionalMethodState::basicNew(context, pragmaCount);
+            methodState->setSelector(selector);
+            auto pragmas = methodState->getIndexableElements();
+            for(size_t i = 0; i < pragmaCount; ++i)
+            {
+                auto pragma = Pragma::create(context);
+                pragmas[i] = Oop::fromPointer(pragma);
+                if(!readLiteral(pragma->keyword) || !readLiteral(pragma->arguments))
+                    return false;
+            }
+
+            literal = Oop::fromPointer(methodState);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool ScriptCacheReader::readBytes(const char *&bytes, size_t &size)
+{
+    uint32_t byteCount;
+    if(!read(byteCount) || size_t(end - position) < byteCount)
+        return false;
+
+    bytes = position;
+    size = byteCount;
+    position += byteCount;
+    return true;
+}
+
+// The script cache
+ScriptCache::ScriptCache(VMContext *context, const std::string &scriptFileName, const SourceBuffer &source)
+    : context(context)
+{
+    sourceSize = source.getSize();
+    sourceHash = hashBytes(source.getData(), source.getSize());
+
+    // The caches of a directory are distinguished by the hash of the script path.
+    auto &directory = context->getScriptCacheDirectory();
+    if(directory.empty())
+    {
+        // The cache of script.lodtalk is script.lodtalkc.
+        auto extensionLength = sizeof(ScriptCacheExtension) - 2;
+        auto hasExtension = scriptFileName.size() >= extensionLength &&
+            !scriptFileName.compare(scriptFileName.size() - extensionLength, extensionLength, ScriptCacheExtension, extensionLength);
+        fileName = hasExtension ? scriptFileName + "c" : scriptFileName + ScriptCacheExtension;
+    }
+    else
+    {
+        char pathHash[32];
+        snprintf(pathHash, sizeof(pathHash), "-%016llx", (unsigned long long)hashBytes(scriptFileName.data(), scriptFileName.size()));
+        auto baseName = scriptFileName.substr(dirname(scriptFileName).size());
+        fileName = joinPath(directory, baseName + pathHash + ScriptCacheExtension);
+    }
+}
+
+ScriptCache::~ScriptCache()
+{
+}
+
+bool ScriptCache::load()
+{
+    StdFile file(fileName, "rb");
+    if(!file)
+        return false;
+
+    ScriptCacheHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, ScriptCacheMagic, sizeof(header.magic)))
+        return false;
+
+    if(header.version != ScriptCacheFormatVersion || header.bytecodeSetVersion != BytecodeSet::BytecodeSetVersion ||
+        header.wordSize != sizeof(void*) || header.sourceSize != sourceSize || header.sourceHash != sourceHash)
+        return false;
+
+    // Read the body, and check that it is complete.
+    std::string body(header.bodySize, 0);
+    if(fread(&body[0], 1, body.size(), file) != body.size() || hashBytes(body.data(), body.size()) != header.bodyHash)
+        return false;
+
+    // Split the statements.
+    std::vector<Statement> loadedStatements(header.statementCount);
+    size_t position = 0;
+    for(auto &statement : loadedStatements)
+    {
+        uint32_t size;
+        if(body.size() - position < 2 + sizeof(size))
+            return false;
+
+        statement.kind = uint8_t(body[position]);
+        statement.isDefinition = body[position + 1] != 0;
+        memcpy(&size, &body[position + 2], sizeof(size));
+        position += 2 + sizeof(size);
+        if(statement.kind > SCSK_Function || body.size() - position < size)
+            return false;
+
+        statement.data = body.substr(position, size);
+        position += size;
+    }
+
+    if(position != body.size())
+        return false;
+
+    statements.swap(loadedStatements);
+    return true;
+}
+
+bool ScriptCache::save()
+{
+    // Write the body. The definitions whose method was not compiled are compiled from the source.
+    std::string body;
+    for(auto &statement : statements)
+    {
+        if(statement.kind != SCSK_DoIt && statement.data.empty())
+            statement.kind = SCSK_Source;
+
+        uint32_t size = uint32_t(statement.data.size());
+        body.push_back(char(statement.kind));
+        body.push_back(char(statement.isDefinition));
+        body.append(reinterpret_cast<const char*> (&size), sizeof(size));
+        body.append(statement.data);
+    }
+
+    ScriptCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ScriptCacheMagic, sizeof(header.magic));
+    header.version = ScriptCacheFormatVersion;
+    header.bytecodeSetVersion = BytecodeSet::BytecodeSetVersion;
+    header.wordSize = sizeof(void*);
+    header.statementCount = uint32_t(statements.size());
+    header.sourceSize = sourceSize;
+    header.sourceHash = sourceHash;
+    header.bodySize = body.size();
+    header.bodyHash = hashBytes(body.data(), body.size());
+
+    // The cache directory is created when the first cache is saved into it.
+    auto &directory = context->getScriptCacheDirectory();
+    if(!directory.empty() && !makeDirectory(directory))
+        return false;
+
+    // Write a temporary file, so a cache file is always complete.
+    auto temporaryFileName = fileName + ".tmp";
+    bool succeeded;
+    {
+        StdFile file(temporaryFileName, "wb");
+        if(!file)
+            return false;
+
+        succeeded = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(body.data(), 1, body.size(), file) == body.size();
+    }
+
+    if(!succeeded || rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+    {
+        remove(temporaryFileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+CompiledMethod *ScriptCache::loadStatementMethod(size_t index, Oop clazz)
+{
+    auto &statement = statements[index];
+    if(statement.kind == SCSK_Source)
+        return nullptr;
+
+    WithoutGC withoutGC(context);
+    ScriptCacheReader reader(context, statement.data);
+    return reader.readMethod(clazz);
+}
+
+void ScriptCache::addDoIt(CompiledMethod *doIt, bool isDefinition)
+{
+    Statement statement;
+    statement.kind = SCSK_DoIt;
+    statement.isDefinition = isDefinition;
+
+    // The doit does not use the instance variables of the script context.
+    ScriptCacheWriter writer(context, statement.data);
+    if(!writer.writeMethod(doIt, 0))
+    {
+        statement.kind = SCSK_Source;
+        statement.data.clear();
+    }
+
+    statements.push_back(std::move(statement));
+}
+
+void ScriptCache::addSourceStatement(bool isDefinition)
+{
+    Statement statement;
+    statement.kind = SCSK_Source;
+    statement.isDefinition = isDefinition;
+    statements.push_back(std::move(statement));
+}
+
+void ScriptCache::addMethodDefinition(AST::MethodAST *ast, bool isFunction)
+{
+    Statement statement;
+    statement.kind = isFunction ? SCSK_Function : SCSK_Method;
+    statement.isDefinition = true;
+    pendingDefinitions[ast] = statements.size();
+    statements.push_back(std::move(statement));
+}
+
+void ScriptCache::setDefinitionMethod(AST::MethodAST *ast, Oop clazz, CompiledMethod *method)
+{
+    auto it = pendingDefinitions.find(ast);
+    if(it == pendingDefinitions.end())
+        return;
+
+    auto &statement = statements[it->second];
+    pendingDefinitions.erase(it);
+
+    ScriptCacheWriter writer(context, statement.data);
+    if(!writer.writeMethod(method, instanceVariablesHashOf(clazz)))
+        statement.data.clear();
+}
+
+} // End of namespace Lodtalk
@@ -0,0 +1,137 @@
+#ifndef LODTALK_SCRIPT_CACHE_HPP
+#define LODTALK_SCRIPT_CACHE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "Lodtalk/ObjectModel.hpp"
+
+namespace Lodtalk
+{
+class VMContext;
+class CompiledMethod;
+class SourceBuffer;
+
+namespace AST
+{
+class MethodAST;
+}
+
+// The script cache file identification.
+static const char ScriptCacheMagic[8] = {'L', 'O', 'D', 'T', 'A', 'L', 'K', 'C'};
+static constexpr uint32_t ScriptCacheFormatVersion = 1;
+
+// The extension of the script cache files.
+static const char ScriptCacheExtension[] = ".lodtalkc";
+
+/**
+ * The header of a script cache file. The cache is only valid for the
+ * source whose contents have the same hash, and for the same VM.
+ */
+struct ScriptCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bytecodeSetVersion;
+    uint32_t wordSize;
+    uint32_t statementCount;
+
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    uint64_t bodySize;
+    uint64_t bodyHash;
+};
+
+// The kinds of the statements of a cached script.
+enum ScriptCacheStatementKind
+{
+    // The statement is compiled from the source.
+    SCSK_Source = 0,
+
+    // The statement is a compiled doit of the script context.
+    SCSK_DoIt,
+
+    // The statement defines a method of the current class, or a function of the global context.
+    SCSK_Method,
+    SCSK_Function,
+};
+
+/**
+ * Script cache. It keeps the compiled code of the statements of a script
+ * file, so that a script that did not change is executed without parsing
+ * and compiling it again. The cache file is next to the script, or in the
+ * script cache directory of the context.
+ *
+ * The literals are stored by value, and the global variables by name, so
+ * they are bound again when a statement is loaded. A statement that cannot
+ * be stored, or whose globals or instance variables changed since it was
+ * compiled, is compiled from the source.
+ *
+ * The methods of a script that is being recorded are not compiled lazily,
+ * because the cached methods are loaded without compiling them anyway.
+ */
+class ScriptCache
+{
+public:
+    ScriptCache(VMContext *context, const std::string &scriptFileName, const SourceBuffer &source);
+    ~ScriptCache();
+
+    const std::string &getFileName() const
+    {
+        return fileName;
+    }
+
+    // Loads the cache file. It fails when the file is missing, or when it was made for another source or VM.
+    bool load();
+
+    // Saves the recorded statements.
+    bool save();
+
+    size_t getStatementCount() const
+    {
+        return statements.size();
+    }
+
+    ScriptCacheStatementKind getStatementKind(size_t index) const
+    {
+        return ScriptCacheStatementKind(statements[index].kind);
+    }
+
+    bool isDefinitionStatement(size_t index) const
+    {
+        return statements[index].isDefinition;
+    }
+
+    // Creates the method of a cached statement for its class. It returns
+    // null when the statement has to be compiled from the source.
+    CompiledMethod *loadStatementMethod(size_t index, Oop clazz);
+
+    // Records the statements of the script, in order.
+    void addDoIt(CompiledMethod *doIt, bool isDefinition);
+    void addSourceStatement(bool isDefinition);
+
+    // The method of a definition can be compiled after the following statements.
+    void addMethodDefinition(AST::MethodAST *ast, bool isFunction);
+    void setDefinitionMethod(AST::MethodAST *ast, Oop clazz, CompiledMethod *method);
+
+private:
+    struct Statement
+    {
+        uint8_t kind;
+        bool isDefinition;
+        std::string data;
+    };
+
+    VMContext *context;
+    std::string fileName;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+
+    std::vector<Statement> statements;
+    std::unordered_map<AST::MethodAST*, size_t> pendingDefinitions;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_SCRIPT_CACHE_HPP
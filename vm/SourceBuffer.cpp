@@ -0,0 +1,120 @@
+#ifdef __unix__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "SourceBuffer.hpp"
+
+namespace Lodtalk
+{
+
+SourceBuffer::SourceBuffer()
+    : data(nullptr), size(0), mappedSize(0)
+{
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    release();
+}
+
+void SourceBuffer::release()
+{
+#ifdef __unix__
+    if(mappedSize)
+        munmap(data, mappedSize);
+    else
+#endif
+        free(data);
+
+    data = nullptr;
+    size = 0;
+    mappedSize = 0;
+}
+
+bool SourceBuffer::load(FILE *file)
+{
+    release();
+    return map(file) || read(file);
+}
+
+#ifdef __unix__
+bool SourceBuffer::map(FILE *file)
+{
+    // Only the whole regular files are mapped, without data in the stdio buffer.
+    auto fd = fileno(file);
+    struct stat fileStat;
+    if(fd < 0 || fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode))
+        return false;
+
+    if(ftell(file) != 0)
+        return false;
+
+    // The padding has to fit in the zero filled tail of the last page.
+    auto fileSize = size_t(fileStat.st_size);
+    auto pageSize = size_t(sysconf(_SC_PAGESIZE));
+    auto tailSize = fileSize % pageSize;
+    if(fileSize == 0 || tailSize == 0 || tailSize + SourceBufferPaddingSize > pageSize)
+        return false;
+
+    auto mappingSize = fileSize + pageSize - tailSize;
+    auto mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    // Leave the file at its end, as when it is read.
+    fseek(file, 0, SEEK_END);
+
+    data = reinterpret_cast<char*> (mapping);
+    size = fileSize;
+    mappedSize = mappingSize;
+    return true;
+}
+#else
+bool SourceBuffer::map(FILE *)
+{
+    return false;
+}
+#endif
+
+bool SourceBuffer::read(FILE *file)
+{
+    size_t capacity = 4096;
+    data = reinterpret_cast<char*> (malloc(capacity));
+    if(!data)
+        return false;
+
+    for(;;)
+    {
+        if(size + SourceBufferPaddingSize >= capacity)
+        {
+            capacity *= 2;
+            auto newData = reinterpret_cast<char*> (realloc(data, capacity));
+            if(!newData)
+            {
+                release();
+                return false;
+            }
+            data = newData;
+        }
+
+        auto readCount = fread(data + size, 1, capacity - size - SourceBufferPaddingSize, file);
+        size += readCount;
+        if(readCount == 0)
+            break;
+    }
+
+    if(ferror(file))
+    {
+        release();
+        return false;
+    }
+
+    memset(data + size, 0, SourceBufferPaddingSize);
+    return true;
+}
+
+} // End of namespace Lodtalk
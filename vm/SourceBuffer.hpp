@@ -0,0 +1,74 @@
+#ifndef LODTALK_SOURCE_BUFFER_HPP
+#define LODTALK_SOURCE_BUFFER_HPP
+
+#include <stddef.h>
+#include <stdio.h>
+
+namespace Lodtalk
+{
+
+// The scanner requires two null characters after the end of its buffer.
+static constexpr size_t SourceBufferPaddingSize = 2;
+
+/**
+ * Source buffer. It holds the whole contents of a source file, followed by
+ * the padding that is required by the scanner, so the tokens can refer to
+ * the source without copying it.
+ *
+ * Where it is supported, a regular file is mapped copy on write, because the
+ * scanner writes temporarily a null character after the current token. The
+ * other files, and the ones whose padding does not fit in the last page of
+ * the mapping, are read into memory.
+ */
+class SourceBuffer
+{
+public:
+    SourceBuffer();
+    ~SourceBuffer();
+
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    // Loads the contents of the file, from its current position.
+    bool load(FILE *file);
+    void release();
+
+    const char *getData() const
+    {
+        return data;
+    }
+
+    // The size of the source, without the padding.
+    size_t getSize() const
+    {
+        return size;
+    }
+
+    // The buffer of the scanner, with the padding.
+    char *getScannerBuffer()
+    {
+        return data;
+    }
+
+    size_t getScannerBufferSize() const
+    {
+        return size + SourceBufferPaddingSize;
+    }
+
+    bool isMapped() const
+    {
+        return mappedSize != 0;
+    }
+
+private:
+    bool map(FILE *file);
+    bool read(FILE *file);
+
+    char *data;
+    size_t size;
+    size_t mappedSize;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_SOURCE_BUFFER_HPP
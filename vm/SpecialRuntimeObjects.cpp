@@ -1,3 +1,4 @@
+#include <string.h>
 #include "MemoryManager.hpp"
 #include "SpecialRuntimeObjects.hpp"
 
@@ -21,9 +22,25 @@ void SpecialRuntimeObjects::initialize()
     registerGCRoots();
 }
 
+void SpecialRuntimeObjects::initializeFromImage()
+{
+    WithoutGC wgc(context);
+
+    // The selectors are found in the symbol table of the image.
+    createSpecialObjectTable();
+
+    // The special classes are in the class table of the image.
+    auto classTable = context->getMemoryManager()->getClassTable();
+    specialClassTable.resize(SpecialClassTableSize);
+    for(size_t i = 0; i < SpecialClassTableSize; ++i)
+        specialClassTable[i] = classTable->getClassFromIndex(i);
+
+    registerGCRoots();
+}
+
 Oop SpecialRuntimeObjects::makeSelector(const char *string)
 {
-    return context->makeSelector(string);
+    return context->makeSelector(string, strlen(string));
 }
 
 void SpecialRuntimeObjects::createSpecialObjectTable()
@@ -118,6 +135,11 @@ void SpecialRuntimeObjects::createSpecialObjectTable()
     // Iteration
     specialObjectTable.push_back(makeSelector("to:by:do:"));
     specialObjectTable.push_back(makeSelector("to:do:"));
+    specialObjectTable.push_back(makeSelector("timesRepeat:"));
+
+    // Logic
+    specialObjectTable.push_back(makeSelector("and:"));
+    specialObjectTable.push_back(makeSelector("or:"));
 
     compilerMessageSelectorCount = specialObjectTable.size() - compilerMessageSelectorFirst;
     assert(compilerMessageSelectorCount == (size_t)CompilerOptimizedSelector::CompilerMessageCount);
@@ -16,6 +16,7 @@ public:
 	~SpecialRuntimeObjects();
 
     void initialize();
+    void initializeFromImage();
 
 	void createSpecialObjectTable();
 	void createSpecialClassTable();
@@ -2,6 +2,7 @@
 #include <math.h>
 #include "StackInterpreter.hpp"
 #include "StackMemory.hpp"
+#include "MemoryManager.hpp"
 #include "BytecodeSets.hpp"
 #include "Constants.hpp"
 #include "Lodtalk/Exception.hpp"
@@ -74,6 +75,7 @@ public:
     // Message send.
     virtual void sendMessage(int argumentCount) override;
     virtual void sendMessageWithSelector(Oop selector, int argumentCount) override;
+    virtual void executeMethod(Oop method, int argumentCount) override;
 
 private:
     StackInterpreter *interpreter;
@@ -89,8 +91,10 @@ private:
 	// Use the stack memory.
     VMContext *context;
 	StackMemory *stack;
+    GarbageCollector *garbageCollector;
 
 	// Interpreter data.
+	const size_t *oldInstructionPointerLocation;
 	size_t pc;
 	int nextOpcode;
 	int currentOpcode;
@@ -431,7 +435,9 @@ public:
 
 	void setInstanceVariable(size_t index, Oop value)
 	{
-		reinterpret_cast<Oop*> (currentReceiver().getFirstFieldPointer())[index] = value;
+        auto &slot = reinterpret_cast<Oop*> (currentReceiver().getFirstFieldPointer())[index];
+        garbageCollector->writeBarrier(slot, value);
+		slot = value;
 	}
 
 	Oop getLiteral(size_t index)
@@ -534,6 +540,7 @@ public:
 
         // Cast the literal variable and set its value.
         auto literalVar = reinterpret_cast<LiteralVariable*> (literal.pointer);
+        garbageCollector->writeBarrier(literalVar->value, value);
         literalVar->value = value;
     }
 
@@ -571,7 +578,7 @@ public:
         if (isNil(lookupClass))
             return nilOop();
 
-    	return lookupClass->lookupSelector(selector);
+    	return lookupClass->lookupSelector(context, selector);
     }
 
 	void sendSelectorArgumentCount(Oop selector, size_t argumentCount, bool superLookup = false)
@@ -664,6 +671,19 @@ public:
         sendSelectorArgumentCount(popOop(), argumentCount);
     }
 
+    void executeMethodArgumentCount(Oop methodOop, size_t argumentCount)
+    {
+        auto compiledMethod = reinterpret_cast<CompiledMethod*> (methodOop.pointer);
+        assert(classIndexOf(methodOop) == SCI_CompiledMethod);
+        assert(compiledMethod->getArgumentCount() == argumentCount);
+
+        // Push the return PC.
+        pushPC();
+
+        // Activate the method without looking it up.
+        activateMethodFrame(compiledMethod);
+    }
+
     void sendBasicNew()
     {
         sendSelectorArgumentCount(context->getSpecialMessageSelector(SpecialMessageSelector::BasicNew), 0);
@@ -1115,12 +1135,22 @@ private:
 
 	void interpretPopStoreReceiverVariable()
 	{
-		LODTALK_UNIMPLEMENTED();
+        // Fetch the instruction data.
+        auto variableIndex = fetchByte() + extendA*256;
+        fetchNextInstructionOpcode();
+        extendA = 0;
+
+        setInstanceVariable(variableIndex, popOop());
 	}
 
 	void interpretPopStoreLiteralVariable()
 	{
-		LODTALK_UNIMPLEMENTED();
+        // Fetch the instruction data.
+        auto literalVariableIndex = fetchByte() + extendA*256;
+        fetchNextInstructionOpcode();
+        extendA = 0;
+
+        storeLiteralVariable(literalVariableIndex, popOop());
 	}
 
 	void interpretPopStoreTemporalVariable()
@@ -1190,6 +1220,7 @@ private:
 
         // Set the temporary.
         auto vectorData = reinterpret_cast<Oop*> (vector.getFirstFieldPointer());
+        garbageCollector->writeBarrier(vectorData[temporalIndex], stackOopAt(0));
         vectorData[temporalIndex] = stackOopAt(0);
     }
 
@@ -1206,7 +1237,9 @@ private:
 
         // Set the temporary.
         auto vectorData = reinterpret_cast<Oop*> (vector.getFirstFieldPointer());
-        vectorData[temporalIndex] = popOop();
+        auto value = popOop();
+        garbageCollector->writeBarrier(vectorData[temporalIndex], value);
+        vectorData[temporalIndex] = value;
     }
 
     void interpretPushClosure()
@@ -1935,10 +1968,16 @@ private:
 StackInterpreter::StackInterpreter(VMContext *context, StackMemory *stack)
 	: context(context), stack(stack), pc(0), nextOpcode(0), currentOpcode(0)
 {
+    garbageCollector = context->getMemoryManager()->getGarbageCollector();
+
+    // Publish the pc, for the allocation profiler.
+    oldInstructionPointerLocation = stack->getInstructionPointerLocation();
+    stack->setInstructionPointerLocation(&pc);
 }
 
 StackInterpreter::~StackInterpreter()
 {
+    stack->setInstructionPointerLocation(oldInstructionPointerLocation);
 }
 
 void StackInterpreter::activateMethodFrame(CompiledMethod *newMethod)
@@ -1980,8 +2019,8 @@ void StackInterpreter::activateMethodFrame(CompiledMethod *newMethod)
 	// Fetch the frame data.
 	fetchFrameData();
 
-	// Set the instruction pointer.
-	pc = newMethod->getFirstPCOffset();
+	// Set the instruction pointer. The method could have been moved by the GC.
+	pc = method->getFirstPCOffset();
 
     // Check for stack overflow.
     checkStackOverflow();
@@ -2345,6 +2384,12 @@ void StackInterpreterProxy::sendMessageWithSelector(Oop selector, int argumentCo
     interpreter->interpret();
 }
 
+void StackInterpreterProxy::executeMethod(Oop method, int argumentCount)
+{
+    interpreter->executeMethodArgumentCount(method, argumentCount);
+    interpreter->interpret();
+}
+
 void VMContext::withInterpreter(const WithInterpreterBlock &block)
 {
     withStackMemory(this, [&](StackMemory *stack) {
@@ -131,7 +131,7 @@ void StackFrame::updateMarriedSpouseState()
 
 // Stack memory for a single thread.
 StackMemory::StackMemory(VMContext *context)
-    : context(context)
+    : context(context), instructionPointerLocation(nullptr)
 {
     stackSize = StackMemoryPageSize*StackPageCount;
     stackMemoryLowest = new uint8_t[stackSize];
@@ -291,6 +291,11 @@ void StackMemory::makeBaseFrame(Context *context)
 // Interface for accessing the stack memory for the current native thread.
 static thread_local StackMemory *currentStackMemory = nullptr;
 
+StackMemory *getCurrentStackMemory()
+{
+    return currentStackMemory;
+}
+
 void withStackMemory(VMContext *context, const StackMemoryEntry &entryPoint)
 {
 	if(currentStackMemory && currentStackMemory->getContext() == context)
@@ -409,6 +409,17 @@ public:
 		return stackFrame;
 	}
 
+    // The instruction pointer of the interpreter that is using this stack.
+    inline const size_t *getInstructionPointerLocation()
+    {
+        return instructionPointerLocation;
+    }
+
+    inline void setInstructionPointerLocation(const size_t *newLocation)
+    {
+        instructionPointerLocation = newLocation;
+    }
+
     inline int getArgumentCount()
     {
         return stackFrame.getArgumentCount();
@@ -492,6 +503,7 @@ private:
 
     StackPage *currentPage;
     StackFrame stackFrame;
+    const size_t *instructionPointerLocation;
     size_t stackSize;
     uint8_t *stackMemoryLowest;
     uint8_t *stackMemoryHighest;
@@ -534,6 +546,7 @@ private:
 typedef std::function<void (StackMemory*) > StackMemoryEntry;
 
 void withStackMemory(VMContext *context, const StackMemoryEntry &entryPoint);
+StackMemory *getCurrentStackMemory();
 
 } // End of namespace Lodtalk
 
@@ -0,0 +1,157 @@
+#include <string.h>
+#include "Lodtalk/VMContext.hpp"
+#include "Lodtalk/Collections.hpp"
+#include "SymbolTable.hpp"
+#include "MemoryManager.hpp"
+
+namespace Lodtalk
+{
+
+SymbolTable::SymbolTable(MemoryManager *memoryManager)
+    : memoryManager(memoryManager), symbolCount(0)
+{
+}
+
+SymbolTable::~SymbolTable()
+{
+}
+
+uint32_t SymbolTable::hashOf(const char *data, size_t size)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= uint8_t(data[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+Oop *SymbolTable::getSlots()
+{
+    return reinterpret_cast<Oop*> (table.getFirstFieldPointer());
+}
+
+size_t SymbolTable::getCapacity()
+{
+    return table.getSlotCount();
+}
+
+size_t SymbolTable::findSlot(Oop *slots, size_t capacity, const char *data, size_t size, uint32_t hash)
+{
+    auto mask = capacity - 1;
+    auto index = hash & mask;
+    for(;;)
+    {
+        auto symbol = slots[index];
+        if(isNil(symbol))
+            return index;
+
+        if(symbol.getNumberOfElements() == size && !memcmp(symbol.getFirstFieldPointer(), data, size))
+            return index;
+
+        index = (index + 1) & mask;
+    }
+}
+
+void SymbolTable::insertIntoSlots(Oop *slots, size_t capacity, Oop symbol)
+{
+    auto data = reinterpret_cast<const char*> (symbol.getFirstFieldPointer());
+    auto size = symbol.getNumberOfElements();
+    slots[findSlot(slots, capacity, data, size, hashOf(data, size))] = symbol;
+}
+
+void SymbolTable::grow()
+{
+    // The table is a weak array, so the symbols are not kept alive by it.
+    auto context = memoryManager->getContext();
+    auto newCapacity = isNil(table) ? InitialSymbolTableCapacity : getCapacity()*2;
+    auto newTable = Oop::fromPointer(context->newObject(0, newCapacity, OF_WEAK_VARIABLE_SIZE, SCI_Array));
+    auto newSlots = reinterpret_cast<Oop*> (newTable.getFirstFieldPointer());
+
+    if(!isNil(table))
+    {
+        auto slots = getSlots();
+        auto capacity = getCapacity();
+        for(size_t i = 0; i < capacity; ++i)
+        {
+            if(!isNil(slots[i]))
+                insertIntoSlots(newSlots, newCapacity, slots[i]);
+        }
+    }
+
+    table = newTable;
+}
+
+void SymbolTable::closeProbeGaps(size_t emptySlot)
+{
+    auto slots = getSlots();
+    auto capacity = getCapacity();
+    auto mask = capacity - 1;
+
+    // Start after a slot that was empty before the removal, so no probe
+    // sequence crosses the start, and each one is visited from its beginning.
+    auto start = emptySlot;
+
+    // Move each symbol to the first empty slot of its probe sequence.
+    for(size_t i = 1; i < capacity; ++i)
+    {
+        auto index = (start + i) & mask;
+        auto symbol = slots[index];
+        if(isNil(symbol))
+            continue;
+
+        auto data = reinterpret_cast<const char*> (symbol.getFirstFieldPointer());
+        auto destIndex = hashOf(data, symbol.getNumberOfElements()) & mask;
+        while(destIndex != index && !isNil(slots[destIndex]))
+            destIndex = (destIndex + 1) & mask;
+
+        if(destIndex != index)
+        {
+            slots[destIndex] = symbol;
+            slots[index] = Oop();
+        }
+    }
+}
+
+Oop SymbolTable::lookup(const char *data, size_t size)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    if(isNil(table))
+        return Oop();
+
+    auto symbol = getSlots()[findSlot(getSlots(), getCapacity(), data, size, hashOf(data, size))];
+
+    // The symbol could be only reachable from the table during the incremental marking.
+    memoryManager->getGarbageCollector()->writeBarrier(Oop(), symbol);
+    return symbol;
+}
+
+Oop SymbolTable::intern(const char *data, size_t size)
+{
+    std::unique_lock<std::mutex> l(mutex);
+
+    // Keep the table at most half full.
+    if(isNil(table) || (symbolCount + 1)*2 > getCapacity())
+        grow();
+
+    // Find existing internation
+    auto slots = getSlots();
+    auto index = findSlot(slots, getCapacity(), data, size, hashOf(data, size));
+    if(!isNil(slots[index]))
+    {
+        memoryManager->getGarbageCollector()->writeBarrier(Oop(), slots[index]);
+        return slots[index];
+    }
+
+    // Create the byte symbol. The allocation does not move the table.
+    auto symbol = Oop::fromPointer(ByteSymbol::basicNativeNew(memoryManager->getContext(), size));
+    memcpy(symbol.getFirstFieldPointer(), data, size);
+    slots[index] = symbol;
+    ++symbolCount;
+    return symbol;
+}
+
+} // End of namespace Lodtalk
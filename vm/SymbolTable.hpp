@@ -0,0 +1,106 @@
+#ifndef LODTALK_SYMBOL_TABLE_HPP
+#define LODTALK_SYMBOL_TABLE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include "Lodtalk/ObjectModel.hpp"
+
+namespace Lodtalk
+{
+class MemoryManager;
+
+// The symbol table capacity is a power of two. It grows when it is half full.
+static constexpr size_t InitialSymbolTableCapacity = 1024;
+
+/**
+ * The symbol table. It is an open addressing hash table with linear probing,
+ * stored in a weak array in the heap. The symbols are hashed on their bytes,
+ * so they can be looked up from a native range without allocating a string.
+ * The unused symbols are removed by the garbage collector. The symbols can be
+ * interned and looked up from several threads.
+ */
+class SymbolTable
+{
+public:
+    SymbolTable(MemoryManager *memoryManager);
+    ~SymbolTable();
+
+    // Gets the symbol with the given bytes, creating it if it does not exist.
+    Oop intern(const char *data, size_t size);
+
+    // Gets the symbol with the given bytes, or nil if it does not exist.
+    Oop lookup(const char *data, size_t size);
+
+    size_t getSymbolCount() const
+    {
+        return symbolCount;
+    }
+
+    // The table array is a root of the garbage collector.
+    Oop &getTableOop()
+    {
+        return table;
+    }
+
+    // Uses the table array of an image.
+    void restore(Oop newTable, size_t newSymbolCount)
+    {
+        table = newTable;
+        symbolCount = newSymbolCount;
+    }
+
+    // Removes the symbols that satisfy the predicate. Returns the number of removed symbols.
+    template<typename FT>
+    size_t removeSymbolsIf(const FT &predicate)
+    {
+        if(isNil(table))
+            return 0;
+
+        auto slots = getSlots();
+        auto capacity = getCapacity();
+        size_t removedCount = 0;
+        size_t firstEmptySlot = capacity;
+        for(size_t i = 0; i < capacity; ++i)
+        {
+            if(isNil(slots[i]))
+            {
+                if(firstEmptySlot == capacity)
+                    firstEmptySlot = i;
+            }
+            else if(predicate(slots[i]))
+            {
+                slots[i] = Oop();
+                ++removedCount;
+            }
+        }
+
+        if(removedCount)
+        {
+            symbolCount -= removedCount;
+            closeProbeGaps(firstEmptySlot);
+        }
+        return removedCount;
+    }
+
+    static uint32_t hashOf(const char *data, size_t size);
+
+private:
+    Oop *getSlots();
+    size_t getCapacity();
+
+    // Gets the slot of the symbol, or the empty slot where it should be inserted.
+    size_t findSlot(Oop *slots, size_t capacity, const char *data, size_t size, uint32_t hash);
+    void insertIntoSlots(Oop *slots, size_t capacity, Oop symbol);
+    void grow();
+    void closeProbeGaps(size_t emptySlot);
+
+    MemoryManager *memoryManager;
+    Oop table;
+    size_t symbolCount;
+    std::mutex mutex;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_SYMBOL_TABLE_HPP
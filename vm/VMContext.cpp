@@ -1,23 +1,40 @@
+#include <algorithm>
+#include <thread>
 #include "Lodtalk/VMContext.hpp"
 #include "Compiler.hpp"
 #include "StackInterpreter.hpp"
 #include "SpecialRuntimeObjects.hpp"
 #include "MemoryManager.hpp"
+#include "AllocationProfiler.hpp"
 #include "StackMemory.hpp"
 #include "ClassFactoryRegistry.hpp"
+#include "ImageSnapshot.hpp"
 
 namespace Lodtalk
 {
 static thread_local VMContext *currentContext = nullptr;
 
 VMContext::VMContext()
+    : VMContext(true)
 {
-    initialize();
+}
+
+VMContext::VMContext(bool bootstrap)
+    : memoryManager(nullptr), specialRuntimeObjects(nullptr), globalDictionary(nullptr), compilerStatistics(new CompilerStatistics()),
+      lazyMethodCompilation(false), lazyMethodTable(new LazyMethodTable(this)), scriptCacheEnabled(false)
+{
+    compilerThreadCount = std::max(1u, std::thread::hardware_concurrency());
+    if(bootstrap)
+        initialize();
 }
 
 VMContext::~VMContext()
 {
     ClassFactoryRegistry::get()->unregisterVMContext(this);
+    delete lazyMethodTable;
+    delete compilerStatistics;
+    delete specialRuntimeObjects;
+    delete memoryManager;
 }
 
 void VMContext::initialize()
@@ -29,6 +46,46 @@ void VMContext::initialize()
     instanceClassFactories();
 }
 
+VMContext *VMContext::loadImage(const std::string &fileName)
+{
+    auto context = new VMContext(false);
+    if(!context->initializeFromImage(fileName))
+    {
+        delete context;
+        return nullptr;
+    }
+
+    return context;
+}
+
+bool VMContext::initializeFromImage(const std::string &fileName)
+{
+    memoryManager = new MemoryManager(this);
+    specialRuntimeObjects = new SpecialRuntimeObjects(this);
+    WithoutGC wgc(this);
+
+    // Load the object memory.
+    Oop globals;
+    if(!ImageSnapshot(this).load(fileName, globals))
+        return false;
+    globalDictionary = reinterpret_cast<SystemDictionary*> (globals.pointer);
+    registerGCRoot((Oop*)&globalDictionary, 1);
+
+    // Bind the native parts of the runtime again.
+    specialRuntimeObjects->initializeFromImage();
+    ClassFactoryRegistry::get()->rebindVMContext(this);
+    return true;
+}
+
+bool VMContext::saveImage(const std::string &fileName)
+{
+    // The stubs point to the trees of the scripts, which are not saved.
+    withInterpreter([&](InterpreterProxy *) {
+        compileLazyMethods();
+    });
+    return ImageSnapshot(this).save(fileName, (Oop*)&globalDictionary);
+}
+
 void VMContext::executeDoIt(const std::string &code)
 {
     withInterpreter([&](InterpreterProxy *interpreter) {
@@ -68,6 +125,11 @@ void VMContext::enableGC()
     memoryManager->getGarbageCollector()->enable();
 }
 
+void VMContext::collectGarbage()
+{
+    memoryManager->getGarbageCollector()->queueExplicitCollection();
+}
+
 void VMContext::registerGCRoot(Oop *gcroot, size_t size)
 {
 	memoryManager->getGarbageCollector()->registerGCRoot(gcroot, size);
@@ -93,14 +155,151 @@ bool VMContext::garbageCollectionSafePoint()
     return memoryManager->getGarbageCollector()->collectionSafePoint();
 }
 
+void VMContext::writeBarrier(Oop oldValue, Oop newValue)
+{
+    memoryManager->getGarbageCollector()->writeBarrier(oldValue, newValue);
+}
+
+void VMContext::setIncrementalMarking(bool enabled, size_t pauseBudgetMicroseconds)
+{
+    memoryManager->getGarbageCollector()->setIncrementalMarking(enabled, pauseBudgetMicroseconds);
+}
+
+void VMContext::setCompactionThreshold(size_t percentage)
+{
+    memoryManager->getGarbageCollector()->setCompactionThreshold(percentage);
+}
+
+void VMContext::setMaxHeapSize(size_t size)
+{
+    memoryManager->getGarbageCollector()->setVMParameter(VMP_MaxHeapSize, size);
+}
+
+void VMContext::setInitialHeapSize(size_t size)
+{
+    memoryManager->getGarbageCollector()->setVMParameter(VMP_InitialHeapSize, size);
+}
+
+void VMContext::setTargetGCRatio(size_t percentage)
+{
+    memoryManager->getGarbageCollector()->setVMParameter(VMP_TargetGCRatio, percentage);
+}
+
+void VMContext::enableHugePages()
+{
+    memoryManager->getHeap()->enableHugePages();
+}
+
+bool VMContext::getVMParameter(int index, int64_t &result)
+{
+    return memoryManager->getGarbageCollector()->getVMParameter(index, result);
+}
+
+bool VMContext::setVMParameter(int index, int64_t value)
+{
+    return memoryManager->getGarbageCollector()->setVMParameter(index, value);
+}
+
+bool VMContext::setGCLogFile(const std::string &fileName)
+{
+    return memoryManager->getGarbageCollector()->setLogFile(fileName);
+}
+
+void VMContext::getGCStatistics(std::vector<int64_t> &counters)
+{
+    memoryManager->getGarbageCollector()->getStatisticsCounters(counters);
+}
+
+// Allocation profiler
+void VMContext::setAllocationSamplingInterval(size_t bytes)
+{
+    memoryManager->getAllocationProfiler()->setSamplingInterval(bytes);
+}
+
+void VMContext::writeAllocationProfile(FILE *output)
+{
+    memoryManager->getAllocationProfiler()->writeReport(output);
+}
+
+void VMContext::resetAllocationProfile()
+{
+    memoryManager->getAllocationProfiler()->reset();
+}
+
+// Compiler
+void VMContext::setCompilerThreadCount(size_t count)
+{
+    compilerThreadCount = std::max(size_t(1), count);
+}
+
+size_t VMContext::getCompilerThreadCount() const
+{
+    return compilerThreadCount;
+}
+
+void VMContext::setLazyMethodCompilation(bool enabled)
+{
+    lazyMethodCompilation = enabled;
+}
+
+bool VMContext::isLazyMethodCompilationEnabled() const
+{
+    return lazyMethodCompilation;
+}
+
+LazyMethodTable *VMContext::getLazyMethodTable()
+{
+    return lazyMethodTable;
+}
+
+Oop VMContext::compileLazyMethod(Oop stub)
+{
+    return lazyMethodTable->compile(stub);
+}
+
+void VMContext::compileLazyMethods()
+{
+    lazyMethodTable->compileAll();
+}
+
+void VMContext::setScriptCacheEnabled(bool enabled)
+{
+    scriptCacheEnabled = enabled;
+}
+
+bool VMContext::isScriptCacheEnabled() const
+{
+    return scriptCacheEnabled;
+}
+
+void VMContext::setScriptCacheDirectory(const std::string &directory)
+{
+    scriptCacheDirectory = directory;
+}
+
+const std::string &VMContext::getScriptCacheDirectory() const
+{
+    return scriptCacheDirectory;
+}
+
+CompilerStatistics *VMContext::getCompilerStatistics()
+{
+    return compilerStatistics;
+}
+
+void VMContext::writeCompilerStatistics(FILE *output)
+{
+    compilerStatistics->writeReport(output);
+}
+
 void VMContext::registerNativeObject(Oop object)
 {
     memoryManager->getGarbageCollector()->registerNativeObject(object);
 }
 
-uint8_t *VMContext::allocateObjectMemory(size_t objectSize, bool bigObject)
+uint8_t *VMContext::allocateObjectMemory(size_t objectSize, bool bigObject, bool pinned)
 {
-	return memoryManager->getGarbageCollector()->allocateObjectMemory(objectSize, bigObject);
+	return memoryManager->getGarbageCollector()->allocateObjectMemory(objectSize, bigObject, pinned);
 }
 
 MemoryManager *VMContext::getMemoryManager()
@@ -176,6 +375,28 @@ unsigned int VMContext::instanceClassFactory(AbstractClassFactory *factory)
     return classIndex;
 }
 
+bool VMContext::rebindClassFactory(AbstractClassFactory *factory)
+{
+    // Find the class in the image.
+    Oop clazz;
+    if(factory->getSpecialClassIndex() >= 0)
+        clazz = getClassFromIndex(factory->getSpecialClassIndex());
+    else
+        clazz = getGlobalValueFromName(factory->getName());
+    if(!isClass(clazz))
+        return false;
+
+    // The identity hash of a class is its index.
+    instancedClassFactories[factory] = clazz.header->identityHash;
+
+    // Build the class again for getting its native methods.
+    auto metaclass = getClassFromOop(clazz);
+    ClassBuilder builder(this, reinterpret_cast<Class*> (clazz.pointer), reinterpret_cast<Metaclass*> (metaclass.pointer));
+    factory->build(builder);
+    builder.rebindNativeMethods();
+    return true;
+}
+
 PrimitiveFunction VMContext::findPrimitive(int primitiveIndex)
 {
     auto it = numberedPrimitives.find(primitiveIndex);
@@ -200,6 +421,11 @@ LODTALK_VM_EXPORT VMContext *createVMContext()
     return new VMContext();
 }
 
+LODTALK_VM_EXPORT VMContext *createVMContextFromImage(const std::string &fileName)
+{
+    return VMContext::loadImage(fileName);
+}
+
 LODTALK_VM_EXPORT VMContext *getCurrentContext()
 {
     return currentContext;
@@ -0,0 +1,92 @@
+#include "Lodtalk/VMContext.hpp"
+#include "WorkerPool.hpp"
+
+namespace Lodtalk
+{
+
+WorkerPool::WorkerPool(VMContext *context)
+    : context(context), shuttingDown(false), jobGeneration(0), jobThreadCount(0), activeThreadCount(0),
+      jobFunction(nullptr), jobFunctionData(nullptr), jobCount(0), nextJobIndex(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        shuttingDown = true;
+    }
+
+    jobStarted.notify_all();
+    for(auto &thread : threads)
+        thread.join();
+}
+
+void WorkerPool::run(size_t count, size_t workerCount, JobFunction function, void *functionData)
+{
+    std::unique_lock<std::mutex> jobLock(jobMutex);
+
+    // Start the job. The current thread is one of its workers.
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        while(threads.size() < workerCount - 1)
+            threads.push_back(std::thread(&WorkerPool::workerMain, this, threads.size(), jobGeneration));
+
+        jobFunction = function;
+        jobFunctionData = functionData;
+        jobCount = count;
+        nextJobIndex = 0;
+        jobThreadCount = workerCount - 1;
+        activeThreadCount = jobThreadCount;
+        ++jobGeneration;
+    }
+    jobStarted.notify_all();
+
+    claimJobIndices();
+
+    // Wait for the other workers.
+    std::unique_lock<std::mutex> l(mutex);
+    jobFinished.wait(l, [&]() {
+        return activeThreadCount == 0;
+    });
+}
+
+void WorkerPool::claimJobIndices()
+{
+    size_t index;
+    while((index = nextJobIndex.fetch_add(1)) < jobCount)
+        jobFunction(jobFunctionData, index);
+}
+
+void WorkerPool::workerMain(size_t workerIndex, uint64_t startGeneration)
+{
+    setCurrentContext(context);
+
+    auto generation = startGeneration;
+    for(;;)
+    {
+        // Wait for a job that needs this worker.
+        {
+            std::unique_lock<std::mutex> l(mutex);
+            jobStarted.wait(l, [&]() {
+                return shuttingDown || jobGeneration != generation;
+            });
+            if(shuttingDown)
+                break;
+
+            generation = jobGeneration;
+            if(workerIndex >= jobThreadCount)
+                continue;
+        }
+
+        claimJobIndices();
+
+        std::unique_lock<std::mutex> l(mutex);
+        if(--activeThreadCount == 0)
+            jobFinished.notify_all();
+    }
+
+    setCurrentContext(nullptr);
+}
+
+} // End of namespace Lodtalk
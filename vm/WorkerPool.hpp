@@ -0,0 +1,84 @@
+#ifndef LODTALK_WORKER_POOL_HPP
+#define LODTALK_WORKER_POOL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Lodtalk
+{
+class VMContext;
+
+/**
+ * Worker pool. Its threads are started the first time that they are needed,
+ * and they are kept until the pool is destroyed, so the parallel phases of
+ * the garbage collector and of the compiler do not create threads. The
+ * workers run in the context that owns the pool. A single job runs at a time.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool(VMContext *context);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Calls the function with each index below the count. The indices are claimed in ascending
+    // order by up to the given number of threads, including the current one, which waits for the others.
+    template<typename FT>
+    void parallelFor(size_t count, size_t threadCount, const FT &f)
+    {
+        auto workerCount = std::min(threadCount, count);
+        if(workerCount <= 1)
+        {
+            for(size_t i = 0; i < count; ++i)
+                f(i);
+            return;
+        }
+
+        run(count, workerCount, &callJobFunction<FT>, const_cast<FT*> (&f));
+    }
+
+private:
+    typedef void (*JobFunction)(void *function, size_t index);
+
+    template<typename FT>
+    static void callJobFunction(void *function, size_t index)
+    {
+        (*reinterpret_cast<const FT*> (function))(index);
+    }
+
+    void run(size_t count, size_t workerCount, JobFunction function, void *functionData);
+    void claimJobIndices();
+    void workerMain(size_t workerIndex, uint64_t startGeneration);
+
+    VMContext *context;
+
+    // Serializes the jobs.
+    std::mutex jobMutex;
+
+    std::mutex mutex;
+    std::condition_variable jobStarted;
+    std::condition_variable jobFinished;
+    std::vector<std::thread> threads;
+    bool shuttingDown;
+
+    // The current job.
+    uint64_t jobGeneration;
+    size_t jobThreadCount;
+    size_t activeThreadCount;
+    JobFunction jobFunction;
+    void *jobFunctionData;
+    size_t jobCount;
+    std::atomic<size_t> nextJobIndex;
+};
+
+} // End of namespace Lodtalk
+
+#endif //LODTALK_WORKER_POOL_HPP